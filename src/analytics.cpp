@@ -0,0 +1,339 @@
+#include "analytics.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+#include <string>
+#include <omp.h>
+#include "force_kernels.hpp"
+
+namespace {
+
+// Candidates whose distances are computed together.
+constexpr uint32_t PAIR_CHUNK = 64;
+
+// Union-find over the parent array, shared by all threads. A root only
+// ever gets linked under a smaller root, by compare-and-swap, and path
+// halving only replaces a parent by one of its ancestors, so concurrent
+// finds and unions stay consistent without locks.
+uint32_t find_root(uint32_t* parent, uint32_t v) {
+    for (;;) {
+        const uint32_t p = std::atomic_ref<uint32_t>(parent[v]).load(std::memory_order_acquire);
+        if (p == v) return v;
+        const uint32_t grandparent = std::atomic_ref<uint32_t>(parent[p]).load(std::memory_order_acquire);
+        if (grandparent != p) std::atomic_ref<uint32_t>(parent[v]).store(grandparent, std::memory_order_release);
+        v = grandparent;
+    }
+}
+
+void unite(uint32_t* parent, uint32_t a, uint32_t b) {
+    for (;;) {
+        a = find_root(parent, a);
+        b = find_root(parent, b);
+        if (a == b) return;
+        if (a < b) std::swap(a, b);
+        uint32_t expected = a;
+        if (std::atomic_ref<uint32_t>(parent[a]).compare_exchange_weak(expected, b, std::memory_order_acq_rel)) return;
+    }
+}
+
+} // namespace
+
+void StructureAnalytics::sweep_pairs(const StructureInput& input, float link_sq, float range) {
+    const SpatialGrid& grid = *input.grid;
+    const int num_cells = grid.num_cells();
+    const int bins = latest_.rdf_bins;
+    const int types = latest_.rdf_types;
+    const size_t stride = thread_rdf_stride();
+    const float range_sq = range * range;
+    const float bin_scale = bins / range;
+    const float width = input.world_width;
+    const float height = input.world_height;
+    const float* px = input.x;
+    const float* py = input.y;
+    const uint8_t* pt = input.type;
+    uint32_t* parent = parent_.data();
+
+    // Histogram offset of each ordered type pair.
+    pair_offset_.resize(std::max(1, types * types));
+    pair_offset_[0] = 0;
+    for (int a = 0; a < types; ++a) {
+        for (int b = 0; b < types; ++b) {
+            pair_offset_[a * types + b] = static_cast<uint32_t>(rdf_pair_index(a, b, types) * bins);
+        }
+    }
+    const uint32_t* pair_offset = pair_offset_.data();
+
+#pragma omp parallel
+    {
+#pragma omp single
+        thread_rdf_.assign(static_cast<size_t>(omp_get_num_threads()) * stride, 0);
+
+        uint64_t* histogram = thread_rdf_.data() + static_cast<size_t>(omp_get_thread_num()) * stride;
+        float d_sq[PAIR_CHUNK];
+        int bin[PAIR_CHUNK];
+        uint32_t hits[PAIR_CHUNK];
+        uint32_t range_begin[MAX_NEIGHBOR_RANGES];
+        uint32_t range_end[MAX_NEIGHBOR_RANGES];
+
+        // Each particle of [begin, end) against the stencil ranges, past its
+        // own index so every pair is taken once, from its lower end.
+        // Distances and bins are computed a chunk at a time in a loop the
+        // compiler vectorizes, the pairs in range are compacted without
+        // branches, and only those within the link distance take the
+        // union-find path.
+        auto visit_pairs = [&]<bool PerType>(uint32_t begin, uint32_t end, int num_ranges) {
+            for (uint32_t i = begin; i < end; ++i) {
+                const float xi = px[i];
+                const float yi = py[i];
+                const uint32_t* offsets = pair_offset + (PerType ? pt[i] * types : 0);
+                uint32_t root_i = UINT32_MAX;
+
+                for (int r = 0; r < num_ranges; ++r) {
+                    for (uint32_t first = std::max(range_begin[r], i + 1); first < range_end[r]; first += PAIR_CHUNK) {
+                        const uint32_t n = std::min<uint32_t>(PAIR_CHUNK, range_end[r] - first);
+                        for (uint32_t k = 0; k < n; ++k) {
+                            // Nearest image from the absolute offsets; min and
+                            // fabs vectorize where compare-and-select does not.
+                            const float ax = std::fabs(px[first + k] - xi);
+                            const float ay = std::fabs(py[first + k] - yi);
+                            const float dx = std::min(ax, width - ax);
+                            const float dy = std::min(ay, height - ay);
+                            d_sq[k] = dx * dx + dy * dy;
+                            // d = d^2 / sqrt(d^2); the estimate's error only moves shell edges by 0.2%.
+                            bin[k] = std::min(static_cast<int>(d_sq[k] * fast_inv_sqrt(d_sq[k]) * bin_scale), bins - 1);
+                        }
+
+                        uint32_t num_hits = 0;
+                        for (uint32_t k = 0; k < n; ++k) {
+                            hits[num_hits] = (PerType ? offsets[pt[first + k]] : 0) + bin[k];
+                            num_hits += d_sq[k] < range_sq;
+                        }
+                        for (uint32_t h = 0; h < num_hits; ++h) {
+                            histogram[hits[h]]++;
+                        }
+
+                        for (uint32_t k = 0; k < n; ++k) {
+                            if (d_sq[k] >= link_sq) continue;
+                            // Inside a cluster the pairs mostly share a root already.
+                            if (root_i == UINT32_MAX) root_i = find_root(parent, i);
+                            const uint32_t root_j = find_root(parent, first + k);
+                            if (root_j != root_i) {
+                                unite(parent, root_i, root_j);
+                                root_i = find_root(parent, root_i);
+                            }
+                        }
+                    }
+                }
+            }
+        };
+
+#pragma omp for schedule(dynamic, 4)
+        for (int c = 0; c < num_cells; ++c) {
+            const uint32_t begin = grid.cell_begin(c);
+            const uint32_t end = grid.cell_end(c);
+            if (begin == end) continue;
+
+            const int num_ranges = grid.neighbor_ranges(c, range_begin, range_end);
+            if (types > 0) visit_pairs.template operator()<true>(begin, end, num_ranges);
+            else visit_pairs.template operator()<false>(begin, end, num_ranges);
+        }
+    }
+}
+
+void StructureAnalytics::collect_clusters(const StructureInput& input) {
+    const int n = static_cast<int>(input.count);
+    uint32_t* parent = parent_.data();
+
+#pragma omp parallel for
+    for (int k = 0; k < n; ++k) {
+        std::atomic_ref<uint32_t>(parent[k]).store(find_root(parent, k), std::memory_order_relaxed);
+    }
+
+    component_size_.assign(input.count, 0);
+    for (int k = 0; k < n; ++k) {
+        component_size_[parent[k]]++;
+    }
+
+    StructureStats& stats = latest_;
+    stats.cluster_size_histogram.assign(CLUSTER_SIZE_BINS, 0);
+    stats.clusters = 0;
+    stats.largest_cluster = 0;
+    size_t clustered = 0;
+    for (int k = 0; k < n; ++k) {
+        const uint32_t size = component_size_[k];
+        if (size == 0) continue;
+        stats.cluster_size_histogram[std::min(static_cast<int>(std::bit_width(size)) - 1, CLUSTER_SIZE_BINS - 1)]++;
+        stats.largest_cluster = std::max<size_t>(stats.largest_cluster, size);
+        if (size < static_cast<uint32_t>(min_cluster_size)) continue;
+        stats.clusters++;
+        clustered += size;
+    }
+    stats.mean_cluster_size = stats.clusters > 0 ? static_cast<double>(clustered) / stats.clusters : 0.0;
+    stats.clustered_fraction = n > 0 ? static_cast<double>(clustered) / n : 0.0;
+}
+
+void StructureAnalytics::collect_energy(const StructureInput& input) {
+    const int n = static_cast<int>(input.count);
+    const int types = input.num_types;
+    // Per thread: energy per type, particles per type, summed speed, padded
+    // to whole cache lines.
+    const size_t stride = (2 * static_cast<size_t>(types) + 1 + 7) / 8 * 8;
+
+#pragma omp parallel
+    {
+#pragma omp single
+        thread_energy_.assign(static_cast<size_t>(omp_get_num_threads()) * stride, 0.0);
+
+        double* sums = thread_energy_.data() + static_cast<size_t>(omp_get_thread_num()) * stride;
+
+#pragma omp for
+        for (int i = 0; i < n; ++i) {
+            const int t = input.slot_type[i];
+            const double v_sq = static_cast<double>(input.vx[i]) * input.vx[i] + static_cast<double>(input.vy[i]) * input.vy[i];
+            sums[t] += 0.5 * input.type_mass[t] * v_sq;
+            sums[types + t] += 1.0;
+            sums[2 * types] += std::sqrt(v_sq);
+        }
+    }
+
+    StructureStats& stats = latest_;
+    stats.type_kinetic_energy.assign(types, 0.0);
+    type_counts_.assign(types, 0);
+    double speed = 0.0;
+    for (size_t offset = 0; offset < thread_energy_.size(); offset += stride) {
+        for (int t = 0; t < types; ++t) {
+            stats.type_kinetic_energy[t] += thread_energy_[offset + t];
+            type_counts_[t] += static_cast<uint64_t>(thread_energy_[offset + types + t]);
+        }
+        speed += thread_energy_[offset + 2 * types];
+    }
+    stats.kinetic_energy = 0.0;
+    for (const double e : stats.type_kinetic_energy) stats.kinetic_energy += e;
+    stats.mean_speed = n > 0 ? speed / n : 0.0;
+}
+
+void StructureAnalytics::normalize_rdf(const StructureInput& input) {
+    StructureStats& stats = latest_;
+    const int bins = stats.rdf_bins;
+    const int types = stats.rdf_types;
+    const int pairs = types * (types + 1) / 2;
+    const size_t stride = thread_rdf_stride();
+
+    std::vector<uint64_t> counts(stride, 0);
+    for (size_t offset = 0; offset < thread_rdf_.size(); offset += stride) {
+        for (size_t k = 0; k < stride; ++k) {
+            counts[k] += thread_rdf_[offset + k];
+        }
+    }
+
+    // Pairs a uniform scatter would put in each shell: the pair count times
+    // the shell's share of the world's area.
+    const double area = static_cast<double>(input.world_width) * input.world_height;
+    const double dr = static_cast<double>(stats.rdf_range) / bins;
+    auto normalized = [&](uint64_t count, double pair_count, int bin) {
+        const double shell = std::numbers::pi * dr * dr * (2.0 * bin + 1.0);
+        const double expected = pair_count * shell / area;
+        return expected > 0.0 ? static_cast<float>(count / expected) : 0.0f;
+    };
+
+    // With per-type histograms the all-pairs one is their sum.
+    std::vector<uint64_t> total(counts.begin(), counts.begin() + bins);
+    for (int p = 1; p < pairs; ++p) {
+        for (int b = 0; b < bins; ++b) {
+            total[b] += counts[static_cast<size_t>(p) * bins + b];
+        }
+    }
+    const double n = static_cast<double>(input.count);
+    stats.rdf.resize(bins);
+    for (int b = 0; b < bins; ++b) {
+        stats.rdf[b] = normalized(total[b], n * (n - 1.0) * 0.5, b);
+    }
+
+    stats.type_rdf.resize(static_cast<size_t>(pairs) * bins);
+    for (int a = 0; a < types; ++a) {
+        for (int c = a; c < types; ++c) {
+            const double na = static_cast<double>(type_counts_[a]);
+            const double nc = static_cast<double>(type_counts_[c]);
+            const double pair_count = a == c ? na * (na - 1.0) * 0.5 : na * nc;
+            const size_t p = rdf_pair_index(a, c, types);
+            for (int b = 0; b < bins; ++b) {
+                stats.type_rdf[p * bins + b] = normalized(counts[p * bins + b], pair_count, b);
+            }
+        }
+    }
+}
+
+void StructureAnalytics::analyze(const StructureInput& input) {
+    const auto start = std::chrono::steady_clock::now();
+    const SpatialGrid& grid = *input.grid;
+
+    // Everything within reach cells of a particle is in its stencil.
+    const float covered = grid.reach() * std::min(grid.cell_width(), grid.cell_height());
+    const float link = std::min(cluster_distance * input.interaction_radius, covered);
+    const float range = std::min(rdf_range * input.interaction_radius, covered);
+
+    StructureStats& stats = latest_;
+    stats.step = input.step;
+    stats.particles = input.count;
+    stats.num_types = input.num_types;
+    stats.cluster_distance = link;
+    stats.rdf_range = range;
+    stats.rdf_bins = std::max(1, rdf_bins);
+    stats.rdf_types = input.num_types <= MAX_RDF_TYPES ? input.num_types : 0;
+
+    parent_.resize(input.count);
+    const int n = static_cast<int>(input.count);
+#pragma omp parallel for
+    for (int k = 0; k < n; ++k) {
+        parent_[k] = k;
+    }
+
+    sweep_pairs(input, link * link, range);
+    collect_clusters(input);
+    collect_energy(input);
+    normalize_rdf(input);
+
+    stats.compute_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    samples_++;
+}
+
+void write_structure_json(FILE* out, const StructureStats& stats) {
+    std::string text;
+    char field[160];
+    auto append_list = [&](const char* name, auto begin, auto end) {
+        text += ", \"";
+        text += name;
+        text += "\": [";
+        for (auto it = begin; it != end; ++it) {
+            std::snprintf(field, sizeof(field), it == begin ? "%.6g" : ", %.6g", static_cast<double>(*it));
+            text += field;
+        }
+        text += "]";
+    };
+
+    std::snprintf(field, sizeof(field), "{\"step\": %llu, \"particles\": %zu, \"kinetic_energy\": %.6g, \"mean_speed\": %.6g",
+                  static_cast<unsigned long long>(stats.step), stats.particles, stats.kinetic_energy, stats.mean_speed);
+    text += field;
+    append_list("type_kinetic_energy", stats.type_kinetic_energy.begin(), stats.type_kinetic_energy.end());
+    std::snprintf(field, sizeof(field),
+                  ", \"cluster_distance\": %.6g, \"clusters\": %zu, \"largest_cluster\": %zu, "
+                  "\"mean_cluster_size\": %.6g, \"clustered_fraction\": %.6g",
+                  stats.cluster_distance, stats.clusters, stats.largest_cluster, stats.mean_cluster_size,
+                  stats.clustered_fraction);
+    text += field;
+    // Trailing empty bins dropped.
+    auto last = stats.cluster_size_histogram.end();
+    while (last != stats.cluster_size_histogram.begin() && *(last - 1) == 0) --last;
+    append_list("cluster_size_histogram", stats.cluster_size_histogram.begin(), last);
+    std::snprintf(field, sizeof(field), ", \"rdf_range\": %.6g, \"rdf_types\": %d", stats.rdf_range, stats.rdf_types);
+    text += field;
+    append_list("rdf", stats.rdf.begin(), stats.rdf.end());
+    append_list("type_rdf", stats.type_rdf.begin(), stats.type_rdf.end());
+    std::snprintf(field, sizeof(field), ", \"compute_ms\": %.3f}\n", stats.compute_ms);
+    text += field;
+
+    std::fwrite(text.data(), 1, text.size(), out);
+}
@@ -0,0 +1,130 @@
+#ifndef ANALYTICS_HPP
+#define ANALYTICS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+#include <vector>
+#include "spatial_grid.hpp"
+
+// Per-type-pair radial distribution functions are kept up to this many
+// types; beyond it only the all-pairs function is.
+constexpr int MAX_RDF_TYPES = 16;
+// Cluster sizes are binned by powers of two: bin b counts the clusters of
+// 2^b to 2^(b+1) - 1 particles.
+constexpr int CLUSTER_SIZE_BINS = 32;
+
+// One sample of the structure of a system.
+struct StructureStats {
+    uint64_t step = 0;
+    size_t particles = 0;
+    int num_types = 0;
+
+    // Sum of m v^2 / 2, in total and per type, and the mean speed.
+    double kinetic_energy = 0.0;
+    std::vector<double> type_kinetic_energy;
+    double mean_speed = 0.0;
+
+    // Clusters are the connected components of the graph linking particles
+    // closer than cluster_distance, counted once they hold min_cluster_size
+    // particles.
+    float cluster_distance = 0.0f;
+    size_t clusters = 0;
+    size_t largest_cluster = 0;
+    double mean_cluster_size = 0.0;
+    // Fraction of the particles that belong to a counted cluster.
+    double clustered_fraction = 0.0;
+    // Every component by size, including single particles.
+    std::vector<uint32_t> cluster_size_histogram;
+
+    // g(r) in rdf_bins equal shells out to rdf_range, normalized so that
+    // particles scattered at random give 1 everywhere. type_rdf holds one
+    // function per unordered type pair a <= b (see rdf_pair_index), when
+    // rdf_types > 0.
+    float rdf_range = 0.0f;
+    int rdf_bins = 0;
+    int rdf_types = 0;
+    std::vector<float> rdf;
+    std::vector<float> type_rdf;
+
+    double compute_ms = 0.0;
+};
+
+inline int rdf_pair_index(int a, int b, int num_types) {
+    if (a > b) std::swap(a, b);
+    return a * num_types - a * (a - 1) / 2 + (b - a);
+}
+
+// What an analysis reads: the particles as the force pass saw them, in the
+// cell order of the grid it used.
+struct StructureInput {
+    uint64_t step = 0;
+    size_t count = 0;
+    int num_types = 0;
+    float world_width = 0.0f;
+    float world_height = 0.0f;
+    float interaction_radius = 0.0f;
+    const SpatialGrid* grid = nullptr;
+    // Cell-sorted positions and types; sorted_indices() of the grid maps them to slots.
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const uint8_t* type = nullptr;
+    // By slot.
+    const float* vx = nullptr;
+    const float* vy = nullptr;
+    const uint8_t* slot_type = nullptr;
+    const float* type_mass = nullptr;
+};
+
+// Cluster, radial distribution and energy statistics computed inside the
+// step, every `every` steps, on the grid and cell-sorted positions the
+// force pass has just built: one parallel sweep over the grid stencil
+// finds every pair within range once, from its lower index, merges the pairs
+// within cluster_distance with a lock-free union-find and bins all of them
+// into per-thread RDF histograms. Nothing is sorted or gridded again.
+class StructureAnalytics {
+public:
+    // Steps between samples; 0 turns the analysis off.
+    int every = 0;
+    // As fractions of the interaction radius. Both are limited to what the
+    // grid stencil covers, which is at least the radius.
+    float cluster_distance = 0.1f;
+    float rdf_range = 1.0f;
+    int rdf_bins = 32;
+    int min_cluster_size = 5;
+
+    bool due(uint64_t step) const { return every > 0 && step % every == 0; }
+    void analyze(const StructureInput& input);
+
+    const StructureStats& latest() const { return latest_; }
+    uint64_t samples() const { return samples_; }
+
+private:
+    void sweep_pairs(const StructureInput& input, float link_sq, float range);
+    void collect_clusters(const StructureInput& input);
+    void collect_energy(const StructureInput& input);
+    void normalize_rdf(const StructureInput& input);
+    // Histogram entries per thread, padded to whole cache lines.
+    size_t thread_rdf_stride() const {
+        const int types = latest_.rdf_types;
+        return (static_cast<size_t>(std::max(1, types * (types + 1) / 2)) * latest_.rdf_bins + 7) / 8 * 8;
+    }
+
+    StructureStats latest_;
+    uint64_t samples_ = 0;
+
+    std::vector<uint32_t> parent_;
+    std::vector<uint32_t> component_size_;
+    // Per thread: one histogram per type pair, or only the all-pairs one
+    // beyond MAX_RDF_TYPES.
+    std::vector<uint64_t> thread_rdf_;
+    std::vector<uint32_t> pair_offset_;
+    std::vector<double> thread_energy_;
+    std::vector<uint64_t> type_counts_;
+};
+
+// One JSON object per sample, on a single line.
+void write_structure_json(FILE* out, const StructureStats& stats);
+
+#endif
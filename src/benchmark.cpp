@@ -0,0 +1,375 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <omp.h>
+#include "particle_system.hpp"
+
+// Times the phases of ParticleSystem::update separately over a sweep of
+// particle counts, type counts, densities and thread counts. Every case starts
+// from the same seed, so runs on the same machine are directly comparable.
+
+struct BenchOptions {
+    std::vector<size_t> particles = {1000, 10000, 100000, 1000000};
+    std::vector<int> types = {3};
+    // Mean particles per radius x radius square; sets the world size per case.
+    std::vector<float> densities = {20.0f};
+    float radius = 80.0f;
+    // 0 lets the grid pick its cell size.
+    std::vector<float> cell_sizes = {0.0f};
+    std::vector<int> threads;
+    int warmup = 5;
+    int steps = 20;
+    uint64_t seed = 12345;
+    ForceKernel force_kernel = ForceKernel::Auto;
+    ForceMode force_mode = ForceMode::Gather;
+    ForceLaw force_law = ForceLaw::Constant;
+    bool quantize = false;
+    float grid_churn = 0.05f;
+    float skin = 0.15f;
+    bool json = false;
+    std::string output;
+};
+
+struct PhaseTimes {
+    double grid = 0.0;
+    double forces = 0.0;
+    double integrate = 0.0;
+    double mouse = 0.0;
+};
+
+struct BenchResult {
+    size_t particles;
+    int types;
+    float density;
+    int threads;
+    float world_width;
+    float world_height;
+    ForceKernel kernel;
+    ForceMode mode;
+    ForceLaw law;
+    bool quantized;
+    float cell_size;
+    int reach;
+    // Mean fraction of particles changing cells per step.
+    double churn;
+    // Nanoseconds per particle per step, per phase.
+    PhaseTimes ns;
+    PhaseTimes efficiency;
+};
+
+template <typename T>
+static bool parse_list(const char* value, std::vector<T>& out, bool allow_zero = false) {
+    out.clear();
+    std::string s = value;
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t comma = s.find(',', pos);
+        if (comma == std::string::npos) comma = s.size();
+        std::string item = s.substr(pos, comma - pos);
+        char* end = nullptr;
+        double v = std::strtod(item.c_str(), &end);
+        if (item.empty() || *end != '\0' || v < 0 || (v == 0 && !allow_zero)) return false;
+        out.push_back(static_cast<T>(v));
+        pos = comma + 1;
+    }
+    return !out.empty();
+}
+
+static void print_usage(const char* program) {
+    std::printf(
+        "usage: %s [options]\n"
+        "  --particles LIST     particle counts (default 1000,10000,100000,1000000)\n"
+        "  --types LIST         type counts, up to 256 (default 3)\n"
+        "  --densities LIST     particles per radius x radius square (default 20)\n"
+        "  --radius F           interaction radius (default 80)\n"
+        "  --cell-sizes LIST    grid cell sizes, 0 = auto-tuned (default 0)\n"
+        "  --threads LIST       OpenMP thread counts (default 1,<max>)\n"
+        "  --warmup N           untimed steps before measuring (default 5)\n"
+        "  --steps N            timed steps per case (default 20)\n"
+        "  --seed N             RNG seed (default 12345)\n"
+        "  --kernel K           auto | scalar | avx2 | avx512\n"
+        "  --mode M             gather | half | verlet\n"
+        "  --skin F             verlet list margin, fraction of the radius (default 0.15)\n"
+        "  --law L              constant | classic | smooth (default constant)\n"
+        "  --quantize 0|1       int8 attraction matrix (default 0)\n"
+        "  --grid-churn F       incremental grid updates up to this churn, 0 = off (default 0.05)\n"
+        "  --format F           csv | json (default csv)\n"
+        "  --output FILE        write results to FILE instead of stdout\n",
+        program);
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions& opt) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (std::strcmp(arg, "--help") == 0) {
+            print_usage(argv[0]);
+            std::exit(0);
+        }
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "error: missing value for %s\n", arg);
+            return false;
+        }
+        const char* value = argv[++i];
+        bool ok = true;
+
+        if (std::strcmp(arg, "--particles") == 0) ok = parse_list(value, opt.particles);
+        else if (std::strcmp(arg, "--types") == 0) {
+            ok = parse_list(value, opt.types) && *std::max_element(opt.types.begin(), opt.types.end()) <= MAX_PARTICLE_TYPES;
+        } else if (std::strcmp(arg, "--densities") == 0) ok = parse_list(value, opt.densities);
+        else if (std::strcmp(arg, "--radius") == 0) ok = (opt.radius = static_cast<float>(std::atof(value))) > 0.0f;
+        else if (std::strcmp(arg, "--cell-sizes") == 0) ok = parse_list(value, opt.cell_sizes, true);
+        else if (std::strcmp(arg, "--threads") == 0) ok = parse_list(value, opt.threads);
+        else if (std::strcmp(arg, "--warmup") == 0) opt.warmup = std::atoi(value);
+        else if (std::strcmp(arg, "--steps") == 0) ok = (opt.steps = std::atoi(value)) > 0;
+        else if (std::strcmp(arg, "--seed") == 0) opt.seed = std::strtoull(value, nullptr, 10);
+        else if (std::strcmp(arg, "--kernel") == 0) {
+            if (std::strcmp(value, "auto") == 0) opt.force_kernel = ForceKernel::Auto;
+            else if (std::strcmp(value, "scalar") == 0) opt.force_kernel = ForceKernel::Scalar;
+            else if (std::strcmp(value, "avx2") == 0) opt.force_kernel = ForceKernel::AVX2;
+            else if (std::strcmp(value, "avx512") == 0) opt.force_kernel = ForceKernel::AVX512;
+            else ok = false;
+        } else if (std::strcmp(arg, "--mode") == 0) {
+            if (std::strcmp(value, "gather") == 0) opt.force_mode = ForceMode::Gather;
+            else if (std::strcmp(value, "half") == 0) opt.force_mode = ForceMode::HalfStencil;
+            else if (std::strcmp(value, "verlet") == 0) opt.force_mode = ForceMode::Verlet;
+            else ok = false;
+        } else if (std::strcmp(arg, "--law") == 0) {
+            if (std::strcmp(value, "constant") == 0) opt.force_law = ForceLaw::Constant;
+            else if (std::strcmp(value, "classic") == 0) opt.force_law = ForceLaw::Classic;
+            else if (std::strcmp(value, "smooth") == 0) opt.force_law = ForceLaw::SmoothStep;
+            else ok = false;
+        } else if (std::strcmp(arg, "--quantize") == 0) {
+            opt.quantize = std::atoi(value) != 0;
+        } else if (std::strcmp(arg, "--skin") == 0) {
+            opt.skin = static_cast<float>(std::atof(value));
+            ok = opt.skin > 0.0f && opt.skin <= 1.0f;
+        } else if (std::strcmp(arg, "--grid-churn") == 0) {
+            opt.grid_churn = static_cast<float>(std::atof(value));
+            ok = opt.grid_churn >= 0.0f && opt.grid_churn <= 1.0f;
+        } else if (std::strcmp(arg, "--format") == 0) {
+            if (std::strcmp(value, "json") == 0) opt.json = true;
+            else if (std::strcmp(value, "csv") == 0) opt.json = false;
+            else ok = false;
+        } else if (std::strcmp(arg, "--output") == 0) opt.output = value;
+        else {
+            std::fprintf(stderr, "error: unknown option %s\n", arg);
+            return false;
+        }
+
+        if (!ok) {
+            std::fprintf(stderr, "error: invalid value '%s' for %s\n", value, arg);
+            return false;
+        }
+    }
+
+    if (opt.threads.empty()) {
+        opt.threads.push_back(1);
+        if (omp_get_max_threads() > 1) opt.threads.push_back(omp_get_max_threads());
+    }
+    return true;
+}
+
+static void run_case(const BenchOptions& opt, size_t num_particles, int num_types, float density, float cell_size,
+                     int num_threads, BenchResult& result) {
+    using clock = std::chrono::steady_clock;
+    const float cell = opt.radius;
+
+    // Keep the viewer's 16:9 aspect ratio and scale the area to the density.
+    float area = num_particles * cell * cell / density;
+    float world_height = std::max(cell, std::sqrt(area * 9.0f / 16.0f));
+    float world_width = std::max(cell, area / world_height);
+
+    omp_set_num_threads(num_threads);
+
+    ParticleSystem particles;
+    particles.seed = opt.seed;
+    particles.force_kernel = opt.force_kernel;
+    particles.force_mode = opt.force_mode;
+    particles.force_law = opt.force_law;
+    particles.quantize_coefficients = opt.quantize;
+    particles.interaction_radius = opt.radius;
+    particles.cell_size = cell_size;
+    particles.max_grid_churn = opt.grid_churn;
+    particles.verlet_skin = opt.skin;
+    particles.init(num_particles, num_types, world_width, world_height);
+    particles.randomize_rules();
+
+    // The brush runs inside apply_forces; the profiler splits its time out.
+    Profiler profiler;
+    profiler.enabled = true;
+    profiler.neighbor_stats = false;
+    particles.profiler = &profiler;
+
+    const float dt = 0.016f;
+    particles.brush.tool = BrushTool::Force;
+    particles.brush.x = world_width * 0.5f;
+    particles.brush.y = world_height * 0.5f;
+    particles.brush.radius = 150.0f;
+    particles.brush.strength = 5.0f;
+
+    for (int s = 0; s < opt.warmup; ++s) {
+        particles.update(dt);
+    }
+
+    PhaseTimes total;
+    auto elapsed = [](clock::time_point a, clock::time_point b) {
+        return std::chrono::duration<double, std::nano>(b - a).count();
+    };
+
+    for (int s = 0; s < opt.steps; ++s) {
+        profiler.begin_frame();
+        auto t1 = clock::now();
+        particles.rebuild_grid();
+        auto t2 = clock::now();
+        particles.apply_forces();
+        auto t3 = clock::now();
+        particles.integrate(dt);
+        auto t4 = clock::now();
+        particles.step_count++;
+        profiler.end_frame();
+
+        const double mouse = profiler.last_ms(ProfilePhase::Mouse) * 1e6;
+        total.mouse += mouse;
+        total.grid += elapsed(t1, t2);
+        total.forces += elapsed(t2, t3) - mouse;
+        total.integrate += elapsed(t3, t4);
+    }
+
+    const double scale = 1.0 / (static_cast<double>(opt.steps) * num_particles);
+    total.mouse *= scale;
+    total.grid *= scale;
+    total.forces *= scale;
+    total.integrate *= scale;
+
+    result.particles = num_particles;
+    result.types = num_types;
+    result.density = density;
+    result.threads = num_threads;
+    result.world_width = world_width;
+    result.world_height = world_height;
+    result.kernel = particles.active_force_kernel();
+    result.mode = particles.active_force_mode();
+    result.law = particles.force_law;
+    result.quantized = particles.quantize_coefficients;
+    result.cell_size = particles.grid->cell_size();
+    result.reach = particles.grid_reach();
+    result.churn = particles.grid_stats().mean_churn();
+    result.ns = total;
+}
+
+static void write_results(FILE* out, const std::vector<BenchResult>& results, bool json) {
+    struct Phase { const char* name; double PhaseTimes::* field; };
+    const Phase phases[] = {
+        {"grid", &PhaseTimes::grid},
+        {"forces", &PhaseTimes::forces},
+        {"integrate", &PhaseTimes::integrate},
+        {"mouse", &PhaseTimes::mouse},
+    };
+
+    if (json) {
+        std::fprintf(out, "[\n");
+    } else {
+        std::fprintf(out, "particles,types,density,threads,world_width,world_height,kernel,mode,phase,ns_per_particle_step,parallel_efficiency,cell_size,reach,law,quantized,churn\n");
+    }
+
+    bool first = true;
+    for (const BenchResult& r : results) {
+        const char* mode = force_mode_name(r.mode);
+        double total_ns = 0.0;
+        for (const Phase& p : phases) total_ns += r.ns.*p.field;
+
+        for (const Phase& p : phases) {
+            if (json) {
+                std::fprintf(out, "%s  {\"particles\": %zu, \"types\": %d, \"density\": %g, \"threads\": %d, "
+                             "\"world_width\": %.1f, \"world_height\": %.1f, \"kernel\": \"%s\", \"mode\": \"%s\", "
+                             "\"phase\": \"%s\", \"ns_per_particle_step\": %.4f, \"parallel_efficiency\": %.4f, "
+                             "\"cell_size\": %.2f, \"reach\": %d, \"law\": \"%s\", \"quantized\": %d, \"churn\": %.4f}",
+                             first ? "" : ",\n", r.particles, r.types, r.density, r.threads,
+                             r.world_width, r.world_height, force_kernel_name(r.kernel), mode,
+                             p.name, r.ns.*p.field, r.efficiency.*p.field, r.cell_size, r.reach,
+                             force_law_name(r.law), r.quantized ? 1 : 0, r.churn);
+            } else {
+                std::fprintf(out, "%zu,%d,%g,%d,%.1f,%.1f,%s,%s,%s,%.4f,%.4f,%.2f,%d,%s,%d,%.4f\n",
+                             r.particles, r.types, r.density, r.threads, r.world_width, r.world_height,
+                             force_kernel_name(r.kernel), mode, p.name, r.ns.*p.field, r.efficiency.*p.field,
+                             r.cell_size, r.reach, force_law_name(r.law), r.quantized ? 1 : 0, r.churn);
+            }
+            first = false;
+        }
+
+        std::fprintf(stderr, "n=%-8zu types=%-3d density=%-6g threads=%-3d reach=%d %8.2f ns/particle/step (forces %.2f, grid %.2f, integrate %.2f, mouse %.2f)\n",
+                     r.particles, r.types, r.density, r.threads, r.reach, total_ns,
+                     r.ns.forces, r.ns.grid, r.ns.integrate, r.ns.mouse);
+    }
+
+    if (json) {
+        std::fprintf(out, "\n]\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    if (!parse_options(argc, argv, opt)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+
+    for (size_t n : opt.particles) {
+        for (int t : opt.types) {
+            for (float d : opt.densities) {
+                for (float cell_size : opt.cell_sizes) {
+                    // Parallel efficiency is measured against a single-thread run
+                    // of the same case, which is added when the sweep lacks one.
+                    BenchResult baseline;
+                    bool have_baseline = false;
+
+                    for (int threads : opt.threads) {
+                        BenchResult r;
+                        run_case(opt, n, t, d, cell_size, threads, r);
+
+                        if (threads == 1) {
+                            baseline = r;
+                            have_baseline = true;
+                        } else if (!have_baseline) {
+                            run_case(opt, n, t, d, cell_size, 1, baseline);
+                            have_baseline = true;
+                        }
+
+                        auto efficiency = [&](double PhaseTimes::* field) {
+                            double parallel = r.ns.*field * threads;
+                            return parallel > 0.0 ? baseline.ns.*field / parallel : 0.0;
+                        };
+                        r.efficiency.grid = efficiency(&PhaseTimes::grid);
+                        r.efficiency.forces = efficiency(&PhaseTimes::forces);
+                        r.efficiency.integrate = efficiency(&PhaseTimes::integrate);
+                        r.efficiency.mouse = efficiency(&PhaseTimes::mouse);
+                        results.push_back(r);
+                    }
+                }
+            }
+        }
+    }
+
+    FILE* out = stdout;
+    if (!opt.output.empty()) {
+        out = std::fopen(opt.output.c_str(), "w");
+        if (!out) {
+            std::fprintf(stderr, "error: cannot write %s\n", opt.output.c_str());
+            return 1;
+        }
+    }
+
+    write_results(out, results, opt.json);
+
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,419 @@
+#include "config.hpp"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <omp.h>
+
+static std::string trim(const std::string& s) {
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) return "";
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+static bool parse_number(const std::string& value, double& out) {
+    char* end = nullptr;
+    out = std::strtod(value.c_str(), &end);
+    // strtod takes "nan" and "inf", which no option means.
+    return end != value.c_str() && *end == '\0' && std::isfinite(out);
+}
+
+static bool parse_matrix(const std::string& value, std::vector<float>& out) {
+    out.clear();
+    size_t pos = 0;
+    while (pos <= value.size()) {
+        size_t comma = value.find(',', pos);
+        if (comma == std::string::npos) comma = value.size();
+
+        double number;
+        if (!parse_number(trim(value.substr(pos, comma - pos)), number)) return false;
+        out.push_back(static_cast<float>(number));
+        pos = comma + 1;
+    }
+    return true;
+}
+
+static bool set_config_value(SimConfig& config, const std::string& key, const std::string& value, std::string& error) {
+    double number = 0.0;
+    bool numeric = parse_number(value, number);
+
+    auto require_number = [&](double min_value) {
+        if (!numeric || number < min_value) {
+            error = "invalid value '" + value + "' for " + key;
+            return false;
+        }
+        return true;
+    };
+
+    // For values stored as int.
+    auto require_count = [&](double min_value) {
+        if (!require_number(min_value)) return false;
+        if (number > INT_MAX) {
+            error = key + " must be at most " + std::to_string(INT_MAX);
+            return false;
+        }
+        return true;
+    };
+
+    auto require_positive = [&]() {
+        if (!numeric || number <= 0.0) {
+            error = "invalid value '" + value + "' for " + key;
+            return false;
+        }
+        return true;
+    };
+
+    if (key == "particles") {
+        if (!require_number(1)) return false;
+        // Slots and ids are 32-bit.
+        if (number > UINT32_MAX) {
+            error = "particles must be at most " + std::to_string(UINT32_MAX);
+            return false;
+        }
+        config.num_particles = static_cast<size_t>(number);
+    } else if (key == "types") {
+        if (!require_number(1) || number > MAX_PARTICLE_TYPES) {
+            error = "types must be between 1 and " + std::to_string(MAX_PARTICLE_TYPES);
+            return false;
+        }
+        config.num_types = static_cast<int>(number);
+    } else if (key == "steps") {
+        if (!require_count(0)) return false;
+        config.steps = static_cast<int>(number);
+    } else if (key == "seed") {
+        if (!require_number(0)) return false;
+        config.seed = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (key == "dt") {
+        if (!require_number(0)) return false;
+        config.dt = static_cast<float>(number);
+    } else if (key == "world-width") {
+        if (!require_positive()) return false;
+        config.world_width = static_cast<float>(number);
+    } else if (key == "world-height") {
+        if (!require_positive()) return false;
+        config.world_height = static_cast<float>(number);
+    } else if (key == "radius") {
+        if (!require_positive()) return false;
+        config.interaction_radius = static_cast<float>(number);
+    } else if (key == "cell-size") {
+        if (!require_number(0)) return false;
+        config.cell_size = static_cast<float>(number);
+    } else if (key == "threads") {
+        if (!require_count(0)) return false;
+        config.threads = static_cast<int>(number);
+    } else if (key == "report-every") {
+        if (!require_count(0)) return false;
+        config.report_every = static_cast<int>(number);
+    } else if (key == "sort-interval") {
+        if (!require_count(0)) return false;
+        config.sort_interval = static_cast<int>(number);
+    } else if (key == "grid-churn") {
+        if (!require_number(0) || number > 1.0) {
+            error = "grid-churn must be between 0 and 1";
+            return false;
+        }
+        config.grid_churn = static_cast<float>(number);
+    } else if (key == "kernel") {
+        if (value == "auto") config.force_kernel = ForceKernel::Auto;
+        else if (value == "scalar") config.force_kernel = ForceKernel::Scalar;
+        else if (value == "avx2") config.force_kernel = ForceKernel::AVX2;
+        else if (value == "avx512") config.force_kernel = ForceKernel::AVX512;
+        else {
+            error = "unknown kernel '" + value + "'";
+            return false;
+        }
+    } else if (key == "mode") {
+        if (value == "gather") config.force_mode = ForceMode::Gather;
+        else if (value == "half") config.force_mode = ForceMode::HalfStencil;
+        else if (value == "verlet") config.force_mode = ForceMode::Verlet;
+        else {
+            error = "unknown force mode '" + value + "'";
+            return false;
+        }
+    } else if (key == "skin") {
+        if (!require_number(0) || number <= 0.0 || number > 1.0) {
+            error = "skin must be above 0 and at most 1";
+            return false;
+        }
+        config.skin = static_cast<float>(number);
+    } else if (key == "force-law") {
+        if (value == "constant") config.force_law = ForceLaw::Constant;
+        else if (value == "classic") config.force_law = ForceLaw::Classic;
+        else if (value == "smooth") config.force_law = ForceLaw::SmoothStep;
+        else {
+            error = "unknown force law '" + value + "'";
+            return false;
+        }
+    } else if (key == "beta") {
+        if (!require_number(0) || number <= 0.0 || number >= 1.0) {
+            error = "beta must be between 0 and 1";
+            return false;
+        }
+        config.beta = static_cast<float>(number);
+    } else if (key == "deterministic") {
+        if (!require_number(0)) return false;
+        config.deterministic = number != 0.0;
+    } else if (key == "expect-hash") {
+        config.expect_hash = value;
+    } else if (key == "snapshot-in") {
+        config.snapshot_in = value;
+    } else if (key == "snapshot-out") {
+        config.snapshot_out = value;
+    } else if (key == "trajectory") {
+        config.trajectory_path = value;
+    } else if (key == "trajectory-every") {
+        if (!require_count(1)) return false;
+        config.trajectory_every = static_cast<int>(number);
+    } else if (key == "trajectory-encoding") {
+        if (value == "raw") config.trajectory_encoding = TrajectoryEncoding::Raw;
+        else if (value == "quantized") config.trajectory_encoding = TrajectoryEncoding::Quantized;
+        else if (value == "delta") config.trajectory_encoding = TrajectoryEncoding::Delta;
+        else {
+            error = "unknown trajectory encoding '" + value + "'";
+            return false;
+        }
+    } else if (key == "keyframe-every") {
+        if (!require_count(1)) return false;
+        config.keyframe_every = static_cast<int>(number);
+    } else if (key == "profile") {
+        if (!require_number(0)) return false;
+        config.profile = number != 0.0;
+    } else if (key == "trace") {
+        config.trace_path = value;
+    } else if (key == "matrix") {
+        if (!parse_matrix(value, config.matrix)) {
+            error = "matrix must be a comma separated list of numbers";
+            return false;
+        }
+    } else if (key == "type-radius") {
+        if (!parse_matrix(value, config.type_radius) ||
+            std::any_of(config.type_radius.begin(), config.type_radius.end(), [](float r) { return !(r > 0.0f && r <= 1.0f); })) {
+            error = "type-radius must be a comma separated list of fractions in (0, 1]";
+            return false;
+        }
+    } else if (key == "type-mass") {
+        if (!parse_matrix(value, config.type_mass) ||
+            std::any_of(config.type_mass.begin(), config.type_mass.end(), [](float m) { return !(m > 0.0f); })) {
+            error = "type-mass must be a comma separated list of positive numbers";
+            return false;
+        }
+    } else if (key == "quantize") {
+        if (!require_number(0)) return false;
+        config.quantize = number != 0.0;
+    } else if (key == "emit") {
+        if (!require_count(0)) return false;
+        config.emit = static_cast<int>(number);
+    } else if (key == "lifetime") {
+        if (!require_number(0)) return false;
+        config.lifetime = static_cast<float>(number);
+    } else if (key == "frames") {
+        config.frames_dir = value;
+    } else if (key == "frame-every") {
+        if (!require_count(1)) return false;
+        config.frame_every = static_cast<int>(number);
+    } else if (key == "frame-width") {
+        if (!require_count(1)) return false;
+        config.frame_width = static_cast<int>(number);
+    } else if (key == "frame-height") {
+        if (!require_count(1)) return false;
+        config.frame_height = static_cast<int>(number);
+    } else if (key == "particle-size") {
+        if (!require_positive() || number > MAX_SPLAT_RADIUS) {
+            error = "particle-size must be above 0 and at most " + std::to_string(MAX_SPLAT_RADIUS);
+            return false;
+        }
+        config.particle_size = static_cast<float>(number);
+    } else if (key == "frame-trail") {
+        if (!require_number(0) || number >= 1.0) {
+            error = "frame-trail must be at least 0 and below 1";
+            return false;
+        }
+        config.frame_trail = static_cast<float>(number);
+    } else if (key == "frame-glow") {
+        if (!require_number(0)) return false;
+        config.frame_glow = static_cast<float>(number);
+    } else if (key == "analytics-every") {
+        if (!require_count(0)) return false;
+        config.analytics_every = static_cast<int>(number);
+    } else if (key == "analytics-out") {
+        config.analytics_path = value;
+    } else if (key == "cluster-distance") {
+        if (!require_positive() || number > 1.0) {
+            error = "cluster-distance must be above 0 and at most 1";
+            return false;
+        }
+        config.cluster_distance = static_cast<float>(number);
+    } else if (key == "min-cluster") {
+        if (!require_count(1)) return false;
+        config.min_cluster_size = static_cast<int>(number);
+    } else if (key == "rdf-bins") {
+        if (!require_count(1)) return false;
+        config.rdf_bins = static_cast<int>(number);
+    } else {
+        error = "unknown option '" + key + "'";
+        return false;
+    }
+    return true;
+}
+
+bool load_config_file(const std::string& path, SimConfig& config, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "cannot open config file '" + path + "'";
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            error = path + ":" + std::to_string(line_number) + ": expected key = value";
+            return false;
+        }
+        if (!set_config_value(config, trim(line.substr(0, eq)), trim(line.substr(eq + 1)), error)) {
+            error = path + ":" + std::to_string(line_number) + ": " + error;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parse_config_args(int argc, char** argv, SimConfig& config, std::string& error) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            error = "unexpected argument '" + arg + "'";
+            return false;
+        }
+
+        std::string key = arg.substr(2);
+        std::string value;
+        size_t eq = key.find('=');
+        if (eq != std::string::npos) {
+            value = key.substr(eq + 1);
+            key = key.substr(0, eq);
+        } else if (i + 1 < argc) {
+            value = argv[++i];
+        } else {
+            error = "missing value for --" + key;
+            return false;
+        }
+
+        if (key == "config") {
+            if (!load_config_file(value, config, error)) return false;
+        } else if (!set_config_value(config, key, value, error)) {
+            return false;
+        }
+    }
+
+    if (!config.matrix.empty() && config.matrix.size() != static_cast<size_t>(config.num_types * config.num_types)) {
+        error = "matrix needs types * types = " + std::to_string(config.num_types * config.num_types) + " values";
+        return false;
+    }
+    if ((!config.type_radius.empty() && config.type_radius.size() != static_cast<size_t>(config.num_types)) ||
+        (!config.type_mass.empty() && config.type_mass.size() != static_cast<size_t>(config.num_types))) {
+        error = "type-radius and type-mass need one value per type";
+        return false;
+    }
+    return true;
+}
+
+void apply_config(const SimConfig& config, ParticleSystem& particles) {
+    if (config.threads > 0) {
+        omp_set_num_threads(config.threads);
+    }
+
+    particles.seed = config.seed;
+    particles.sort_interval = config.sort_interval;
+    particles.max_grid_churn = config.grid_churn;
+    particles.force_kernel = config.force_kernel;
+    particles.force_mode = config.force_mode;
+    particles.verlet_skin = config.skin;
+    particles.force_law = config.force_law;
+    particles.beta = config.beta;
+    particles.deterministic = config.deterministic;
+    particles.interaction_radius = config.interaction_radius;
+    particles.cell_size = config.cell_size;
+    particles.quantize_coefficients = config.quantize;
+    particles.emit_rate = config.emit;
+    particles.spawn_lifetime = config.lifetime > 0.0f ? config.lifetime : INFINITY;
+    if (!config.type_radius.empty()) particles.type_radius = config.type_radius;
+    if (!config.type_mass.empty()) particles.type_mass = config.type_mass;
+
+    if (config.matrix.empty()) {
+        particles.randomize_rules();
+    } else {
+        for (int i = 0; i < config.num_types; ++i) {
+            for (int j = 0; j < config.num_types; ++j) {
+                particles.set_attraction(i, j, config.matrix[i * config.num_types + j]);
+            }
+        }
+    }
+}
+
+void print_config_usage(const char* program) {
+    std::printf(
+        "usage: %s [options]\n"
+        "  --config FILE         read options from FILE (key = value per line)\n"
+        "  --particles N         particle count (default 5000)\n"
+        "  --types N             particle types, 1-256 (default 3)\n"
+        "  --steps N             steps to simulate (default 1000)\n"
+        "  --seed N              RNG seed, 0 = nondeterministic (default 1)\n"
+        "  --dt F                time step (default 0.016)\n"
+        "  --world-width F       world size; the world is a torus (default 1600)\n"
+        "  --world-height F      (default 900)\n"
+        "  --radius F            interaction radius (default 80)\n"
+        "  --cell-size F         grid cell size, 0 = tuned to the density (default 0)\n"
+        "  --threads N           OpenMP threads, 0 = default\n"
+        "  --report-every N      print progress every N steps\n"
+        "  --sort-interval N     reorder particles by cell every N steps\n"
+        "  --grid-churn F        update the grid incrementally while at most this\n"
+        "                        fraction of particles changes cells, 0 = never (default 0.05)\n"
+        "  --kernel K            auto | scalar | avx2 | avx512\n"
+        "  --mode M              gather | half | verlet\n"
+        "  --skin F              verlet list margin beyond the radius, fraction of\n"
+        "                        the radius (default 0.15)\n"
+        "  --force-law L         constant | classic | smooth (default constant)\n"
+        "  --beta F              classic law repulsion zone, fraction of the radius (default 0.3)\n"
+        "  --deterministic 0|1   identical results for any thread count (scalar kernel\n"
+        "                        unless --kernel is given)\n"
+        "  --expect-hash HEX     fail unless the final state hash matches\n"
+        "  --snapshot-in FILE    start from a saved snapshot instead of a random state\n"
+        "  --snapshot-out FILE   save the final state as a snapshot\n"
+        "  --trajectory FILE     record positions to FILE for replay in the viewer\n"
+        "  --trajectory-every N  record every N steps (default 1)\n"
+        "  --trajectory-encoding E  raw | quantized | delta (default delta)\n"
+        "  --keyframe-every N    frames between delta keyframes (default 60)\n"
+        "  --profile 0|1         print per-phase timings at the end\n"
+        "  --trace FILE          write a Chrome trace of the run to FILE\n"
+        "  --matrix a,b,...      row-major attraction matrix (types * types values)\n"
+        "  --type-radius a,b,... per-type sensing radius as a fraction of --radius\n"
+        "  --type-mass a,b,...   per-type mass, dividing the force each type feels\n"
+        "  --quantize 0|1        store the attraction matrix as int8\n"
+        "  --emit N              particles spawned per step at random places\n"
+        "  --lifetime F          seconds each emitted particle lives, 0 = forever\n"
+        "  --frames DIR          render PPM frames into DIR with the CPU splat renderer\n"
+        "  --frame-every N       render every N steps (default 1)\n"
+        "  --frame-width N       frame size in pixels (default 1600)\n"
+        "  --frame-height N      (default 900)\n"
+        "  --particle-size F     particle radius in pixels, at most 7 (default 2)\n"
+        "  --frame-trail F       fraction of the previous frame kept as trails, 0 = off\n"
+        "  --frame-glow F        glow strength, 0 = off\n"
+        "  --analytics-every N   sample clusters, g(r) and kinetic energy every N steps,\n"
+        "                        0 = off (default 0)\n"
+        "  --analytics-out FILE  write each sample to FILE as a line of JSON\n"
+        "  --cluster-distance F  link distance of clusters as a fraction of --radius\n"
+        "                        (default 0.1)\n"
+        "  --min-cluster N       particles a cluster needs to be counted (default 5)\n"
+        "  --rdf-bins N          g(r) shells out to --radius (default 32)\n",
+        program);
+}
@@ -0,0 +1,82 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "particle_system.hpp"
+#include "snapshot.hpp"
+#include "splat_renderer.hpp"
+
+struct SimConfig {
+    size_t num_particles = 5000;
+    int num_types = 3;
+    int steps = 1000;
+    uint64_t seed = 1;
+    float dt = 0.016f;
+    float world_width = 1600.0f;
+    float world_height = 900.0f;
+    float interaction_radius = 80.0f;
+    // 0 lets the grid tune its cell size to the density.
+    float cell_size = 0.0f;
+    int threads = 0;
+    int report_every = 0;
+    int sort_interval = 0;
+    // Largest fraction of particles changing cells for an incremental grid update.
+    float grid_churn = 0.05f;
+    ForceKernel force_kernel = ForceKernel::Auto;
+    ForceMode force_mode = ForceMode::Gather;
+    // Verlet list margin as a fraction of the radius.
+    float skin = 0.15f;
+    ForceLaw force_law = ForceLaw::Constant;
+    float beta = 0.3f;
+    bool deterministic = false;
+    bool profile = false;
+    std::string trace_path;
+    // Hex state hash the run must end with; empty skips the check.
+    std::string expect_hash;
+    std::string snapshot_in;
+    std::string snapshot_out;
+    std::string trajectory_path;
+    int trajectory_every = 1;
+    TrajectoryEncoding trajectory_encoding = TrajectoryEncoding::Delta;
+    int keyframe_every = 60;
+    // Row-major num_types x num_types attraction values; empty randomizes the rules.
+    std::vector<float> matrix;
+    // num_types values each; empty leaves every type at 1.
+    std::vector<float> type_radius;
+    std::vector<float> type_mass;
+    bool quantize = false;
+    // Particles emitted per step, living lifetime seconds (0 = forever).
+    int emit = 0;
+    float lifetime = 0.0f;
+    // Directory for rendered PPM frames; empty renders nothing.
+    std::string frames_dir;
+    int frame_every = 1;
+    int frame_width = 1600;
+    int frame_height = 900;
+    float particle_size = 2.0f;
+    // Splat renderer trail decay and glow strength, 0 = off.
+    float frame_trail = 0.0f;
+    float frame_glow = 0.0f;
+    // Structure analytics every analytics_every steps, 0 = off; empty
+    // analytics_path only prints the last sample.
+    int analytics_every = 0;
+    std::string analytics_path;
+    float cluster_distance = 0.1f;
+    int min_cluster_size = 5;
+    int rdf_bins = 32;
+};
+
+// Config files hold "key = value" lines, '#' starts a comment, and the keys
+// are the command line flags without their leading dashes.
+bool load_config_file(const std::string& path, SimConfig& config, std::string& error);
+
+// Flags are "--key value" or "--key=value". "--config path" loads a file at
+// that point, so flags after it override the file.
+bool parse_config_args(int argc, char** argv, SimConfig& config, std::string& error);
+
+void apply_config(const SimConfig& config, ParticleSystem& particles);
+void print_config_usage(const char* program);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef COUNTER_RNG_HPP
+#define COUNTER_RNG_HPP
+
+#include <cstdint>
+
+// Stateless counter-based generator: every draw is a pure function of
+// (seed, stream, index), so a parallel loop that draws with its element
+// index gets the same numbers for any thread count or schedule.
+
+inline uint64_t splitmix64(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t counter_hash(uint64_t seed, uint64_t stream, uint64_t index) {
+    return splitmix64(splitmix64(splitmix64(seed) ^ stream) ^ index);
+}
+
+// Uniform in [lo, hi) from the top 24 bits, which a float holds exactly.
+inline float counter_uniform(uint64_t seed, uint64_t stream, uint64_t index, float lo, float hi) {
+    float unit = static_cast<float>(counter_hash(seed, stream, index) >> 40) * (1.0f / 16777216.0f);
+    return lo + (hi - lo) * unit;
+}
+
+// Uniform integer in [0, n) by multiply-shift on the top 32 bits.
+inline uint32_t counter_below(uint64_t seed, uint64_t stream, uint64_t index, uint32_t n) {
+    return static_cast<uint32_t>(((counter_hash(seed, stream, index) >> 32) * n) >> 32);
+}
+
+#endif
@@ -0,0 +1,187 @@
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "config.hpp"
+#include "domain.hpp"
+#include "particle_system.hpp"
+
+// Runs one simulation split into strips across worker processes on this
+// machine (see domain.hpp). Takes every nucleon_headless option that makes
+// sense for a single run, plus its own.
+
+static void print_usage(const char* program) {
+    std::printf(
+        "usage: %s [decomposition options] [simulation options]\n"
+        "  --workers N          worker processes, one strip each, 2-%d (default 2)\n"
+        "  --halo F             ghost margin, at least the radius (default the radius)\n"
+        "  --rebalance-every N  move the strip edges to even out the work every N\n"
+        "                       steps, 0 = never (default 50)\n"
+        "  --pin 0|1            pin each worker to its own block of CPUs (default 1)\n"
+        "simulation options (--threads is per worker, default its CPUs):\n",
+        program, MAX_DOMAIN_WORKERS);
+    print_config_usage(program);
+}
+
+int main(int argc, char** argv) {
+    DomainOptions options;
+
+    // Decomposition options are taken out here; the rest go to parse_config_args.
+    std::vector<char*> sim_args = {argv[0]};
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        const bool ours = std::strcmp(arg, "--workers") == 0 || std::strcmp(arg, "--halo") == 0 ||
+                          std::strcmp(arg, "--rebalance-every") == 0 || std::strcmp(arg, "--pin") == 0;
+        if (!ours) {
+            sim_args.push_back(argv[i]);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "error: missing value for %s\n", arg);
+            return 1;
+        }
+        const char* value = argv[++i];
+        bool ok = true;
+        if (std::strcmp(arg, "--workers") == 0) {
+            options.workers = std::atoi(value);
+            ok = options.workers >= 2 && options.workers <= MAX_DOMAIN_WORKERS;
+        } else if (std::strcmp(arg, "--halo") == 0) ok = (options.halo = std::strtof(value, nullptr)) > 0.0f;
+        else if (std::strcmp(arg, "--rebalance-every") == 0) ok = (options.rebalance_every = std::atoi(value)) >= 0;
+        else options.pin = std::atoi(value) != 0;
+
+        if (!ok) {
+            std::fprintf(stderr, "error: invalid value '%s' for %s\n", value, arg);
+            return 1;
+        }
+    }
+
+    SimConfig config;
+    std::string error;
+    if (!parse_config_args(static_cast<int>(sim_args.size()), sim_args.data(), config, error)) {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+
+    const float halo = options.halo > 0.0f ? options.halo : config.interaction_radius;
+    if (halo < config.interaction_radius) {
+        std::fprintf(stderr, "error: --halo %g is less than the interaction radius %g\n", halo,
+                     config.interaction_radius);
+        return 1;
+    }
+    if (config.world_width / options.workers < 2.0f * halo) {
+        std::fprintf(stderr, "error: %d strips of a %g wide world are narrower than two halos (%g)\n",
+                     options.workers, config.world_width, 2.0f * halo);
+        return 1;
+    }
+    if (config.emit > 0 || !config.snapshot_in.empty() || !config.trajectory_path.empty() ||
+        !config.frames_dir.empty() || config.analytics_every > 0) {
+        std::fprintf(stderr,
+                     "error: --emit, --snapshot-in, --trajectory, --frames and --analytics-every need nucleon_headless\n");
+        return 1;
+    }
+
+    DomainShared shared;
+    if (!shared.create(options.workers, config.num_particles, config.world_width)) {
+        std::fprintf(stderr, "error: cannot map shared memory for %d workers\n", options.workers);
+        return 1;
+    }
+    DomainControl& control = shared.control();
+
+    std::printf("particles: %zu, types: %d, steps: %d, seed: %llu, workers: %d, halo: %g\n",
+                config.num_particles, config.num_types, config.steps, static_cast<unsigned long long>(config.seed),
+                options.workers, halo);
+    std::fflush(stdout);
+
+    // No OpenMP in this process before the fork: the runtime's threads
+    // would not survive into the workers.
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    std::vector<pid_t> pids(options.workers, -1);
+    for (int w = 0; w < options.workers; ++w) {
+        pids[w] = fork();
+        if (pids[w] == 0) {
+            std::_Exit(run_domain_worker(config, options, shared, w) ? 0 : 1);
+        }
+        if (pids[w] < 0) {
+            std::fprintf(stderr, "error: cannot start worker %d\n", w);
+            control.abort.store(1);
+            break;
+        }
+    }
+
+    bool failed = control.abort.load() != 0;
+    for (int remaining = options.workers; remaining > 0; --remaining) {
+        int status = 0;
+        const pid_t pid = wait(&status);
+        if (pid < 0) break;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) continue;
+        if (!failed) {
+            std::fprintf(stderr, "error: a worker failed, stopping the others\n");
+            failed = true;
+        }
+        control.abort.store(1);
+        for (const pid_t other : pids) {
+            if (other > 0 && other != pid) kill(other, SIGTERM);
+        }
+    }
+    if (failed) return 1;
+
+    const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    const double steps_per_sec = elapsed > 0.0 ? config.steps / elapsed : 0.0;
+
+    // The final state, with the same rules and settings as nucleon_headless.
+    ParticleSystem particles;
+    particles.seed = config.seed;
+    particles.init(config.num_particles, config.num_types, config.world_width, config.world_height);
+    apply_config(config, particles);
+    const HaloRecord* records = shared.final_records();
+    for (size_t i = 0; i < particles.count; ++i) {
+        particles.x[i] = records[i].x;
+        particles.y[i] = records[i].y;
+        particles.vx[i] = records[i].vx;
+        particles.vy[i] = records[i].vy;
+        particles.type[i] = static_cast<uint8_t>(records[i].type);
+    }
+
+    std::printf("elapsed: %.3f s, steps/sec: %.2f, particle-steps/sec: %.3e\n", elapsed, steps_per_sec,
+                steps_per_sec * config.num_particles);
+    std::printf("%llu rebalances, strip edges:", static_cast<unsigned long long>(control.rebalances));
+    for (int w = 0; w <= options.workers; ++w) {
+        std::printf(" %.1f", control.edges[w]);
+    }
+    std::printf("\n");
+    for (int w = 0; w < options.workers; ++w) {
+        const DomainWorkerStats& stats = control.workers[w];
+        std::printf("  worker %d: %llu particles at end, %.3f s busy, %.1f halo and %.2f migrated per step\n", w,
+                    static_cast<unsigned long long>(stats.owned), stats.busy_seconds,
+                    config.steps > 0 ? static_cast<double>(stats.halo_sent) / config.steps : 0.0,
+                    config.steps > 0 ? static_cast<double>(stats.migrated) / config.steps : 0.0);
+    }
+
+    const uint64_t hash = particles.state_hash();
+    std::printf("state hash: %016llx\n", static_cast<unsigned long long>(hash));
+
+    if (!config.snapshot_out.empty()) {
+        if (!save_snapshot(particles, config.snapshot_out, error)) {
+            std::fprintf(stderr, "error: %s\n", error.c_str());
+            return 1;
+        }
+        std::printf("snapshot written to %s\n", config.snapshot_out.c_str());
+    }
+
+    if (!config.expect_hash.empty() && std::strtoull(config.expect_hash.c_str(), nullptr, 16) != hash) {
+        std::fprintf(stderr, "error: state hash %016llx does not match expected %s\n",
+                     static_cast<unsigned long long>(hash), config.expect_hash.c_str());
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,500 @@
+#include "domain.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <new>
+#include <sched.h>
+#include <sys/mman.h>
+#include <omp.h>
+#include "particle_system.hpp"
+
+namespace {
+
+constexpr uint32_t BATCH_HEADER = UINT32_MAX;
+// Records moved per ring operation while polling.
+constexpr size_t RING_CHUNK = 4096;
+
+size_t round_up(size_t n, size_t alignment) { return (n + alignment - 1) / alignment * alignment; }
+
+size_t next_pow2(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+double now_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Pins the calling process to its share of the CPUs it may run on. The
+// blocks are contiguous in CPU numbering, which on the usual multi-socket
+// layouts keeps each worker on one node, so its first-touched memory is
+// local. Returns the CPUs in the block.
+int pin_worker(int worker, int num_workers) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return 0;
+    std::vector<int> cpus;
+    for (int c = 0; c < CPU_SETSIZE; ++c) {
+        if (CPU_ISSET(c, &allowed)) cpus.push_back(c);
+    }
+    if (cpus.empty()) return 0;
+
+    const size_t n = cpus.size();
+    size_t first = n * worker / num_workers;
+    size_t last = n * (worker + 1) / num_workers;
+    if (first == last) {
+        // More workers than CPUs: share them round robin.
+        first = worker % n;
+        last = first + 1;
+    }
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (size_t c = first; c < last; ++c) {
+        CPU_SET(cpus[c], &mask);
+    }
+    if (sched_setaffinity(0, sizeof(mask), &mask) != 0) return 0;
+    return static_cast<int>(last - first);
+}
+
+// One worker: its part of the particles in a ParticleSystem over the whole
+// world, and the batches in flight to and from its neighbors.
+class DomainWorker {
+public:
+    DomainWorker(const SimConfig& config, const DomainOptions& options, DomainShared& shared, int worker)
+        : config_(config), options_(options), shared_(shared), control_(shared.control()), worker_(worker),
+          left_((worker + control_.num_workers - 1) % control_.num_workers),
+          right_((worker + 1) % control_.num_workers) {
+        std::copy(control_.edges, control_.edges + control_.num_workers + 1, edges_);
+    }
+
+    bool run();
+
+private:
+    void setup();
+    void send_halos();
+    bool receive_ghosts();
+    void send_migrants();
+    bool receive_migrants();
+    bool rebalance();
+    void write_final();
+
+    void begin_batches();
+    void end_batches();
+    // Moves what fits of the outgoing batches into the rings and whatever
+    // arrived into the inboxes; false once some worker aborted.
+    bool poll();
+    // Waits for the next batch from the left (side 0) or right (1) neighbor.
+    bool receive_batch(int side, std::vector<HaloRecord>& records);
+
+    void adopt(const HaloRecord& record);
+
+    const SimConfig& config_;
+    const DomainOptions& options_;
+    DomainShared& shared_;
+    DomainControl& control_;
+    const int worker_;
+    const int left_;
+    const int right_;
+    double edges_[MAX_DOMAIN_WORKERS + 1];
+    float halo_ = 0.0f;
+
+    ParticleSystem local_;
+    // Global id of each local id held by an owned particle.
+    std::vector<uint32_t> global_of_local_;
+    std::vector<uint32_t> ghost_ids_;
+
+    // Per direction: batches being filled this phase, and queued records
+    // not yet pushed into the ring from pending_pos_ on.
+    std::vector<HaloRecord> batch_[2];
+    std::vector<HaloRecord> pending_[2];
+    size_t pending_pos_[2] = {};
+    // Per side: records popped from the ring and not yet consumed.
+    std::vector<HaloRecord> inbox_[2];
+    size_t inbox_pos_[2] = {};
+    std::vector<HaloRecord> received_;
+};
+
+void DomainWorker::setup() {
+    // The whole initial state is generated exactly as nucleon_headless does,
+    // so the decomposed run starts from the same particles and rules.
+    ParticleSystem full;
+    full.seed = config_.seed;
+    full.init(config_.num_particles, config_.num_types, config_.world_width, config_.world_height);
+    apply_config(config_, full);
+
+    local_.seed = config_.seed;
+    local_.init(0, config_.num_types, config_.world_width, config_.world_height);
+    apply_config(config_, local_);
+    for (int i = 0; i < config_.num_types; ++i) {
+        for (int j = 0; j < config_.num_types; ++j) {
+            local_.set_attraction(i, j, full.attraction(i, j));
+        }
+    }
+
+    const double left = edges_[worker_];
+    const double right = edges_[worker_ + 1];
+    // Room for the strip's share plus its halos before any growth.
+    const double share = (right - left + 2.0 * halo_) / config_.world_width;
+    local_.reserve(static_cast<size_t>(config_.num_particles * share * 1.25) + 1024);
+    global_of_local_.reserve(local_.capacity());
+
+    for (size_t i = 0; i < full.count; ++i) {
+        if (full.x[i] < left || full.x[i] >= right) continue;
+        const uint32_t local_id = local_.spawn(full.x[i], full.y[i], full.vx[i], full.vy[i], full.type[i]);
+        if (local_id >= global_of_local_.size()) global_of_local_.resize(local_id + 1);
+        global_of_local_[local_id] = full.id[i];
+    }
+}
+
+void DomainWorker::begin_batches() {
+    for (int d = 0; d < 2; ++d) {
+        batch_[d].clear();
+        batch_[d].push_back({0.0f, 0.0f, 0.0f, 0.0f, 0, BATCH_HEADER});
+    }
+}
+
+void DomainWorker::end_batches() {
+    for (int d = 0; d < 2; ++d) {
+        batch_[d][0].id = static_cast<uint32_t>(batch_[d].size() - 1);
+        if (pending_pos_[d] == pending_[d].size()) {
+            pending_[d].clear();
+            pending_pos_[d] = 0;
+        }
+        pending_[d].insert(pending_[d].end(), batch_[d].begin(), batch_[d].end());
+    }
+}
+
+bool DomainWorker::poll() {
+    for (int d = 0; d < 2; ++d) {
+        std::vector<HaloRecord>& pending = pending_[d];
+        pending_pos_[d] += shared_.ring(worker_, d).push(pending.data() + pending_pos_[d], pending.size() - pending_pos_[d]);
+    }
+
+    // The left neighbor sends to us toward its right, and the right one toward its left.
+    const int senders[2] = {left_, right_};
+    for (int side = 0; side < 2; ++side) {
+        SharedRing& ring = shared_.ring(senders[side], 1 - side);
+        std::vector<HaloRecord>& inbox = inbox_[side];
+        if (inbox_pos_[side] > 0 && inbox_pos_[side] * 2 >= inbox.size()) {
+            inbox.erase(inbox.begin(), inbox.begin() + inbox_pos_[side]);
+            inbox_pos_[side] = 0;
+        }
+        for (;;) {
+            const size_t old_size = inbox.size();
+            inbox.resize(old_size + RING_CHUNK);
+            const size_t popped = ring.pop(inbox.data() + old_size, RING_CHUNK);
+            inbox.resize(old_size + popped);
+            if (popped < RING_CHUNK) break;
+        }
+    }
+    return control_.abort.load(std::memory_order_relaxed) == 0;
+}
+
+bool DomainWorker::receive_batch(int side, std::vector<HaloRecord>& records) {
+    for (;;) {
+        const std::vector<HaloRecord>& inbox = inbox_[side];
+        const size_t available = inbox.size() - inbox_pos_[side];
+        if (available > 0) {
+            const size_t n = inbox[inbox_pos_[side]].id;
+            if (available > n) {
+                const auto first = inbox.begin() + inbox_pos_[side] + 1;
+                records.assign(first, first + n);
+                inbox_pos_[side] += n + 1;
+                return true;
+            }
+        }
+        // Keeps our own batches moving while we wait, so neighbors waiting
+        // on them cannot stall us in turn.
+        if (!poll()) return false;
+        if (inbox_[side].size() - inbox_pos_[side] == available) sched_yield();
+    }
+}
+
+void DomainWorker::send_halos() {
+    const float left = static_cast<float>(edges_[worker_]);
+    const float right = static_cast<float>(edges_[worker_ + 1]);
+    begin_batches();
+    for (size_t i = 0; i < local_.count; ++i) {
+        const float px = local_.x[i];
+        const HaloRecord record = {px, local_.y[i], local_.vx[i], local_.vy[i], 0, local_.type[i]};
+        if (px - left < halo_) batch_[0].push_back(record);
+        if (right - px <= halo_) batch_[1].push_back(record);
+    }
+    control_.workers[worker_].halo_sent += batch_[0].size() + batch_[1].size() - 2;
+    end_batches();
+    poll();
+}
+
+bool DomainWorker::receive_ghosts() {
+    ghost_ids_.clear();
+    for (int side = 0; side < 2; ++side) {
+        if (!receive_batch(side, received_)) return false;
+        for (const HaloRecord& record : received_) {
+            ghost_ids_.push_back(local_.spawn(record.x, record.y, record.vx, record.vy, record.type));
+        }
+    }
+    return true;
+}
+
+void DomainWorker::send_migrants() {
+    const float width = local_.world_width();
+    const float left = static_cast<float>(edges_[worker_]);
+    const float right = static_cast<float>(edges_[worker_ + 1]);
+    begin_batches();
+    // From the back, so the particle despawn moves into a slot is one already seen.
+    for (size_t i = local_.count; i-- > 0;) {
+        const float px = local_.x[i];
+        if (px >= left && px < right) continue;
+        // Whichever edge is nearer around the torus.
+        const float past_left = std::fmod(left - px + width, width);
+        const float past_right = std::fmod(px - right + width, width);
+        const uint32_t local_id = local_.id[i];
+        batch_[past_left <= past_right ? 0 : 1].push_back(
+            {px, local_.y[i], local_.vx[i], local_.vy[i], global_of_local_[local_id], local_.type[i]});
+        local_.despawn(local_id);
+    }
+    control_.workers[worker_].migrated += batch_[0].size() + batch_[1].size() - 2;
+    end_batches();
+    poll();
+}
+
+void DomainWorker::adopt(const HaloRecord& record) {
+    const uint32_t local_id = local_.spawn(record.x, record.y, record.vx, record.vy, record.type);
+    if (local_id >= global_of_local_.size()) global_of_local_.resize(local_id + 1);
+    global_of_local_[local_id] = record.id;
+}
+
+bool DomainWorker::receive_migrants() {
+    for (int side = 0; side < 2; ++side) {
+        if (!receive_batch(side, received_)) return false;
+        for (const HaloRecord& record : received_) {
+            adopt(record);
+        }
+    }
+    return true;
+}
+
+bool DomainWorker::rebalance() {
+    const int num_workers = control_.num_workers;
+    const double width = local_.world_width();
+    DomainWorkerStats& own = control_.workers[worker_];
+    std::fill(own.histogram, own.histogram + REBALANCE_BINS, 0u);
+    for (size_t i = 0; i < local_.count; ++i) {
+        const int bin = std::min(static_cast<int>(local_.x[i] / width * REBALANCE_BINS), REBALANCE_BINS - 1);
+        own.histogram[bin]++;
+    }
+    own.owned = local_.count;
+    if (!shared_.barrier()) return false;
+
+    // Every worker computes the same edges from the same shared numbers.
+    // A bin weighs its particles times their owner's measured seconds per
+    // particle-step, so strips of slower (denser) regions shrink.
+    std::vector<double> weight(REBALANCE_BINS, 0.0);
+    for (int w = 0; w < num_workers; ++w) {
+        const DomainWorkerStats& stats = control_.workers[w];
+        const double cost = stats.window_particle_steps > 0 ? stats.window_busy_seconds / stats.window_particle_steps : 1.0;
+        for (int b = 0; b < REBALANCE_BINS; ++b) {
+            weight[b] += stats.histogram[b] * cost;
+        }
+    }
+    double total = 0.0;
+    for (const double w : weight) total += w;
+
+    double next[MAX_DOMAIN_WORKERS + 1];
+    next[0] = 0.0;
+    next[num_workers] = width;
+    if (total > 0.0) {
+        double sum = 0.0;
+        int b = 0;
+        for (int k = 1; k < num_workers; ++k) {
+            const double target = total * k / num_workers;
+            while (b < REBALANCE_BINS - 1 && sum + weight[b] < target) sum += weight[b++];
+            const double fraction = weight[b] > 0.0 ? std::clamp((target - sum) / weight[b], 0.0, 1.0) : 0.0;
+            next[k] = (b + fraction) * width / REBALANCE_BINS;
+        }
+    } else {
+        std::copy(edges_, edges_ + num_workers + 1, next);
+    }
+
+    // An edge moves at most halfway into either strip it borders, and no
+    // strip gets narrower than two halos.
+    const double min_width = 2.0 * halo_;
+    for (int k = 1; k < num_workers; ++k) {
+        next[k] = std::clamp(next[k], 0.5 * (edges_[k - 1] + edges_[k]), 0.5 * (edges_[k] + edges_[k + 1]));
+    }
+    for (int k = 1; k < num_workers; ++k) next[k] = std::max(next[k], next[k - 1] + min_width);
+    for (int k = num_workers - 1; k > 0; --k) next[k] = std::min(next[k], next[k + 1] - min_width);
+
+    // Everyone has read the histograms before any worker can refill them.
+    if (!shared_.barrier()) return false;
+    std::copy(next, next + num_workers + 1, edges_);
+    if (worker_ == 0) {
+        std::copy(next, next + num_workers + 1, control_.edges);
+        control_.rebalances++;
+    }
+    own.window_busy_seconds = 0.0;
+    own.window_particle_steps = 0;
+
+    send_migrants();
+    return receive_migrants();
+}
+
+void DomainWorker::write_final() {
+    HaloRecord* records = shared_.final_records();
+    for (size_t i = 0; i < local_.count; ++i) {
+        records[global_of_local_[local_.id[i]]] = {local_.x[i], local_.y[i], local_.vx[i], local_.vy[i],
+                                                    global_of_local_[local_.id[i]], local_.type[i]};
+    }
+    control_.workers[worker_].owned = local_.count;
+}
+
+bool DomainWorker::run() {
+    halo_ = options_.halo > 0.0f ? options_.halo : config_.interaction_radius;
+    setup();
+
+    DomainWorkerStats& own = control_.workers[worker_];
+    const auto start = std::chrono::steady_clock::now();
+    auto last_report = start;
+
+    for (int step = 1; step <= config_.steps; ++step) {
+        send_halos();
+        if (!receive_ghosts()) return false;
+
+        const size_t owned = local_.count - ghost_ids_.size();
+        const double update_start = now_seconds();
+        local_.update(config_.dt);
+        const double busy = now_seconds() - update_start;
+        own.busy_seconds += busy;
+        own.window_busy_seconds += busy;
+        own.window_particle_steps += owned;
+
+        // Ghosts only lent their forces; their owners integrate them.
+        for (const uint32_t ghost : ghost_ids_) {
+            local_.despawn(ghost);
+        }
+
+        send_migrants();
+        if (!receive_migrants()) return false;
+
+        if (options_.rebalance_every > 0 && step % options_.rebalance_every == 0 && step < config_.steps &&
+            !rebalance()) {
+            return false;
+        }
+
+        if (worker_ == 0 && config_.report_every > 0 && step % config_.report_every == 0) {
+            const auto now = std::chrono::steady_clock::now();
+            const double interval = std::chrono::duration<double>(now - last_report).count();
+            std::printf("step %d: %.1f steps/sec\n", step, config_.report_every / interval);
+            std::fflush(stdout);
+            last_report = now;
+        }
+    }
+
+    write_final();
+    return shared_.barrier();
+}
+
+} // namespace
+
+void SharedRing::init(size_t capacity) {
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+    capacity_ = capacity;
+}
+
+size_t SharedRing::push(const HaloRecord* records, size_t n) {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    n = std::min<size_t>(n, capacity_ - (tail - head));
+    HaloRecord* ring = this->records();
+    for (size_t i = 0; i < n; ++i) {
+        ring[(tail + i) & (capacity_ - 1)] = records[i];
+    }
+    tail_.store(tail + n, std::memory_order_release);
+    return n;
+}
+
+size_t SharedRing::pop(HaloRecord* records, size_t n) {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    const uint64_t tail = tail_.load(std::memory_order_acquire);
+    n = std::min<size_t>(n, tail - head);
+    const HaloRecord* ring = this->records();
+    for (size_t i = 0; i < n; ++i) {
+        records[i] = ring[(head + i) & (capacity_ - 1)];
+    }
+    head_.store(head + n, std::memory_order_release);
+    return n;
+}
+
+DomainShared::~DomainShared() {
+    if (base_) munmap(base_, bytes_);
+}
+
+bool DomainShared::create(int num_workers, size_t num_particles, float world_width) {
+    if (num_workers < 1 || num_workers > MAX_DOMAIN_WORKERS) return false;
+
+    // Sized for a whole strip's worth of migrants or halo in one batch.
+    const size_t capacity = next_pow2(std::max<size_t>(65536, 4 * num_particles / num_workers));
+    const size_t control_bytes = round_up(sizeof(DomainControl), 64);
+    const size_t ring_bytes = round_up(SharedRing::bytes(capacity), 64);
+    const size_t num_rings = 2 * static_cast<size_t>(num_workers);
+    bytes_ = control_bytes + num_rings * ring_bytes + num_particles * sizeof(HaloRecord);
+
+    // Inherited by the forked workers. MAP_NORESERVE: ring pages are only
+    // backed once a batch actually reaches them.
+    void* base = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) return false;
+    base_ = base;
+
+    auto* bytes = static_cast<unsigned char*>(base_);
+    control_ = new (bytes) DomainControl();
+    control_->num_workers = num_workers;
+    control_->num_particles = num_particles;
+    for (int w = 0; w <= num_workers; ++w) {
+        control_->edges[w] = static_cast<double>(world_width) * w / num_workers;
+    }
+
+    rings_.resize(num_rings);
+    for (size_t r = 0; r < num_rings; ++r) {
+        rings_[r] = reinterpret_cast<SharedRing*>(bytes + control_bytes + r * ring_bytes);
+        rings_[r]->init(capacity);
+    }
+    final_ = reinterpret_cast<HaloRecord*>(bytes + control_bytes + num_rings * ring_bytes);
+    return true;
+}
+
+SharedRing& DomainShared::ring(int from, int direction) {
+    return *rings_[2 * static_cast<size_t>(from) + direction];
+}
+
+bool DomainShared::barrier() {
+    DomainControl& c = *control_;
+    const uint32_t generation = c.barrier_generation.load(std::memory_order_acquire);
+    if (c.barrier_count.fetch_add(1, std::memory_order_acq_rel) + 1 == static_cast<uint32_t>(c.num_workers)) {
+        c.barrier_count.store(0, std::memory_order_relaxed);
+        c.barrier_generation.fetch_add(1, std::memory_order_release);
+    } else {
+        while (c.barrier_generation.load(std::memory_order_acquire) == generation) {
+            if (c.abort.load(std::memory_order_relaxed)) return false;
+            sched_yield();
+        }
+    }
+    return c.abort.load(std::memory_order_relaxed) == 0;
+}
+
+bool run_domain_worker(const SimConfig& config, const DomainOptions& options, DomainShared& shared, int worker) {
+    const int num_workers = shared.control().num_workers;
+    const int cpus = options.pin ? pin_worker(worker, num_workers) : 0;
+    // Before the first parallel region, so the worker's threads start on its own CPUs.
+    if (config.threads <= 0) {
+        omp_set_num_threads(std::max(1, cpus > 0 ? cpus : omp_get_num_procs() / num_workers));
+    }
+
+    DomainWorker domain_worker(config, options, shared, worker);
+    if (domain_worker.run()) return true;
+    shared.control().abort.store(1, std::memory_order_relaxed);
+    return false;
+}
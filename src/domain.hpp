@@ -0,0 +1,127 @@
+#ifndef DOMAIN_HPP
+#define DOMAIN_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "config.hpp"
+
+// Multi-process domain decomposition (POSIX only). The torus is cut into
+// vertical strips, one per worker process. Each worker simulates the
+// particles of its strip with an ordinary ParticleSystem covering the whole
+// world, plus ghost copies of the particles within the halo width of its
+// edges, received from the two neighbor strips every step, so the forces on
+// its own particles are complete. Ghosts are dropped after the step, and
+// particles that crossed an edge move to the neighbor. Neighbors talk
+// through single-producer single-consumer rings in memory shared by all
+// workers, so a step needs no global synchronization.
+//
+// Every rebalance_every steps the workers share a histogram of their
+// particles along x and the busy time per particle, and all of them move
+// the edges so each strip gets the same estimated work. An edge moves at
+// most halfway into a neighbor strip, so every particle still has at most
+// one strip to go.
+
+constexpr int MAX_DOMAIN_WORKERS = 64;
+// Histogram bins along x for rebalancing.
+constexpr int REBALANCE_BINS = 4096;
+
+struct DomainOptions {
+    int workers = 2;
+    // Ghost margin; 0 means the interaction radius, and it may not be less.
+    float halo = 0.0f;
+    int rebalance_every = 50;
+    // Pin each worker to its own contiguous block of CPUs.
+    bool pin = true;
+};
+
+// A particle as it travels between workers. As a batch header, id holds the
+// number of records that follow and type is BATCH_HEADER.
+struct HaloRecord {
+    float x, y, vx, vy;
+    uint32_t id;
+    uint32_t type;
+};
+
+// Single-producer single-consumer ring of records in shared memory. head
+// and tail count records ever popped and pushed, so the ring is empty when
+// they are equal and full when they are capacity apart.
+class SharedRing {
+public:
+    static size_t bytes(size_t capacity) { return sizeof(SharedRing) + capacity * sizeof(HaloRecord); }
+    void init(size_t capacity);
+
+    // Both move as many records as fit or are available and return the count.
+    size_t push(const HaloRecord* records, size_t n);
+    size_t pop(HaloRecord* records, size_t n);
+
+private:
+    HaloRecord* records() { return reinterpret_cast<HaloRecord*>(this + 1); }
+
+    alignas(64) std::atomic<uint64_t> head_;
+    alignas(64) std::atomic<uint64_t> tail_;
+    alignas(64) uint64_t capacity_;
+};
+
+struct DomainWorkerStats {
+    uint64_t owned = 0;
+    // Seconds spent in ParticleSystem::update, since the start and since the
+    // last rebalance.
+    double busy_seconds = 0.0;
+    double window_busy_seconds = 0.0;
+    uint64_t window_particle_steps = 0;
+    uint64_t halo_sent = 0;
+    uint64_t migrated = 0;
+    uint32_t histogram[REBALANCE_BINS];
+};
+
+// Everything the workers share, placed at the start of the shared mapping;
+// the rings and the final particle records follow it.
+struct DomainControl {
+    alignas(64) std::atomic<uint32_t> barrier_count;
+    std::atomic<uint32_t> barrier_generation;
+    std::atomic<uint32_t> abort;
+    int num_workers;
+    size_t num_particles;
+    uint64_t rebalances;
+    // Strip w is [edges[w], edges[w + 1]), with edges[0] = 0 and
+    // edges[num_workers] = world width.
+    double edges[MAX_DOMAIN_WORKERS + 1];
+    DomainWorkerStats workers[MAX_DOMAIN_WORKERS];
+};
+
+// The shared mapping, created before the workers are forked.
+class DomainShared {
+public:
+    DomainShared() = default;
+    ~DomainShared();
+    DomainShared(const DomainShared&) = delete;
+    DomainShared& operator=(const DomainShared&) = delete;
+
+    bool create(int num_workers, size_t num_particles, float world_width);
+
+    DomainControl& control() { return *control_; }
+    // Ring from worker `from` toward its left (direction 0) or right (1) neighbor.
+    SharedRing& ring(int from, int direction);
+    // Final state by particle id, written by the workers at the end.
+    HaloRecord* final_records() { return final_; }
+
+    // Spinning wait of all workers; returns false once some worker aborted.
+    bool barrier();
+
+private:
+    void* base_ = nullptr;
+    size_t bytes_ = 0;
+    DomainControl* control_ = nullptr;
+    std::vector<SharedRing*> rings_;
+    HaloRecord* final_ = nullptr;
+};
+
+// Runs worker `worker` of the decomposition of config to the end and writes
+// its particles into the final records. Call in the forked worker process,
+// before it has used OpenMP. Returns false on failure, after raising the
+// abort flag so the other workers stop too.
+bool run_domain_worker(const SimConfig& config, const DomainOptions& options, DomainShared& shared, int worker);
+
+#endif
@@ -0,0 +1,133 @@
+#include "ensemble.hpp"
+#include <chrono>
+#include <string>
+#include <omp.h>
+
+double score_mean_speed(const ParticleSystem& particles) {
+    if (particles.count == 0) return 0.0;
+    double sum = 0.0;
+    for (size_t i = 0; i < particles.count; ++i) {
+        sum += std::sqrt(particles.vx[i] * particles.vx[i] + particles.vy[i] * particles.vy[i]);
+    }
+    return sum / particles.count;
+}
+
+double score_clumping(const ParticleSystem& particles) {
+    if (particles.count == 0) return 0.0;
+    const float radius = particles.interaction_radius;
+    const int columns = std::max(1, static_cast<int>(particles.world_width() / radius));
+    const int rows = std::max(1, static_cast<int>(particles.world_height() / radius));
+    const float scale_x = columns / particles.world_width();
+    const float scale_y = rows / particles.world_height();
+
+    std::vector<uint32_t> counts(static_cast<size_t>(columns) * rows, 0);
+    for (size_t i = 0; i < particles.count; ++i) {
+        const int cx = std::min(static_cast<int>(particles.x[i] * scale_x), columns - 1);
+        const int cy = std::min(static_cast<int>(particles.y[i] * scale_y), rows - 1);
+        counts[static_cast<size_t>(cy) * columns + cx]++;
+    }
+
+    const double mean = static_cast<double>(particles.count) / counts.size();
+    double variance = 0.0;
+    for (const uint32_t c : counts) {
+        variance += (c - mean) * (c - mean);
+    }
+    return variance / counts.size() / mean;
+}
+
+void EnsembleRunner::run_one(ParticleSystem& particles, const EnsembleRun& run, EnsembleResult& result) const {
+    const auto start = std::chrono::steady_clock::now();
+
+    SimConfig config = config_;
+    config.seed = run.seed;
+    config.threads = 0;
+    if (!run.matrix.empty()) config.matrix = run.matrix;
+
+    particles.seed = config.seed;
+    particles.init(config.num_particles, config.num_types, config.world_width, config.world_height);
+    apply_config(config, particles);
+
+    for (int step = 0; step < config.steps; ++step) {
+        particles.update(config.dt);
+    }
+
+    const std::span<const float> matrix = particles.attraction_matrix();
+    result.seed = run.seed;
+    result.score = score ? score(particles) : 0.0;
+    result.state_hash = particles.state_hash();
+    result.matrix.assign(matrix.begin(), matrix.end());
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<EnsembleResult> EnsembleRunner::run(std::span<const EnsembleRun> runs) {
+    std::vector<EnsembleResult> results(runs.size());
+    const int num_runs = static_cast<int>(runs.size());
+    const auto start = std::chrono::steady_clock::now();
+
+    // Keeps the systems' own parallel regions on their run's thread.
+    const int saved_levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(1);
+
+#pragma omp parallel
+    {
+#pragma omp single
+        if (workers_.size() < static_cast<size_t>(omp_get_num_threads())) {
+            workers_.resize(omp_get_num_threads());
+        }
+
+        // Created by the thread that uses it, so its arrays are first touched there.
+        std::unique_ptr<ParticleSystem>& worker = workers_[omp_get_thread_num()];
+        if (!worker) worker = std::make_unique<ParticleSystem>();
+
+#pragma omp for schedule(dynamic, 1)
+        for (int r = 0; r < num_runs; ++r) {
+            run_one(*worker, runs[r], results[r]);
+        }
+    }
+
+    omp_set_max_active_levels(saved_levels);
+
+    elapsed_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    system_steps_per_second_ = elapsed_seconds_ > 0.0 ? static_cast<double>(num_runs) * config_.steps / elapsed_seconds_ : 0.0;
+    return results;
+}
+
+std::vector<EnsembleResult> EnsembleRunner::run_sequential(std::span<const EnsembleRun> runs) {
+    std::vector<EnsembleResult> results(runs.size());
+    const auto start = std::chrono::steady_clock::now();
+
+    ParticleSystem particles;
+    for (size_t r = 0; r < runs.size(); ++r) {
+        run_one(particles, runs[r], results[r]);
+    }
+
+    elapsed_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    system_steps_per_second_ = elapsed_seconds_ > 0.0 ? static_cast<double>(runs.size()) * config_.steps / elapsed_seconds_ : 0.0;
+    return results;
+}
+
+void write_ensemble_results(FILE* out, std::span<const EnsembleResult> results, bool json) {
+    // Formatted into one buffer and written with a single call.
+    std::string text;
+    char field[128];
+    text += json ? "[\n" : "run,seed,score,state_hash,seconds,matrix\n";
+
+    for (size_t r = 0; r < results.size(); ++r) {
+        const EnsembleResult& result = results[r];
+        std::snprintf(field, sizeof(field), json ? "%s  {\"run\": %zu, \"seed\": %llu, " : "%s%zu,%llu,",
+                      json && r > 0 ? ",\n" : "", r, static_cast<unsigned long long>(result.seed));
+        text += field;
+        std::snprintf(field, sizeof(field), json ? "\"score\": %.6g, \"state_hash\": \"%016llx\", \"seconds\": %.4f, \"matrix\": ["
+                                                 : "%.6g,%016llx,%.4f,",
+                      result.score, static_cast<unsigned long long>(result.state_hash), result.seconds);
+        text += field;
+        for (size_t k = 0; k < result.matrix.size(); ++k) {
+            std::snprintf(field, sizeof(field), k == 0 ? "%.6g" : (json ? ", %.6g" : " %.6g"), result.matrix[k]);
+            text += field;
+        }
+        text += json ? "]}" : "\n";
+    }
+    if (json) text += "\n]\n";
+
+    std::fwrite(text.data(), 1, text.size(), out);
+}
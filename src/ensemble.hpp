@@ -0,0 +1,78 @@
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+#include "config.hpp"
+#include "particle_system.hpp"
+
+// One member of an ensemble: the seed of its initial state and, unless the
+// matrix is empty, its rules (otherwise randomized from the seed).
+struct EnsembleRun {
+    uint64_t seed = 1;
+    std::vector<float> matrix;
+};
+
+struct EnsembleResult {
+    uint64_t seed = 0;
+    double score = 0.0;
+    uint64_t state_hash = 0;
+    double seconds = 0.0;
+    // The rules the run used, num_types x num_types.
+    std::vector<float> matrix;
+};
+
+// Called on the final state of each run, on the thread that ran it.
+using EnsembleScore = std::function<double(const ParticleSystem&)>;
+
+// Mean particle speed.
+double score_mean_speed(const ParticleSystem& particles);
+// Variance over mean of the particle counts in radius-sized cells: about 1
+// for particles scattered at random, growing as they gather into clusters.
+double score_clumping(const ParticleSystem& particles);
+
+// Steps many small, independent systems at once. Each OpenMP thread runs
+// whole systems one after another, taking the next run from a shared
+// counter, and the systems' own parallel regions run on that thread alone,
+// so small runs pay no fork/join per step. Every thread keeps one
+// ParticleSystem and reinitializes it per run, so after its first run the
+// particle arrays and grid are reused instead of allocated, and stay in
+// memory first touched by that thread.
+//
+// A run is set up exactly as nucleon_headless sets up the same config with
+// the run's seed and matrix, so any run can be replayed on its own.
+class EnsembleRunner {
+public:
+    explicit EnsembleRunner(const SimConfig& config) : config_(config) {}
+
+    // Optional; runs score 0 without it.
+    EnsembleScore score;
+
+    // Results are in the order of runs.
+    std::vector<EnsembleResult> run(std::span<const EnsembleRun> runs);
+    // Runs one after another, each spread over every thread, for comparison.
+    std::vector<EnsembleResult> run_sequential(std::span<const EnsembleRun> runs);
+
+    // Steps simulated per wall second by the last run() or run_sequential(),
+    // summed over systems.
+    double system_steps_per_second() const { return system_steps_per_second_; }
+    double elapsed_seconds() const { return elapsed_seconds_; }
+
+private:
+    void run_one(ParticleSystem& particles, const EnsembleRun& run, EnsembleResult& result) const;
+
+    SimConfig config_;
+    std::vector<std::unique_ptr<ParticleSystem>> workers_;
+    double system_steps_per_second_ = 0.0;
+    double elapsed_seconds_ = 0.0;
+};
+
+// All results in one CSV (matrix values space separated in the last column)
+// or JSON document.
+void write_ensemble_results(FILE* out, std::span<const EnsembleResult> results, bool json);
+
+#endif
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <omp.h>
+#include "config.hpp"
+#include "ensemble.hpp"
+
+// Runs many independent simulations with seeds seed, seed + 1, ... and
+// randomized rules, scores each final state and writes one line per run.
+// Takes every nucleon_headless option for the shared setup, plus its own.
+
+static void print_usage(const char* program) {
+    std::printf(
+        "usage: %s [ensemble options] [simulation options]\n"
+        "  --runs N             independent runs (default 64)\n"
+        "  --score S            none | speed | clumping (default clumping)\n"
+        "  --sequential 0|1     run one system at a time on all threads instead,\n"
+        "                       for comparison (default 0)\n"
+        "  --format F           csv | json (default csv)\n"
+        "  --output FILE        write results to FILE instead of stdout\n"
+        "simulation options (--threads sets the concurrent runs):\n",
+        program);
+    print_config_usage(program);
+}
+
+int main(int argc, char** argv) {
+    int num_runs = 64;
+    std::string score_name = "clumping";
+    bool sequential = false;
+    bool json = false;
+    std::string output;
+
+    // Ensemble options are taken out here; the rest go to parse_config_args.
+    std::vector<char*> sim_args = {argv[0]};
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        const bool ours = std::strcmp(arg, "--runs") == 0 || std::strcmp(arg, "--score") == 0 ||
+                          std::strcmp(arg, "--sequential") == 0 || std::strcmp(arg, "--format") == 0 ||
+                          std::strcmp(arg, "--output") == 0;
+        if (!ours) {
+            sim_args.push_back(argv[i]);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "error: missing value for %s\n", arg);
+            return 1;
+        }
+        const char* value = argv[++i];
+        bool ok = true;
+        if (std::strcmp(arg, "--runs") == 0) ok = (num_runs = std::atoi(value)) > 0;
+        else if (std::strcmp(arg, "--score") == 0) {
+            score_name = value;
+            ok = score_name == "none" || score_name == "speed" || score_name == "clumping";
+        } else if (std::strcmp(arg, "--sequential") == 0) sequential = std::atoi(value) != 0;
+        else if (std::strcmp(arg, "--format") == 0) {
+            json = std::strcmp(value, "json") == 0;
+            ok = json || std::strcmp(value, "csv") == 0;
+        } else output = value;
+
+        if (!ok) {
+            std::fprintf(stderr, "error: invalid value '%s' for %s\n", value, arg);
+            return 1;
+        }
+    }
+
+    SimConfig config;
+    std::string error;
+    if (!parse_config_args(static_cast<int>(sim_args.size()), sim_args.data(), config, error)) {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+    if (config.threads > 0) {
+        omp_set_num_threads(config.threads);
+    }
+
+    std::vector<EnsembleRun> runs(num_runs);
+    for (int r = 0; r < num_runs; ++r) {
+        runs[r].seed = config.seed + r;
+    }
+
+    EnsembleRunner ensemble(config);
+    if (score_name == "speed") ensemble.score = score_mean_speed;
+    else if (score_name == "clumping") ensemble.score = score_clumping;
+
+    const std::vector<EnsembleResult> results = sequential ? ensemble.run_sequential(runs) : ensemble.run(runs);
+
+    FILE* out = stdout;
+    if (!output.empty()) {
+        out = std::fopen(output.c_str(), "w");
+        if (!out) {
+            std::fprintf(stderr, "error: cannot write %s\n", output.c_str());
+            return 1;
+        }
+    }
+    write_ensemble_results(out, results, json);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+
+    const auto best = std::max_element(results.begin(), results.end(),
+                                       [](const EnsembleResult& a, const EnsembleResult& b) { return a.score < b.score; });
+    std::fprintf(stderr, "%d runs of %zu particles x %d steps on %d threads (%s): %.2f s, %.1f system-steps/sec\n",
+                 num_runs, config.num_particles, config.steps, omp_get_max_threads(),
+                 sequential ? "sequential" : "concurrent", ensemble.elapsed_seconds(), ensemble.system_steps_per_second());
+    if (!ensemble.score) return 0;
+    std::fprintf(stderr, "best %s: %.4g (seed %llu)\n", score_name.c_str(), best->score,
+                 static_cast<unsigned long long>(best->seed));
+    return 0;
+}
@@ -0,0 +1,898 @@
+#include "force_kernels.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define NUCLEON_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Force law policies. Each one turns a matrix coefficient, the squared
+// distance, its reciprocal square root and the reciprocal sensing radius
+// into the factor that multiplies the offset (dx, dy), once per ISA. Lanes
+// outside the interaction radius are masked off by the caller, so they may
+// compute anything.
+struct ConstantLaw {
+    static float scale(float coef, float, float inv_dist, float, const ForceLawParams&) {
+        return coef * inv_dist;
+    }
+#ifdef NUCLEON_X86_SIMD
+    __attribute__((target("avx2,fma")))
+    static __m256 scale_avx2(__m256 coef, __m256, __m256 inv_dist, __m256, const ForceLawParams&) {
+        return _mm256_mul_ps(coef, inv_dist);
+    }
+    __attribute__((target("avx512f")))
+    static __m512 scale_avx512(__m512 coef, __m512, __m512 inv_dist, __m512, const ForceLawParams&) {
+        return _mm512_mul_ps(coef, inv_dist);
+    }
+#endif
+};
+
+struct ClassicLaw {
+    static float scale(float coef, float dist_sq, float inv_dist, float inv_radius, const ForceLawParams& p) {
+        const float x = dist_sq * inv_dist * inv_radius;
+        const float repel = x * p.inv_beta - 1.0f;
+        const float attract = coef * (1.0f - std::fabs(2.0f * x - 1.0f - p.beta) * p.inv_one_minus_beta);
+        return (x < p.beta ? repel : attract) * inv_dist;
+    }
+#ifdef NUCLEON_X86_SIMD
+    __attribute__((target("avx2,fma")))
+    static __m256 scale_avx2(__m256 coef, __m256 dist_sq, __m256 inv_dist, __m256 inv_radius, const ForceLawParams& p) {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 beta = _mm256_set1_ps(p.beta);
+        const __m256 x = _mm256_mul_ps(_mm256_mul_ps(dist_sq, inv_dist), inv_radius);
+        const __m256 repel = _mm256_fmsub_ps(x, _mm256_set1_ps(p.inv_beta), one);
+        const __m256 peak = _mm256_andnot_ps(_mm256_set1_ps(-0.0f),
+            _mm256_sub_ps(_mm256_add_ps(x, x), _mm256_add_ps(one, beta)));
+        const __m256 attract = _mm256_mul_ps(coef,
+            _mm256_fnmadd_ps(peak, _mm256_set1_ps(p.inv_one_minus_beta), one));
+        return _mm256_mul_ps(_mm256_blendv_ps(attract, repel, _mm256_cmp_ps(x, beta, _CMP_LT_OQ)), inv_dist);
+    }
+    __attribute__((target("avx512f")))
+    static __m512 scale_avx512(__m512 coef, __m512 dist_sq, __m512 inv_dist, __m512 inv_radius, const ForceLawParams& p) {
+        const __m512 one = _mm512_set1_ps(1.0f);
+        const __m512 beta = _mm512_set1_ps(p.beta);
+        const __m512 x = _mm512_mul_ps(_mm512_mul_ps(dist_sq, inv_dist), inv_radius);
+        const __m512 repel = _mm512_fmsub_ps(x, _mm512_set1_ps(p.inv_beta), one);
+        const __m512 peak = _mm512_abs_ps(_mm512_sub_ps(_mm512_add_ps(x, x), _mm512_add_ps(one, beta)));
+        const __m512 attract = _mm512_mul_ps(coef,
+            _mm512_fnmadd_ps(peak, _mm512_set1_ps(p.inv_one_minus_beta), one));
+        return _mm512_mul_ps(_mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, beta, _CMP_LT_OQ), attract, repel), inv_dist);
+    }
+#endif
+};
+
+struct SmoothStepLaw {
+    static float scale(float coef, float dist_sq, float inv_dist, float inv_radius, const ForceLawParams&) {
+        const float x = dist_sq * inv_dist * inv_radius;
+        return coef * (1.0f - x * x * (3.0f - 2.0f * x)) * inv_dist;
+    }
+#ifdef NUCLEON_X86_SIMD
+    __attribute__((target("avx2,fma")))
+    static __m256 scale_avx2(__m256 coef, __m256 dist_sq, __m256 inv_dist, __m256 inv_radius, const ForceLawParams&) {
+        const __m256 x = _mm256_mul_ps(_mm256_mul_ps(dist_sq, inv_dist), inv_radius);
+        const __m256 step = _mm256_mul_ps(_mm256_mul_ps(x, x),
+            _mm256_fnmadd_ps(_mm256_set1_ps(2.0f), x, _mm256_set1_ps(3.0f)));
+        return _mm256_mul_ps(_mm256_mul_ps(coef, _mm256_sub_ps(_mm256_set1_ps(1.0f), step)), inv_dist);
+    }
+    __attribute__((target("avx512f")))
+    static __m512 scale_avx512(__m512 coef, __m512 dist_sq, __m512 inv_dist, __m512 inv_radius, const ForceLawParams&) {
+        const __m512 x = _mm512_mul_ps(_mm512_mul_ps(dist_sq, inv_dist), inv_radius);
+        const __m512 step = _mm512_mul_ps(_mm512_mul_ps(x, x),
+            _mm512_fnmadd_ps(_mm512_set1_ps(2.0f), x, _mm512_set1_ps(3.0f)));
+        return _mm512_mul_ps(_mm512_mul_ps(coef, _mm512_sub_ps(_mm512_set1_ps(1.0f), step)), inv_dist);
+    }
+#endif
+};
+
+// The vector kernels evaluate the same bit-trick estimate plus one Newton
+// step lane-wise, so every kernel applies identical per-pair forces and only
+// the summation order differs.
+template <typename Law>
+static void cell_forces_scalar(const CellForceArgs& a, uint32_t begin, uint32_t end,
+                               const uint32_t* range_begin, const uint32_t* range_end, int num_ranges) {
+    const float half_w = a.world_width * 0.5f;
+    const float half_h = a.world_height * 0.5f;
+    const ForceLawParams law = a.law;
+
+    for (uint32_t i = begin; i < end; ++i) {
+        const float xi = a.x[i];
+        const float yi = a.y[i];
+        const int ti = a.type[i];
+        const float* row = a.matrix + ti * a.matrix_stride;
+        const float radius_sq = a.radius_sq[ti];
+        const float inv_radius = a.inv_radius[ti];
+        float fx = 0.0f;
+        float fy = 0.0f;
+
+        for (int r = 0; r < num_ranges; ++r) {
+            for (uint32_t j = range_begin[r]; j < range_end[r]; ++j) {
+                float dx = a.x[j] - xi;
+                float dy = a.y[j] - yi;
+                dx += (dx < -half_w ? a.world_width : 0.0f) - (dx > half_w ? a.world_width : 0.0f);
+                dy += (dy < -half_h ? a.world_height : 0.0f) - (dy > half_h ? a.world_height : 0.0f);
+                float dist_sq = dx * dx + dy * dy;
+
+                if (dist_sq > 0 && dist_sq < radius_sq) {
+                    float force = Law::scale(row[a.type[j]], dist_sq, fast_inv_sqrt(dist_sq), inv_radius, law);
+                    fx += force * dx;
+                    fy += force * dy;
+                }
+            }
+        }
+
+        a.fx[i] = fx * a.inv_mass[ti];
+        a.fy[i] = fy * a.inv_mass[ti];
+    }
+}
+
+static uint32_t neighbor_scan_scalar(const CellForceArgs& a, uint32_t i, const uint32_t* range_begin,
+                                     const uint32_t* range_end, int num_ranges, float cutoff_sq, uint32_t* out) {
+    const float half_w = a.world_width * 0.5f;
+    const float half_h = a.world_height * 0.5f;
+    const float xi = a.x[i];
+    const float yi = a.y[i];
+    uint32_t n = 0;
+
+    for (int r = 0; r < num_ranges; ++r) {
+        for (uint32_t j = range_begin[r]; j < range_end[r]; ++j) {
+            float dx = a.x[j] - xi;
+            float dy = a.y[j] - yi;
+            dx += (dx < -half_w ? a.world_width : 0.0f) - (dx > half_w ? a.world_width : 0.0f);
+            dy += (dy < -half_h ? a.world_height : 0.0f) - (dy > half_h ? a.world_height : 0.0f);
+            out[n] = j;
+            n += dx * dx + dy * dy < cutoff_sq && j != i;
+        }
+    }
+    return n;
+}
+
+// Same pair test and arithmetic as cell_forces_scalar, over a list row.
+template <typename Law>
+static void list_forces_scalar(const CellForceArgs& a, const NeighborListArgs& list, const uint32_t* order,
+                               uint32_t begin, uint32_t end) {
+    const float half_w = a.world_width * 0.5f;
+    const float half_h = a.world_height * 0.5f;
+    const ForceLawParams law = a.law;
+
+    for (uint32_t k = begin; k < end; ++k) {
+        const uint32_t i = order ? order[k] : k;
+        const float xi = list.x[i];
+        const float yi = list.y[i];
+        const int ti = a.type[i];
+        const float* row = a.matrix + ti * a.matrix_stride;
+        const float radius_sq = a.radius_sq[ti];
+        const float inv_radius = a.inv_radius[ti];
+        float fx = 0.0f;
+        float fy = 0.0f;
+
+        for (uint32_t s = list.start[i]; s < list.start[i + 1]; ++s) {
+            const uint32_t j = list.neighbors[s];
+            float dx = list.x[j] - xi;
+            float dy = list.y[j] - yi;
+            dx += (dx < -half_w ? a.world_width : 0.0f) - (dx > half_w ? a.world_width : 0.0f);
+            dy += (dy < -half_h ? a.world_height : 0.0f) - (dy > half_h ? a.world_height : 0.0f);
+            float dist_sq = dx * dx + dy * dy;
+
+            if (dist_sq > 0 && dist_sq < radius_sq) {
+                float force = Law::scale(row[list.neighbor_types[s]], dist_sq, fast_inv_sqrt(dist_sq), inv_radius, law);
+                fx += force * dx;
+                fy += force * dy;
+            }
+        }
+
+        a.fx[k] = fx * a.inv_mass[ti];
+        a.fy[k] = fy * a.inv_mass[ti];
+    }
+}
+
+#ifdef NUCLEON_X86_SIMD
+
+__attribute__((target("avx2,fma")))
+static inline float hsum_avx2(__m256 v) {
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+// MaxTypes bounds the type count. Up to 32 types the matrix row sits in
+// MaxTypes / 8 registers and the coefficient lookup is a lane permute per
+// register, blended on the type's high bits; 0 gathers from memory, from the
+// int8 table when Quantized.
+template <typename Law, int MaxTypes, bool Quantized>
+__attribute__((target("avx2,fma")))
+static void cell_forces_avx2(const CellForceArgs& a, uint32_t begin, uint32_t end,
+                             const uint32_t* range_begin, const uint32_t* range_end, int num_ranges) {
+    constexpr int ROW_REGS = MaxTypes / 8;
+    const __m256 width = _mm256_set1_ps(a.world_width);
+    const __m256 height = _mm256_set1_ps(a.world_height);
+    const __m256 half_w = _mm256_set1_ps(a.world_width * 0.5f);
+    const __m256 half_h = _mm256_set1_ps(a.world_height * 0.5f);
+    const __m256 neg_half_w = _mm256_set1_ps(-a.world_width * 0.5f);
+    const __m256 neg_half_h = _mm256_set1_ps(-a.world_height * 0.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three_halves = _mm256_set1_ps(1.5f);
+    const __m256 matrix_scale = _mm256_set1_ps(a.matrix_scale);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i magic = _mm256_set1_epi32(0x5f3759df);
+    const ForceLawParams law = a.law;
+
+    __m256i row_mask[ROW_REGS > 0 ? ROW_REGS : 1];
+    for (int k = 0; k < ROW_REGS; ++k) {
+        row_mask[k] = _mm256_cmpgt_epi32(_mm256_set1_epi32(a.num_types - 8 * k), lanes);
+    }
+
+    for (uint32_t i = begin; i < end; ++i) {
+        const __m256 xi = _mm256_set1_ps(a.x[i]);
+        const __m256 yi = _mm256_set1_ps(a.y[i]);
+        const int ti = a.type[i];
+        const float* row = a.matrix + ti * a.matrix_stride;
+        const int8_t* row_q = Quantized ? a.matrix_q + ti * a.matrix_stride : nullptr;
+        const __m256 radius_sq = _mm256_set1_ps(a.radius_sq[ti]);
+        const __m256 inv_radius = _mm256_set1_ps(a.inv_radius[ti]);
+        __m256 row_vec[ROW_REGS > 0 ? ROW_REGS : 1];
+        for (int k = 0; k < ROW_REGS; ++k) {
+            row_vec[k] = _mm256_maskload_ps(row + 8 * k, row_mask[k]);
+        }
+        __m256 acc_x = zero;
+        __m256 acc_y = zero;
+
+        for (int r = 0; r < num_ranges; ++r) {
+            const uint32_t range_end_j = range_end[r];
+
+            for (uint32_t j = range_begin[r]; j < range_end_j; j += 8) {
+                __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(a.x + j), xi);
+                __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(a.y + j), yi);
+
+                dx = _mm256_add_ps(dx, _mm256_and_ps(_mm256_cmp_ps(dx, neg_half_w, _CMP_LT_OQ), width));
+                dx = _mm256_sub_ps(dx, _mm256_and_ps(_mm256_cmp_ps(dx, half_w, _CMP_GT_OQ), width));
+                dy = _mm256_add_ps(dy, _mm256_and_ps(_mm256_cmp_ps(dy, neg_half_h, _CMP_LT_OQ), height));
+                dy = _mm256_sub_ps(dy, _mm256_and_ps(_mm256_cmp_ps(dy, half_h, _CMP_GT_OQ), height));
+
+                __m256 dist_sq = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+
+                __m256 in_range = _mm256_castsi256_ps(
+                    _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(range_end_j - j)), lanes));
+                __m256 valid = _mm256_and_ps(in_range, _mm256_and_ps(
+                    _mm256_cmp_ps(dist_sq, zero, _CMP_GT_OQ),
+                    _mm256_cmp_ps(dist_sq, radius_sq, _CMP_LT_OQ)));
+
+                __m256i types = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a.type + j)));
+                __m256 coef;
+                if constexpr (ROW_REGS > 0) {
+                    coef = _mm256_permutevar8x32_ps(row_vec[0], types);
+                    for (int k = 1; k < ROW_REGS; ++k) {
+                        coef = _mm256_blendv_ps(coef, _mm256_permutevar8x32_ps(row_vec[k], types),
+                            _mm256_castsi256_ps(_mm256_cmpgt_epi32(types, _mm256_set1_epi32(8 * k - 1))));
+                    }
+                } else if constexpr (Quantized) {
+                    // Four bytes per lane; the low one, sign extended, is the entry.
+                    __m256i q = _mm256_i32gather_epi32(reinterpret_cast<const int*>(row_q), types, 1);
+                    q = _mm256_srai_epi32(_mm256_slli_epi32(q, 24), 24);
+                    coef = _mm256_mul_ps(_mm256_cvtepi32_ps(q), matrix_scale);
+                } else {
+                    coef = _mm256_i32gather_ps(row, types, 4);
+                }
+
+                __m256 inv_dist = _mm256_castsi256_ps(_mm256_sub_epi32(
+                    magic, _mm256_srli_epi32(_mm256_castps_si256(dist_sq), 1)));
+                inv_dist = _mm256_mul_ps(inv_dist, _mm256_fnmadd_ps(
+                    _mm256_mul_ps(half, dist_sq), _mm256_mul_ps(inv_dist, inv_dist), three_halves));
+
+                __m256 force = _mm256_and_ps(valid, Law::scale_avx2(coef, dist_sq, inv_dist, inv_radius, law));
+                acc_x = _mm256_fmadd_ps(force, dx, acc_x);
+                acc_y = _mm256_fmadd_ps(force, dy, acc_y);
+            }
+        }
+
+        a.fx[i] = hsum_avx2(acc_x) * a.inv_mass[ti];
+        a.fy[i] = hsum_avx2(acc_y) * a.inv_mass[ti];
+    }
+}
+
+// As cell_forces_avx2 with 16 lanes: up to 64 types the row sits in
+// MaxTypes / 16 registers, looked up with one permute, or with two-table
+// permutes blended on the type's high bits.
+template <typename Law, int MaxTypes, bool Quantized>
+__attribute__((target("avx512f")))
+static void cell_forces_avx512(const CellForceArgs& a, uint32_t begin, uint32_t end,
+                               const uint32_t* range_begin, const uint32_t* range_end, int num_ranges) {
+    constexpr int ROW_REGS = MaxTypes / 16;
+    const __m512 width = _mm512_set1_ps(a.world_width);
+    const __m512 height = _mm512_set1_ps(a.world_height);
+    const __m512 half_w = _mm512_set1_ps(a.world_width * 0.5f);
+    const __m512 half_h = _mm512_set1_ps(a.world_height * 0.5f);
+    const __m512 neg_half_w = _mm512_set1_ps(-a.world_width * 0.5f);
+    const __m512 neg_half_h = _mm512_set1_ps(-a.world_height * 0.5f);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 three_halves = _mm512_set1_ps(1.5f);
+    const __m512 matrix_scale = _mm512_set1_ps(a.matrix_scale);
+    const __m512i magic = _mm512_set1_epi32(0x5f3759df);
+    const ForceLawParams law = a.law;
+
+    __mmask16 row_mask[ROW_REGS > 0 ? ROW_REGS : 1];
+    for (int k = 0; k < ROW_REGS; ++k) {
+        const int left = std::clamp(a.num_types - 16 * k, 0, 16);
+        row_mask[k] = static_cast<__mmask16>((1u << left) - 1);
+    }
+
+    for (uint32_t i = begin; i < end; ++i) {
+        const __m512 xi = _mm512_set1_ps(a.x[i]);
+        const __m512 yi = _mm512_set1_ps(a.y[i]);
+        const int ti = a.type[i];
+        const float* row = a.matrix + ti * a.matrix_stride;
+        const int8_t* row_q = Quantized ? a.matrix_q + ti * a.matrix_stride : nullptr;
+        const __m512 radius_sq = _mm512_set1_ps(a.radius_sq[ti]);
+        const __m512 inv_radius = _mm512_set1_ps(a.inv_radius[ti]);
+        __m512 row_vec[ROW_REGS > 0 ? ROW_REGS : 1];
+        for (int k = 0; k < ROW_REGS; ++k) {
+            row_vec[k] = _mm512_maskz_loadu_ps(row_mask[k], row + 16 * k);
+        }
+        __m512 acc_x = zero;
+        __m512 acc_y = zero;
+
+        for (int r = 0; r < num_ranges; ++r) {
+            const uint32_t range_end_j = range_end[r];
+
+            for (uint32_t j = range_begin[r]; j < range_end_j; j += 16) {
+                const uint32_t remaining = range_end_j - j;
+                const __mmask16 in_range = remaining >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << remaining) - 1);
+
+                __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(a.x + j), xi);
+                __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(a.y + j), yi);
+
+                dx = _mm512_mask_add_ps(dx, _mm512_cmp_ps_mask(dx, neg_half_w, _CMP_LT_OQ), dx, width);
+                dx = _mm512_mask_sub_ps(dx, _mm512_cmp_ps_mask(dx, half_w, _CMP_GT_OQ), dx, width);
+                dy = _mm512_mask_add_ps(dy, _mm512_cmp_ps_mask(dy, neg_half_h, _CMP_LT_OQ), dy, height);
+                dy = _mm512_mask_sub_ps(dy, _mm512_cmp_ps_mask(dy, half_h, _CMP_GT_OQ), dy, height);
+
+                __m512 dist_sq = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+
+                __mmask16 valid = in_range
+                    & _mm512_cmp_ps_mask(dist_sq, zero, _CMP_GT_OQ)
+                    & _mm512_cmp_ps_mask(dist_sq, radius_sq, _CMP_LT_OQ);
+
+                __m512i types = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a.type + j)));
+                __m512 coef;
+                if constexpr (ROW_REGS == 1) {
+                    coef = _mm512_permutexvar_ps(types, row_vec[0]);
+                } else if constexpr (ROW_REGS >= 2) {
+                    coef = _mm512_permutex2var_ps(row_vec[0], types, row_vec[1]);
+                    for (int k = 2; k < ROW_REGS; k += 2) {
+                        coef = _mm512_mask_blend_ps(_mm512_cmpgt_epi32_mask(types, _mm512_set1_epi32(16 * k - 1)), coef,
+                                                    _mm512_permutex2var_ps(row_vec[k], types, row_vec[k + 1]));
+                    }
+                } else if constexpr (Quantized) {
+                    __m512i q = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), valid, types, row_q, 1);
+                    q = _mm512_srai_epi32(_mm512_slli_epi32(q, 24), 24);
+                    coef = _mm512_mul_ps(_mm512_cvtepi32_ps(q), matrix_scale);
+                } else {
+                    coef = _mm512_mask_i32gather_ps(zero, valid, types, row, 4);
+                }
+
+                __m512 inv_dist = _mm512_castsi512_ps(_mm512_sub_epi32(
+                    magic, _mm512_srli_epi32(_mm512_castps_si512(dist_sq), 1)));
+                inv_dist = _mm512_mul_ps(inv_dist, _mm512_fnmadd_ps(
+                    _mm512_mul_ps(half, dist_sq), _mm512_mul_ps(inv_dist, inv_dist), three_halves));
+
+                __m512 force = _mm512_maskz_mov_ps(valid, Law::scale_avx512(coef, dist_sq, inv_dist, inv_radius, law));
+                acc_x = _mm512_fmadd_ps(force, dx, acc_x);
+                acc_y = _mm512_fmadd_ps(force, dy, acc_y);
+            }
+        }
+
+        a.fx[i] = _mm512_reduce_add_ps(acc_x) * a.inv_mass[ti];
+        a.fy[i] = _mm512_reduce_add_ps(acc_y) * a.inv_mass[ti];
+    }
+}
+
+// Lanes of each 8-bit mask's set bits, 3 bits apiece from the lowest, to
+// left-pack the kept candidates with one permute.
+static constexpr auto COMPRESS_LANES = [] {
+    std::array<uint32_t, 256> lanes{};
+    for (uint32_t mask = 0; mask < 256; ++mask) {
+        int n = 0;
+        for (uint32_t lane = 0; lane < 8; ++lane) {
+            if (mask >> lane & 1) lanes[mask] |= lane << (3 * n++);
+        }
+    }
+    return lanes;
+}();
+
+__attribute__((target("avx2,fma")))
+static uint32_t neighbor_scan_avx2(const CellForceArgs& a, uint32_t i, const uint32_t* range_begin,
+                                   const uint32_t* range_end, int num_ranges, float cutoff_sq, uint32_t* out) {
+    const __m256 width = _mm256_set1_ps(a.world_width);
+    const __m256 height = _mm256_set1_ps(a.world_height);
+    const __m256 half_w = _mm256_set1_ps(a.world_width * 0.5f);
+    const __m256 half_h = _mm256_set1_ps(a.world_height * 0.5f);
+    const __m256 neg_half_w = _mm256_set1_ps(-a.world_width * 0.5f);
+    const __m256 neg_half_h = _mm256_set1_ps(-a.world_height * 0.5f);
+    const __m256 cutoff = _mm256_set1_ps(cutoff_sq);
+    const __m256 xi = _mm256_set1_ps(a.x[i]);
+    const __m256 yi = _mm256_set1_ps(a.y[i]);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i shifts = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const __m256i self = _mm256_set1_epi32(static_cast<int>(i));
+    uint32_t n = 0;
+
+    for (int r = 0; r < num_ranges; ++r) {
+        const uint32_t range_end_j = range_end[r];
+
+        for (uint32_t j = range_begin[r]; j < range_end_j; j += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(a.x + j), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(a.y + j), yi);
+
+            dx = _mm256_add_ps(dx, _mm256_and_ps(_mm256_cmp_ps(dx, neg_half_w, _CMP_LT_OQ), width));
+            dx = _mm256_sub_ps(dx, _mm256_and_ps(_mm256_cmp_ps(dx, half_w, _CMP_GT_OQ), width));
+            dy = _mm256_add_ps(dy, _mm256_and_ps(_mm256_cmp_ps(dy, neg_half_h, _CMP_LT_OQ), height));
+            dy = _mm256_sub_ps(dy, _mm256_and_ps(_mm256_cmp_ps(dy, half_h, _CMP_GT_OQ), height));
+
+            const __m256 dist_sq = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+            const __m256i slots = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(j)), lanes);
+            const __m256i in_range = _mm256_andnot_si256(_mm256_cmpeq_epi32(slots, self),
+                _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(range_end_j - j)), lanes));
+            const int keep = _mm256_movemask_ps(_mm256_and_ps(_mm256_castsi256_ps(in_range),
+                                                              _mm256_cmp_ps(dist_sq, cutoff, _CMP_LT_OQ)));
+
+            const __m256i pack = _mm256_and_si256(
+                _mm256_srlv_epi32(_mm256_set1_epi32(static_cast<int>(COMPRESS_LANES[keep])), shifts),
+                _mm256_set1_epi32(7));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + n), _mm256_permutevar8x32_epi32(slots, pack));
+            n += std::popcount(static_cast<uint32_t>(keep));
+        }
+    }
+    return n;
+}
+
+// Eight list entries per step: the entries and their types are contiguous,
+// and each neighbor's (x, y) is one 64-bit gather. The coefficient lookup is
+// cell_forces_avx2's.
+template <typename Law, int MaxTypes, bool Quantized>
+__attribute__((target("avx2,fma")))
+static void list_forces_avx2(const CellForceArgs& a, const NeighborListArgs& list, const uint32_t* order,
+                             uint32_t begin, uint32_t end) {
+    constexpr int ROW_REGS = MaxTypes / 8;
+    const __m256 width = _mm256_set1_ps(a.world_width);
+    const __m256 height = _mm256_set1_ps(a.world_height);
+    const __m256 half_w = _mm256_set1_ps(a.world_width * 0.5f);
+    const __m256 half_h = _mm256_set1_ps(a.world_height * 0.5f);
+    const __m256 neg_half_w = _mm256_set1_ps(-a.world_width * 0.5f);
+    const __m256 neg_half_h = _mm256_set1_ps(-a.world_height * 0.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three_halves = _mm256_set1_ps(1.5f);
+    const __m256 matrix_scale = _mm256_set1_ps(a.matrix_scale);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i magic = _mm256_set1_epi32(0x5f3759df);
+    const __m256i window_last = _mm256_set1_epi32(15);
+    const __m256i upper_half = _mm256_set1_epi32(7);
+    const ForceLawParams law = a.law;
+
+    __m256i row_mask[ROW_REGS > 0 ? ROW_REGS : 1];
+    for (int k = 0; k < ROW_REGS; ++k) {
+        row_mask[k] = _mm256_cmpgt_epi32(_mm256_set1_epi32(a.num_types - 8 * k), lanes);
+    }
+
+    for (uint32_t k = begin; k < end; ++k) {
+        const uint32_t i = order ? order[k] : k;
+        const __m256 xi = _mm256_set1_ps(list.x[i]);
+        const __m256 yi = _mm256_set1_ps(list.y[i]);
+        const int ti = a.type[i];
+        const float* row = a.matrix + ti * a.matrix_stride;
+        const int8_t* row_q = Quantized ? a.matrix_q + ti * a.matrix_stride : nullptr;
+        const __m256 radius_sq = _mm256_set1_ps(a.radius_sq[ti]);
+        const __m256 inv_radius = _mm256_set1_ps(a.inv_radius[ti]);
+        __m256 row_vec[ROW_REGS > 0 ? ROW_REGS : 1];
+        for (int r = 0; r < ROW_REGS; ++r) {
+            row_vec[r] = _mm256_maskload_ps(row + 8 * r, row_mask[r]);
+        }
+        __m256 acc_x = zero;
+        __m256 acc_y = zero;
+        const uint32_t row_end = list.start[i + 1];
+
+        for (uint32_t s = list.start[i]; s < row_end; s += 8) {
+            const __m256i in_range = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(row_end - s)), lanes);
+            // Lanes past the row read particle 0 and are masked off below.
+            const __m256i slots = _mm256_maskload_epi32(reinterpret_cast<const int*>(list.neighbors + s), in_range);
+
+            const uint32_t base = list.neighbors[s];
+            const __m256i offsets = _mm256_sub_epi32(slots, _mm256_set1_epi32(static_cast<int>(base)));
+            // Unsigned offsets past the 16-slot window, in lanes within the row.
+            const __m256i outside = _mm256_andnot_si256(
+                _mm256_cmpeq_epi32(_mm256_min_epu32(offsets, window_last), offsets), in_range);
+            __m256 xj, yj;
+            if (_mm256_testz_si256(outside, outside)) {
+                const __m256 upper = _mm256_castsi256_ps(_mm256_cmpgt_epi32(offsets, upper_half));
+                xj = _mm256_blendv_ps(_mm256_permutevar8x32_ps(_mm256_loadu_ps(list.x + base), offsets),
+                                      _mm256_permutevar8x32_ps(_mm256_loadu_ps(list.x + base + 8), offsets), upper);
+                yj = _mm256_blendv_ps(_mm256_permutevar8x32_ps(_mm256_loadu_ps(list.y + base), offsets),
+                                      _mm256_permutevar8x32_ps(_mm256_loadu_ps(list.y + base + 8), offsets), upper);
+            } else {
+                xj = _mm256_i32gather_ps(list.x, slots, 4);
+                yj = _mm256_i32gather_ps(list.y, slots, 4);
+            }
+            __m256 dx = _mm256_sub_ps(xj, xi);
+            __m256 dy = _mm256_sub_ps(yj, yi);
+
+            dx = _mm256_add_ps(dx, _mm256_and_ps(_mm256_cmp_ps(dx, neg_half_w, _CMP_LT_OQ), width));
+            dx = _mm256_sub_ps(dx, _mm256_and_ps(_mm256_cmp_ps(dx, half_w, _CMP_GT_OQ), width));
+            dy = _mm256_add_ps(dy, _mm256_and_ps(_mm256_cmp_ps(dy, neg_half_h, _CMP_LT_OQ), height));
+            dy = _mm256_sub_ps(dy, _mm256_and_ps(_mm256_cmp_ps(dy, half_h, _CMP_GT_OQ), height));
+
+            __m256 dist_sq = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+
+            __m256 valid = _mm256_and_ps(_mm256_castsi256_ps(in_range), _mm256_and_ps(
+                _mm256_cmp_ps(dist_sq, zero, _CMP_GT_OQ),
+                _mm256_cmp_ps(dist_sq, radius_sq, _CMP_LT_OQ)));
+
+            __m256i types = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(list.neighbor_types + s)));
+            __m256 coef;
+            if constexpr (ROW_REGS > 0) {
+                coef = _mm256_permutevar8x32_ps(row_vec[0], types);
+                for (int r = 1; r < ROW_REGS; ++r) {
+                    coef = _mm256_blendv_ps(coef, _mm256_permutevar8x32_ps(row_vec[r], types),
+                        _mm256_castsi256_ps(_mm256_cmpgt_epi32(types, _mm256_set1_epi32(8 * r - 1))));
+                }
+            } else if constexpr (Quantized) {
+                __m256i q = _mm256_i32gather_epi32(reinterpret_cast<const int*>(row_q), types, 1);
+                q = _mm256_srai_epi32(_mm256_slli_epi32(q, 24), 24);
+                coef = _mm256_mul_ps(_mm256_cvtepi32_ps(q), matrix_scale);
+            } else {
+                coef = _mm256_i32gather_ps(row, types, 4);
+            }
+
+            __m256 inv_dist = _mm256_castsi256_ps(_mm256_sub_epi32(
+                magic, _mm256_srli_epi32(_mm256_castps_si256(dist_sq), 1)));
+            inv_dist = _mm256_mul_ps(inv_dist, _mm256_fnmadd_ps(
+                _mm256_mul_ps(half, dist_sq), _mm256_mul_ps(inv_dist, inv_dist), three_halves));
+
+            __m256 force = _mm256_and_ps(valid, Law::scale_avx2(coef, dist_sq, inv_dist, inv_radius, law));
+            acc_x = _mm256_fmadd_ps(force, dx, acc_x);
+            acc_y = _mm256_fmadd_ps(force, dy, acc_y);
+        }
+
+        a.fx[k] = hsum_avx2(acc_x) * a.inv_mass[ti];
+        a.fy[k] = hsum_avx2(acc_y) * a.inv_mass[ti];
+    }
+}
+
+// Left-packs with a register compress and a plain store, which unlike a
+// compressing store is fast on every AVX-512 core.
+__attribute__((target("avx512f")))
+static uint32_t neighbor_scan_avx512(const CellForceArgs& a, uint32_t i, const uint32_t* range_begin,
+                                     const uint32_t* range_end, int num_ranges, float cutoff_sq, uint32_t* out) {
+    const __m512 width = _mm512_set1_ps(a.world_width);
+    const __m512 height = _mm512_set1_ps(a.world_height);
+    const __m512 half_w = _mm512_set1_ps(a.world_width * 0.5f);
+    const __m512 half_h = _mm512_set1_ps(a.world_height * 0.5f);
+    const __m512 neg_half_w = _mm512_set1_ps(-a.world_width * 0.5f);
+    const __m512 neg_half_h = _mm512_set1_ps(-a.world_height * 0.5f);
+    const __m512 cutoff = _mm512_set1_ps(cutoff_sq);
+    const __m512 xi = _mm512_set1_ps(a.x[i]);
+    const __m512 yi = _mm512_set1_ps(a.y[i]);
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i self = _mm512_set1_epi32(static_cast<int>(i));
+    uint32_t n = 0;
+
+    for (int r = 0; r < num_ranges; ++r) {
+        const uint32_t range_end_j = range_end[r];
+
+        for (uint32_t j = range_begin[r]; j < range_end_j; j += 16) {
+            const uint32_t remaining = range_end_j - j;
+            const __mmask16 in_range = remaining >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << remaining) - 1);
+
+            __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(a.x + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(a.y + j), yi);
+
+            dx = _mm512_mask_add_ps(dx, _mm512_cmp_ps_mask(dx, neg_half_w, _CMP_LT_OQ), dx, width);
+            dx = _mm512_mask_sub_ps(dx, _mm512_cmp_ps_mask(dx, half_w, _CMP_GT_OQ), dx, width);
+            dy = _mm512_mask_add_ps(dy, _mm512_cmp_ps_mask(dy, neg_half_h, _CMP_LT_OQ), dy, height);
+            dy = _mm512_mask_sub_ps(dy, _mm512_cmp_ps_mask(dy, half_h, _CMP_GT_OQ), dy, height);
+
+            const __m512 dist_sq = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+            const __m512i slots = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(j)), lanes);
+            const __mmask16 keep = in_range & _mm512_cmp_ps_mask(dist_sq, cutoff, _CMP_LT_OQ)
+                                 & _mm512_cmpneq_epi32_mask(slots, self);
+
+            _mm512_storeu_si512(out + n, _mm512_maskz_compress_epi32(keep, slots));
+            n += std::popcount(static_cast<uint32_t>(keep));
+        }
+    }
+    return n;
+}
+
+// As list_forces_avx2 with 16 lanes and cell_forces_avx512's lookup.
+template <typename Law, int MaxTypes, bool Quantized>
+__attribute__((target("avx512f")))
+static void list_forces_avx512(const CellForceArgs& a, const NeighborListArgs& list, const uint32_t* order,
+                               uint32_t begin, uint32_t end) {
+    constexpr int ROW_REGS = MaxTypes / 16;
+    const __m512 width = _mm512_set1_ps(a.world_width);
+    const __m512 height = _mm512_set1_ps(a.world_height);
+    const __m512 half_w = _mm512_set1_ps(a.world_width * 0.5f);
+    const __m512 half_h = _mm512_set1_ps(a.world_height * 0.5f);
+    const __m512 neg_half_w = _mm512_set1_ps(-a.world_width * 0.5f);
+    const __m512 neg_half_h = _mm512_set1_ps(-a.world_height * 0.5f);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 three_halves = _mm512_set1_ps(1.5f);
+    const __m512 matrix_scale = _mm512_set1_ps(a.matrix_scale);
+    const __m512i magic = _mm512_set1_epi32(0x5f3759df);
+    const __m512i window = _mm512_set1_epi32(64);
+    const ForceLawParams law = a.law;
+
+    __mmask16 row_mask[ROW_REGS > 0 ? ROW_REGS : 1];
+    for (int k = 0; k < ROW_REGS; ++k) {
+        const int left = std::clamp(a.num_types - 16 * k, 0, 16);
+        row_mask[k] = static_cast<__mmask16>((1u << left) - 1);
+    }
+
+    for (uint32_t k = begin; k < end; ++k) {
+        const uint32_t i = order ? order[k] : k;
+        const __m512 xi = _mm512_set1_ps(list.x[i]);
+        const __m512 yi = _mm512_set1_ps(list.y[i]);
+        const int ti = a.type[i];
+        const float* row = a.matrix + ti * a.matrix_stride;
+        const int8_t* row_q = Quantized ? a.matrix_q + ti * a.matrix_stride : nullptr;
+        const __m512 radius_sq = _mm512_set1_ps(a.radius_sq[ti]);
+        const __m512 inv_radius = _mm512_set1_ps(a.inv_radius[ti]);
+        __m512 row_vec[ROW_REGS > 0 ? ROW_REGS : 1];
+        for (int r = 0; r < ROW_REGS; ++r) {
+            row_vec[r] = _mm512_maskz_loadu_ps(row_mask[r], row + 16 * r);
+        }
+        __m512 acc_x = zero;
+        __m512 acc_y = zero;
+        const uint32_t row_end = list.start[i + 1];
+
+        for (uint32_t s = list.start[i]; s < row_end; s += 16) {
+            const uint32_t remaining = row_end - s;
+            const __mmask16 in_range = remaining >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << remaining) - 1);
+            // Lanes past the row read particle 0 and are masked off below.
+            const __m512i slots = _mm512_maskz_loadu_epi32(in_range, list.neighbors + s);
+
+            const uint32_t base = list.neighbors[s];
+            const __m512i offsets = _mm512_sub_epi32(slots, _mm512_set1_epi32(static_cast<int>(base)));
+            __m512 xj, yj;
+            if (_mm512_mask_cmpge_epu32_mask(in_range, offsets, window) == 0) {
+                const __mmask16 upper = _mm512_cmpgt_epi32_mask(offsets, _mm512_set1_epi32(31));
+                xj = _mm512_mask_blend_ps(upper,
+                    _mm512_permutex2var_ps(_mm512_loadu_ps(list.x + base), offsets, _mm512_loadu_ps(list.x + base + 16)),
+                    _mm512_permutex2var_ps(_mm512_loadu_ps(list.x + base + 32), offsets, _mm512_loadu_ps(list.x + base + 48)));
+                yj = _mm512_mask_blend_ps(upper,
+                    _mm512_permutex2var_ps(_mm512_loadu_ps(list.y + base), offsets, _mm512_loadu_ps(list.y + base + 16)),
+                    _mm512_permutex2var_ps(_mm512_loadu_ps(list.y + base + 32), offsets, _mm512_loadu_ps(list.y + base + 48)));
+            } else {
+                xj = _mm512_i32gather_ps(slots, list.x, 4);
+                yj = _mm512_i32gather_ps(slots, list.y, 4);
+            }
+            __m512 dx = _mm512_sub_ps(xj, xi);
+            __m512 dy = _mm512_sub_ps(yj, yi);
+
+            dx = _mm512_mask_add_ps(dx, _mm512_cmp_ps_mask(dx, neg_half_w, _CMP_LT_OQ), dx, width);
+            dx = _mm512_mask_sub_ps(dx, _mm512_cmp_ps_mask(dx, half_w, _CMP_GT_OQ), dx, width);
+            dy = _mm512_mask_add_ps(dy, _mm512_cmp_ps_mask(dy, neg_half_h, _CMP_LT_OQ), dy, height);
+            dy = _mm512_mask_sub_ps(dy, _mm512_cmp_ps_mask(dy, half_h, _CMP_GT_OQ), dy, height);
+
+            __m512 dist_sq = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+
+            __mmask16 valid = in_range
+                & _mm512_cmp_ps_mask(dist_sq, zero, _CMP_GT_OQ)
+                & _mm512_cmp_ps_mask(dist_sq, radius_sq, _CMP_LT_OQ);
+
+            __m512i types = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(list.neighbor_types + s)));
+            __m512 coef;
+            if constexpr (ROW_REGS == 1) {
+                coef = _mm512_permutexvar_ps(types, row_vec[0]);
+            } else if constexpr (ROW_REGS >= 2) {
+                coef = _mm512_permutex2var_ps(row_vec[0], types, row_vec[1]);
+                for (int r = 2; r < ROW_REGS; r += 2) {
+                    coef = _mm512_mask_blend_ps(_mm512_cmpgt_epi32_mask(types, _mm512_set1_epi32(16 * r - 1)), coef,
+                                                _mm512_permutex2var_ps(row_vec[r], types, row_vec[r + 1]));
+                }
+            } else if constexpr (Quantized) {
+                __m512i q = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), valid, types, row_q, 1);
+                q = _mm512_srai_epi32(_mm512_slli_epi32(q, 24), 24);
+                coef = _mm512_mul_ps(_mm512_cvtepi32_ps(q), matrix_scale);
+            } else {
+                coef = _mm512_mask_i32gather_ps(zero, valid, types, row, 4);
+            }
+
+            __m512 inv_dist = _mm512_castsi512_ps(_mm512_sub_epi32(
+                magic, _mm512_srli_epi32(_mm512_castps_si512(dist_sq), 1)));
+            inv_dist = _mm512_mul_ps(inv_dist, _mm512_fnmadd_ps(
+                _mm512_mul_ps(half, dist_sq), _mm512_mul_ps(inv_dist, inv_dist), three_halves));
+
+            __m512 force = _mm512_maskz_mov_ps(valid, Law::scale_avx512(coef, dist_sq, inv_dist, inv_radius, law));
+            acc_x = _mm512_fmadd_ps(force, dx, acc_x);
+            acc_y = _mm512_fmadd_ps(force, dy, acc_y);
+        }
+
+        a.fx[k] = _mm512_reduce_add_ps(acc_x) * a.inv_mass[ti];
+        a.fy[k] = _mm512_reduce_add_ps(acc_y) * a.inv_mass[ti];
+    }
+}
+
+#endif
+
+ForceKernel resolve_force_kernel(ForceKernel requested) {
+#ifdef NUCLEON_X86_SIMD
+    static const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    static const bool has_avx512 = __builtin_cpu_supports("avx512f");
+
+    if ((requested == ForceKernel::Auto || requested == ForceKernel::AVX512) && has_avx512) {
+        return ForceKernel::AVX512;
+    }
+    if (requested != ForceKernel::Scalar && has_avx2) {
+        return ForceKernel::AVX2;
+    }
+#else
+    (void)requested;
+#endif
+    return ForceKernel::Scalar;
+}
+
+const char* force_kernel_name(ForceKernel kernel) {
+    switch (kernel) {
+        case ForceKernel::Auto: return "auto";
+        case ForceKernel::Scalar: return "scalar";
+        case ForceKernel::AVX2: return "avx2";
+        case ForceKernel::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+int force_kernel_lanes(ForceKernel kernel) {
+    switch (kernel) {
+        case ForceKernel::AVX2: return 8;
+        case ForceKernel::AVX512: return 16;
+        default: return 1;
+    }
+}
+
+ForceLawParams force_law_params(float beta) {
+    ForceLawParams params;
+    params.beta = beta;
+    params.inv_beta = 1.0f / beta;
+    params.inv_one_minus_beta = 1.0f / (1.0f - beta);
+    return params;
+}
+
+const char* force_law_name(ForceLaw law) {
+    switch (law) {
+        case ForceLaw::Constant: return "constant";
+        case ForceLaw::Classic: return "classic";
+        case ForceLaw::SmoothStep: return "smooth";
+    }
+    return "unknown";
+}
+
+// Each side of a pair uses its own type's radius, so a pair within the
+// larger of the two can act on one particle only.
+template <typename Law>
+static void accumulate_pair_forces(const CellForceArgs& a, uint32_t begin, uint32_t end,
+                                   uint32_t other_begin, uint32_t other_end) {
+    const float half_w = a.world_width * 0.5f;
+    const float half_h = a.world_height * 0.5f;
+    const bool same_cell = other_begin == begin;
+    const ForceLawParams law = a.law;
+
+    for (uint32_t i = begin; i < end; ++i) {
+        const float xi = a.x[i];
+        const float yi = a.y[i];
+        const int ti = a.type[i];
+        const float* row = a.matrix + ti * a.matrix_stride;
+        const float radius_sq = a.radius_sq[ti];
+        const float inv_radius = a.inv_radius[ti];
+        float fx = 0.0f;
+        float fy = 0.0f;
+
+        for (uint32_t j = same_cell ? i + 1 : other_begin; j < other_end; ++j) {
+            float dx = a.x[j] - xi;
+            float dy = a.y[j] - yi;
+            dx += (dx < -half_w ? a.world_width : 0.0f) - (dx > half_w ? a.world_width : 0.0f);
+            dy += (dy < -half_h ? a.world_height : 0.0f) - (dy > half_h ? a.world_height : 0.0f);
+            float dist_sq = dx * dx + dy * dy;
+
+            if (dist_sq > 0 && dist_sq < a.max_distance_sq) {
+                const int tj = a.type[j];
+                float inv_dist = fast_inv_sqrt(dist_sq);
+                if (dist_sq < radius_sq) {
+                    float force_i = Law::scale(row[tj], dist_sq, inv_dist, inv_radius, law);
+                    fx += force_i * dx;
+                    fy += force_i * dy;
+                }
+                if (dist_sq < a.radius_sq[tj]) {
+                    float force_j = Law::scale(a.matrix[tj * a.matrix_stride + ti], dist_sq, inv_dist,
+                                               a.inv_radius[tj], law);
+                    a.fx[j] -= force_j * dx;
+                    a.fy[j] -= force_j * dy;
+                }
+            }
+        }
+
+        a.fx[i] += fx;
+        a.fy[i] += fy;
+    }
+}
+
+template <typename Law>
+static CellForceFn select_cell_forces_for(ForceKernel kernel, [[maybe_unused]] int num_types,
+                                          [[maybe_unused]] bool quantized) {
+    switch (kernel) {
+#ifdef NUCLEON_X86_SIMD
+        case ForceKernel::AVX2:
+            if (num_types <= 8) return cell_forces_avx2<Law, 8, false>;
+            if (num_types <= 16) return cell_forces_avx2<Law, 16, false>;
+            if (num_types <= 32) return cell_forces_avx2<Law, 32, false>;
+            return quantized ? cell_forces_avx2<Law, 0, true> : cell_forces_avx2<Law, 0, false>;
+        case ForceKernel::AVX512:
+            if (num_types <= 16) return cell_forces_avx512<Law, 16, false>;
+            if (num_types <= 32) return cell_forces_avx512<Law, 32, false>;
+            if (num_types <= 64) return cell_forces_avx512<Law, 64, false>;
+            return quantized ? cell_forces_avx512<Law, 0, true> : cell_forces_avx512<Law, 0, false>;
+#endif
+        default:
+            return cell_forces_scalar<Law>;
+    }
+}
+
+CellForceFn select_cell_forces(ForceKernel kernel, ForceLaw law, int num_types, bool quantized) {
+    switch (law) {
+        case ForceLaw::Classic: return select_cell_forces_for<ClassicLaw>(kernel, num_types, quantized);
+        case ForceLaw::SmoothStep: return select_cell_forces_for<SmoothStepLaw>(kernel, num_types, quantized);
+        default: return select_cell_forces_for<ConstantLaw>(kernel, num_types, quantized);
+    }
+}
+
+PairForceFn select_pair_forces(ForceLaw law) {
+    switch (law) {
+        case ForceLaw::Classic: return accumulate_pair_forces<ClassicLaw>;
+        case ForceLaw::SmoothStep: return accumulate_pair_forces<SmoothStepLaw>;
+        default: return accumulate_pair_forces<ConstantLaw>;
+    }
+}
+
+NeighborScanFn select_neighbor_scan(ForceKernel kernel) {
+    switch (kernel) {
+#ifdef NUCLEON_X86_SIMD
+        case ForceKernel::AVX2: return neighbor_scan_avx2;
+        case ForceKernel::AVX512: return neighbor_scan_avx512;
+#endif
+        default: return neighbor_scan_scalar;
+    }
+}
+
+template <typename Law>
+static ListForceFn select_list_forces_for(ForceKernel kernel, [[maybe_unused]] int num_types,
+                                          [[maybe_unused]] bool quantized) {
+    switch (kernel) {
+#ifdef NUCLEON_X86_SIMD
+        case ForceKernel::AVX2:
+            if (num_types <= 8) return list_forces_avx2<Law, 8, false>;
+            if (num_types <= 16) return list_forces_avx2<Law, 16, false>;
+            if (num_types <= 32) return list_forces_avx2<Law, 32, false>;
+            return quantized ? list_forces_avx2<Law, 0, true> : list_forces_avx2<Law, 0, false>;
+        case ForceKernel::AVX512:
+            if (num_types <= 16) return list_forces_avx512<Law, 16, false>;
+            if (num_types <= 32) return list_forces_avx512<Law, 32, false>;
+            if (num_types <= 64) return list_forces_avx512<Law, 64, false>;
+            return quantized ? list_forces_avx512<Law, 0, true> : list_forces_avx512<Law, 0, false>;
+#endif
+        default:
+            return list_forces_scalar<Law>;
+    }
+}
+
+ListForceFn select_list_forces(ForceKernel kernel, ForceLaw law, int num_types, bool quantized) {
+    switch (law) {
+        case ForceLaw::Classic: return select_list_forces_for<ClassicLaw>(kernel, num_types, quantized);
+        case ForceLaw::SmoothStep: return select_list_forces_for<SmoothStepLaw>(kernel, num_types, quantized);
+        default: return select_list_forces_for<ConstantLaw>(kernel, num_types, quantized);
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef FORCE_KERNELS_HPP
+#define FORCE_KERNELS_HPP
+
+#include <bit>
+#include <cstdint>
+
+// One Newton step from the bit-trick estimate: within about 0.2%, and plain
+// integer and float arithmetic, so loops using it still vectorize.
+inline float fast_inv_sqrt(float x) {
+    float xhalf = 0.5f * x;
+    int i = std::bit_cast<int>(x);
+    i = 0x5f3759df - (i >> 1);
+    x = std::bit_cast<float>(i);
+    x = x * (1.5f - xhalf * x * x);
+    return x;
+}
+
+enum class ForceKernel { Auto, Scalar, AVX2, AVX512 };
+
+// Force between two particles at distance d < r with matrix coefficient a,
+// along the direction to the other particle, with x = d / r:
+//   Constant:   a
+//   Classic:    x / beta - 1 for x < beta, else a * (1 - |2x - 1 - beta| / (1 - beta))
+//   SmoothStep: a * (1 - smoothstep(x)), fading to zero at the radius
+enum class ForceLaw : uint32_t { Constant, Classic, SmoothStep };
+
+// Per-pass constants of the force law; see force_law_params(). The radius
+// belongs to the sensing particle's type and is passed separately.
+struct ForceLawParams {
+    float beta;
+    float inv_beta;
+    float inv_one_minus_beta;
+};
+
+// Sorted arrays handed to the cell kernels must stay readable this many
+// elements past the last particle; the vector loops read whole blocks and
+// mask off the lanes that fall outside a cell.
+constexpr int FORCE_KERNEL_PADDING = 16;
+
+struct CellForceArgs {
+    // Cell-sorted particle data (slot k = k-th entry of SpatialGrid::sorted_indices()).
+    const float* x;
+    const float* y;
+    const uint8_t* type;
+    float* fx;
+    float* fy;
+
+    // Row-major coefficients, matrix[ti * matrix_stride + tj] acting on type ti
+    // from type tj. When matrix_q is set, matrix holds its dequantized values
+    // (q * matrix_scale) and the gathering kernels read the int8 copy, which
+    // must stay readable 3 bytes past its end.
+    const float* matrix;
+    const int8_t* matrix_q;
+    float matrix_scale;
+    int matrix_stride;
+    int num_types;
+
+    // Per type: the squared radius it senses others within, the reciprocal
+    // of that radius, and 1 / mass, which scales the force it feels.
+    const float* radius_sq;
+    const float* inv_radius;
+    const float* inv_mass;
+
+    float world_width;
+    float world_height;
+    // Largest radius_sq; pairs beyond it are skipped before the per-type test.
+    float max_distance_sq;
+    ForceLawParams law;
+};
+
+ForceLawParams force_law_params(float beta);
+const char* force_law_name(ForceLaw law);
+
+// Picks the widest kernel the CPU supports for Auto, and downgrades requests
+// the CPU (or compiler) cannot run to the next one that it can.
+ForceKernel resolve_force_kernel(ForceKernel requested);
+const char* force_kernel_name(ForceKernel kernel);
+// Candidates a kernel evaluates per step of its inner loop.
+int force_kernel_lanes(ForceKernel kernel);
+
+// Writes the total force on each sorted slot in [begin, end) from all
+// particles in the candidate slot ranges [range_begin[r], range_end[r]).
+using CellForceFn = void (*)(const CellForceArgs& args, uint32_t begin, uint32_t end,
+                             const uint32_t* range_begin, const uint32_t* range_end, int num_ranges);
+
+// Newton's-third-law variant: evaluates each pair between [begin, end) and
+// [other_begin, other_end) once and adds to both particles' entries in
+// args.fx/fy, with matrix[ti][tj] acting on i and matrix[tj][ti] on j. When
+// other_begin == begin the ranges are the same cell and only j > i is visited.
+using PairForceFn = void (*)(const CellForceArgs& args, uint32_t begin, uint32_t end,
+                             uint32_t other_begin, uint32_t other_end);
+
+// The kernels are instantiated per force law and, for the vector ones, per
+// bound on the type count that decides how a matrix row is held: in up to
+// four registers (32 types for AVX2, 64 for AVX-512), or gathered from
+// memory, from the int8 table when there is one. These pick the
+// instantiation for a resolved kernel, so a pass pays for the choice once
+// instead of per pair.
+CellForceFn select_cell_forces(ForceKernel kernel, ForceLaw law, int num_types, bool quantized);
+PairForceFn select_pair_forces(ForceLaw law);
+
+// Verlet neighbor list building: writes to out the slots j in the candidate
+// ranges, other than i, within sqrt(cutoff_sq) of slot i, and returns how
+// many there are. out must hold the total length of the ranges plus
+// FORCE_KERNEL_PADDING entries, as the vector kernels store whole blocks.
+using NeighborScanFn = uint32_t (*)(const CellForceArgs& args, uint32_t i, const uint32_t* range_begin,
+                                    const uint32_t* range_end, int num_ranges, float cutoff_sq, uint32_t* out);
+
+// Verlet lists in CSR form: the neighbors of particle p are
+// neighbors[start[p] .. start[p + 1]), with their types alongside in
+// neighbor_types, which must stay readable FORCE_KERNEL_PADDING entries past
+// its end. x and y are the current positions by particle and must stay
+// readable LIST_POSITION_PADDING entries past the end: rows come from cell
+// ranges of slots sorted by cell, so a block of entries usually lies within
+// a few dozen slots, and the vector kernels load that window and permute
+// instead of gathering.
+constexpr int LIST_POSITION_PADDING = 64;
+
+struct NeighborListArgs {
+    const uint32_t* start;
+    const uint32_t* neighbors;
+    const uint8_t* neighbor_types;
+    const float* x;
+    const float* y;
+};
+
+// Verlet force pass: for each k in [begin, end), writes into fx[k]/fy[k] the
+// force on particle p = order[k] (or k when order is null) from its list.
+// args.type is indexed by particle here, and args.x/y are unused.
+using ListForceFn = void (*)(const CellForceArgs& args, const NeighborListArgs& list, const uint32_t* order,
+                             uint32_t begin, uint32_t end);
+
+NeighborScanFn select_neighbor_scan(ForceKernel kernel);
+ListForceFn select_list_forces(ForceKernel kernel, ForceLaw law, int num_types, bool quantized);
+
+#endif
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <omp.h>
+#include "config.hpp"
+#include "particle_system.hpp"
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) {
+            print_config_usage(argv[0]);
+            return 0;
+        }
+    }
+
+    SimConfig config;
+    std::string error;
+    if (!parse_config_args(argc, argv, config, error)) {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        print_config_usage(argv[0]);
+        return 1;
+    }
+
+    Profiler profiler;
+    profiler.enabled = config.profile || !config.trace_path.empty();
+    double phase_ms[PROFILE_PHASE_COUNT] = {};
+
+    ParticleSystem particles;
+    particles.profiler = &profiler;
+    particles.seed = config.seed;
+    particles.init(config.num_particles, config.num_types, config.world_width, config.world_height);
+    apply_config(config, particles);
+
+    if (!config.snapshot_in.empty() && !load_snapshot(particles, config.snapshot_in, error)) {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+
+    TrajectoryWriter trajectory;
+    if (!config.trajectory_path.empty()) {
+        if (!trajectory.open(config.trajectory_path, particles, config.trajectory_encoding,
+                             static_cast<uint32_t>(config.keyframe_every), error)) {
+            std::fprintf(stderr, "error: %s\n", error.c_str());
+            return 1;
+        }
+        trajectory.write_frame(particles);
+    }
+
+    SplatRenderer splat;
+    const std::vector<Rgb8> palette = type_palette(MAX_PARTICLE_TYPES);
+    int frames_written = 0;
+    double render_ms = 0.0;
+    // Renders the current state into frames_dir/frame_<step>.ppm.
+    auto write_frame = [&](int step) {
+        const int64_t start_ns = profiler_now_ns();
+        splat.render(particles.x.data(), particles.y.data(), particles.type.data(), particles.count,
+                     particles.num_types, config.frame_width / particles.world_width(),
+                     config.frame_height / particles.world_height(), palette.data());
+        render_ms += (profiler_now_ns() - start_ns) * 1e-6;
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%06d.ppm", step);
+        const std::string path = (std::filesystem::path(config.frames_dir) / name).string();
+        if (!splat.write_ppm(path)) {
+            std::fprintf(stderr, "error: cannot write %s\n", path.c_str());
+            return false;
+        }
+        ++frames_written;
+        return true;
+    };
+    if (!config.frames_dir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(config.frames_dir, ec);
+        splat.resize(config.frame_width, config.frame_height);
+        splat.particle_size = config.particle_size;
+        splat.trail_decay = config.frame_trail;
+        splat.glow = config.frame_glow;
+        splat.glow_radius = static_cast<int>(config.particle_size * 3.0f);
+        if (!write_frame(0)) return 1;
+    }
+
+    StructureAnalytics analytics;
+    analytics.every = config.analytics_every;
+    analytics.cluster_distance = config.cluster_distance;
+    analytics.min_cluster_size = config.min_cluster_size;
+    analytics.rdf_bins = config.rdf_bins;
+    if (analytics.every > 0) {
+        particles.analytics = &analytics;
+    }
+    FILE* analytics_out = nullptr;
+    if (!config.analytics_path.empty()) {
+        analytics_out = std::fopen(config.analytics_path.c_str(), "w");
+        if (!analytics_out) {
+            std::fprintf(stderr, "error: cannot write %s\n", config.analytics_path.c_str());
+            return 1;
+        }
+    }
+    uint64_t analytics_written = 0;
+    double analytics_ms = 0.0;
+
+    std::printf("particles: %zu, types: %d, steps: %d, seed: %llu, threads: %d\n",
+                particles.count, particles.num_types, config.steps,
+                static_cast<unsigned long long>(config.seed), omp_get_max_threads());
+
+    if (!config.trace_path.empty()) {
+        profiler.start_trace();
+    }
+
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    auto last_report = start;
+
+    for (int step = 1; step <= config.steps; ++step) {
+        profiler.begin_frame();
+        particles.update(config.dt);
+        profiler.end_frame();
+
+        if (trajectory.is_open() && step % config.trajectory_every == 0 && !trajectory.write_frame(particles)) {
+            std::fprintf(stderr, "error: cannot write %s\n", config.trajectory_path.c_str());
+            return 1;
+        }
+
+        if (!config.frames_dir.empty() && step % config.frame_every == 0 && !write_frame(step)) {
+            return 1;
+        }
+
+        if (analytics.samples() != analytics_written) {
+            analytics_written = analytics.samples();
+            analytics_ms += analytics.latest().compute_ms;
+            if (analytics_out) write_structure_json(analytics_out, analytics.latest());
+        }
+
+        if (profiler.enabled) {
+            for (int p = 0; p < PROFILE_PHASE_COUNT; ++p) {
+                phase_ms[p] += profiler.last_ms(static_cast<ProfilePhase>(p));
+            }
+        }
+
+        if (config.report_every > 0 && step % config.report_every == 0) {
+            const auto now = clock::now();
+            double interval = std::chrono::duration<double>(now - last_report).count();
+            std::printf("step %d: %.1f steps/sec\n", step, config.report_every / interval);
+            last_report = now;
+        }
+    }
+
+    const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    const double steps_per_sec = elapsed > 0.0 ? config.steps / elapsed : 0.0;
+
+    std::printf("kernel: %s, mode: %s\n", force_kernel_name(particles.active_force_kernel()),
+                force_mode_name(particles.active_force_mode()));
+    std::printf("elapsed: %.3f s, steps/sec: %.2f, particle-steps/sec: %.3e\n",
+                elapsed, steps_per_sec, steps_per_sec * particles.count);
+    if (config.emit > 0) {
+        std::printf("particles at end: %zu\n", particles.count);
+    }
+
+    const uint64_t hash = particles.state_hash();
+    std::printf("state hash: %016llx\n", static_cast<unsigned long long>(hash));
+
+    if (profiler.enabled && config.steps > 0) {
+        for (ProfilePhase phase : {ProfilePhase::Grid, ProfilePhase::Forces, ProfilePhase::Integrate}) {
+            std::printf("  %-10s %8.3f ms/step\n", profile_phase_name(phase),
+                        phase_ms[static_cast<int>(phase)] / config.steps);
+        }
+        const GridStats& grid = particles.grid_stats();
+        std::printf("  grid: %llu incremental updates, %llu rebuilds, %.2f%% mean churn\n",
+                    static_cast<unsigned long long>(grid.incremental), static_cast<unsigned long long>(grid.rebuilt),
+                    100.0 * grid.mean_churn());
+        const NeighborListStats& lists = particles.neighbor_list_stats();
+        if (lists.builds > 0) {
+            std::printf("  neighbor lists: %llu builds, %.1f steps per build, %llu gather fallback steps, "
+                        "%.1f entries per particle (grid stencil %.1f)\n",
+                        static_cast<unsigned long long>(lists.builds), lists.steps_per_build(),
+                        static_cast<unsigned long long>(lists.fallback_steps),
+                        particles.count > 0 ? static_cast<double>(lists.entries) / particles.count : 0.0,
+                        lists.stencil_candidates);
+        }
+        std::printf("  force pass load imbalance (last step): %.2fx\n", profiler.load_imbalance());
+        std::printf("  neighbor candidates per particle (last step): %.1f mean, %u max\n",
+                    profiler.mean_neighbor_candidates(), profiler.max_neighbor_candidates());
+    }
+
+    if (trajectory.is_open()) {
+        std::printf("trajectory: %llu frames (%s), %.2f MB written to %s\n",
+                    static_cast<unsigned long long>(trajectory.frames_written()),
+                    trajectory_encoding_name(config.trajectory_encoding),
+                    trajectory.bytes_written() / (1024.0 * 1024.0), config.trajectory_path.c_str());
+        trajectory.close();
+    }
+
+    if (frames_written > 0) {
+        std::printf("frames: %d written to %s, %.2f ms per frame to render\n", frames_written,
+                    config.frames_dir.c_str(), render_ms / frames_written);
+    }
+
+    if (analytics_written > 0) {
+        const StructureStats& stats = analytics.latest();
+        std::printf("analytics: %llu samples, %.2f ms per sample; at step %llu: %zu clusters (largest %zu, "
+                    "%.1f%% of particles), kinetic energy %.4g, g(r) peak %.2f\n",
+                    static_cast<unsigned long long>(analytics_written), analytics_ms / analytics_written,
+                    static_cast<unsigned long long>(stats.step), stats.clusters, stats.largest_cluster,
+                    100.0 * stats.clustered_fraction, stats.kinetic_energy,
+                    stats.rdf.empty() ? 0.0f : *std::max_element(stats.rdf.begin(), stats.rdf.end()));
+    }
+    if (analytics_out) {
+        std::fclose(analytics_out);
+        std::printf("analytics written to %s\n", config.analytics_path.c_str());
+    }
+
+    if (!config.snapshot_out.empty()) {
+        if (!save_snapshot(particles, config.snapshot_out, error)) {
+            std::fprintf(stderr, "error: %s\n", error.c_str());
+            return 1;
+        }
+        std::printf("snapshot written to %s\n", config.snapshot_out.c_str());
+    }
+
+    if (!config.trace_path.empty()) {
+        profiler.stop_trace();
+        if (!profiler.write_chrome_trace(config.trace_path)) {
+            std::fprintf(stderr, "error: cannot write %s\n", config.trace_path.c_str());
+            return 1;
+        }
+        std::printf("trace written to %s\n", config.trace_path.c_str());
+    }
+
+    if (!config.expect_hash.empty() && std::strtoull(config.expect_hash.c_str(), nullptr, 16) != hash) {
+        std::fprintf(stderr, "error: state hash %016llx does not match expected %s\n",
+                     static_cast<unsigned long long>(hash), config.expect_hash.c_str());
+        return 2;
+    }
+    return 0;
+}
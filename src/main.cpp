@@ -1,55 +1,45 @@
 #include <cstdio>
 #include <SDL3/SDL.h>
 #include "particle_system.hpp"
+#include "profiler.hpp"
+#include "snapshot.hpp"
+#include "renderer.hpp"
+#include "simulation_thread.hpp"
 #include "imgui.h"
 #include "imgui_impl_sdl3.h"
 #include "imgui_impl_sdlrenderer3.h"
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <span>
+#include <vector>
+#include <cfloat>
 
 const int WINDOW_WIDTH = 1600;
 const int WINDOW_HEIGHT = 900;
 
-SDL_Texture* create_circle_texture(SDL_Renderer* renderer, int radius) {
-    int diameter = radius * 2 + 2;
-    SDL_Surface* surface = SDL_CreateSurface(diameter, diameter, SDL_PIXELFORMAT_RGBA8888);
-
-    SDL_FillSurfaceRect(surface, nullptr, SDL_MapSurfaceRGBA(surface, 0, 0, 0, 0));
-
-    Uint32* pixels = (Uint32*)surface->pixels;
-    float center = diameter / 2.0f;
-
-    for (int y = 0; y < diameter; y++) {
-        for (int x = 0; x < diameter; x++) {
-            float dx = x - center + 0.5f;
-            float dy = y - center + 0.5f;
-            float dist = std::sqrt(dx*dx + dy*dy);
-
-            if (dist <= radius) {
-                float alpha = 1.0f;
-                if (dist > radius - 1.0f) {
-                    alpha = radius - dist;
-                }
-                Uint8 a = (Uint8)(alpha * 255);
-                pixels[y * diameter + x] = SDL_MapSurfaceRGBA(surface, 255, 255, 255, a);
-            }
-        }
+// Up to this many types the rule editor shows a named slider per pair;
+// beyond it, a heatmap of the matrix.
+const int NAMED_TYPES = 6;
+
+int main(int argc, char** argv) {
+    // "--snapshot FILE" starts from a saved state; "--replay FILE" plays back
+    // a trajectory recorded by nucleon_headless instead of simulating.
+    const char* snapshot_path = nullptr;
+    const char* replay_path = nullptr;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--snapshot") == 0) snapshot_path = argv[++i];
+        else if (std::strcmp(argv[i], "--replay") == 0) replay_path = argv[++i];
     }
 
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-    SDL_DestroySurface(surface);
-
-    return texture;
-}
-
-int main() {
     SDL_Init(SDL_INIT_VIDEO);
 
     SDL_Window* window = SDL_CreateWindow("Nucleon", WINDOW_WIDTH, WINDOW_HEIGHT, 0);
     SDL_Renderer* renderer = SDL_CreateRenderer(window, nullptr);
-    SDL_Texture* particle_texture = create_circle_texture(renderer, 4);
-    SDL_Texture* glow_texture = create_circle_texture(renderer, 8);
-    SDL_SetTextureBlendMode(glow_texture, SDL_BLENDMODE_ADD);
+    // The display paces itself on vsync; the simulation runs on its own clock.
+    SDL_SetRenderVSync(renderer, 1);
+    auto particle_renderer = std::make_unique<ParticleRenderer>(renderer);
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -59,6 +49,8 @@ int main() {
     ImGui_ImplSDL3_InitForSDLRenderer(window, renderer);
     ImGui_ImplSDLRenderer3_Init(renderer);
 
+    Profiler profiler;
+
     ParticleSystem particles;
     particles.init(5000, 3, WINDOW_WIDTH, WINDOW_HEIGHT);
 
@@ -72,26 +64,82 @@ int main() {
     particles.set_attraction(2, 0, -0.2f);
     particles.set_attraction(2, 1, 0.1f);
 
-    std::vector<SDL_FRect> yellow_rects, red_rects, green_rects;
-    yellow_rects.reserve(particles.count / 3);
-    red_rects.reserve(particles.count / 3);
-    green_rects.reserve(particles.count / 3);
+    std::span<const float> initial_rules = particles.attraction_matrix();
+    std::vector<float> attraction_values(initial_rules.begin(), initial_rules.end());
+
+    TrajectoryReader replay;
+    const bool replaying = replay_path != nullptr;
+    std::string error;
+
+    if (snapshot_path && !replaying) {
+        if (!load_snapshot(particles, snapshot_path, error)) {
+            SDL_Log("cannot load snapshot: %s", error.c_str());
+            return 1;
+        }
+        initial_rules = particles.attraction_matrix();
+        attraction_values.assign(initial_rules.begin(), initial_rules.end());
+    }
+
+    // Replay decodes straight into this frame; otherwise frames come from the
+    // simulation thread, which owns `particles` from start() on.
+    RenderFrame replay_view;
+    SimulationThread simulation(particles);
+
+    if (replaying) {
+        if (!replay.open(replay_path, error)) {
+            SDL_Log("cannot replay trajectory: %s", error.c_str());
+            return 1;
+        }
+        const TrajectoryHeader& header = replay.header();
+        replay_view.count = header.count;
+        replay_view.num_types = static_cast<int>(header.num_types);
+        replay_view.world_width = header.world_width;
+        replay_view.world_height = header.world_height;
+        replay_view.x.resize(header.count);
+        replay_view.y.resize(header.count);
+        replay_view.type.assign(replay.types(), replay.types() + header.count);
+    } else {
+        simulation.start();
+    }
+
+    // Set when a command that replaces the rules is submitted; the sliders are
+    // refreshed from the first frame that includes it.
+    uint64_t rules_sync_command = 0;
+    uint64_t profiled_step = 0;
 
     bool running = true;
     SDL_Event event;
 
     static int config_num_particles = 5000;
     static int config_num_types = 3;
-    static bool needs_reinit = false;
-    static float attraction_values[36] = {-0.32f, -0.17f, 0.34f, -0.1f, -0.34f, 0.15f, 0.15f, -0.2f, 0.1f};
+    static float interaction_radius = 80.0f;
+    static int force_law = 0;
+    static float force_beta = 0.3f;
     static float mouse_force_strength = 5.0f;
     static float mouse_force_radius = 150.0f;
+    static int brush_tool = 0;
+    static int paint_type = 0;
+    static int spawn_rate = 20;
+    static float spawn_lifetime = 0.0f;
+    static int selected_rule = 0;
     static float simulation_speed = 1.0f;
     static float particle_size = 2.0f;
     static bool enable_glow = false;
     static bool enable_trail = false;
+    static bool enable_splat = false;
+    static bool show_profiler = false;
+    static bool show_analytics = false;
+    static int analytics_every = 10;
+    static int rdf_type_a = 0;
+    static int rdf_type_b = 0;
+    static int replay_frame = 0;
+    static int replay_speed = 1;
+    static bool replay_playing = true;
+    static bool replay_loop = true;
 
     while (running) {
+        profiler.begin_frame();
+
         while (SDL_PollEvent(&event)) {
             ImGui_ImplSDL3_ProcessEvent(&event);
             if (event.type == SDL_EVENT_QUIT) {
@@ -99,6 +147,22 @@ int main() {
             }
         }
 
+        const RenderFrame& frame = replaying ? replay_view : simulation.acquire_frame();
+
+        if (rules_sync_command != 0 && frame.last_command >= rules_sync_command) {
+            attraction_values = frame.attraction_matrix;
+            rules_sync_command = 0;
+        }
+
+        if (profiler.enabled && frame.steps > 0 && frame.step != profiled_step) {
+            for (int p = 0; p < PROFILE_PHASE_COUNT; ++p) {
+                profiler.add_ms(static_cast<ProfilePhase>(p), frame.phase_ms[p]);
+            }
+            profiled_step = frame.step;
+        }
+
+        const int64_t imgui_start_ns = profiler_now_ns();
+
         ImGui_ImplSDLRenderer3_NewFrame();
         ImGui_ImplSDL3_NewFrame();
         ImGui::NewFrame();
@@ -129,110 +193,337 @@ int main() {
         ImGui::Begin("Nucleon", nullptr, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_AlwaysAutoResize);
 
         ImGui::SeparatorText("Statistics");
-        ImGui::Text("Particles: %zu", particles.count);
-        ImGui::Text("Types: %d", particles.num_types);
+        ImGui::Text("Particles: %zu", frame.count);
+        ImGui::Text("Types: %d", frame.num_types);
         ImGui::TextColored(ImVec4(0.5f, 0.8f, 1.0f, 1.0f), "FPS: %.1f", io.Framerate);
-
-        ImGui::Spacing();
-        ImGui::SeparatorText("Configuration");
-
-        if (ImGui::CollapsingHeader("Simulation Settings")) {
-            ImGui::SliderInt("Particle Count", &config_num_particles, 1000, 10000);
-            ImGui::SliderInt("Particle Types", &config_num_types, 1, 6);
-
-            if (ImGui::Button("Apply Changes", ImVec2(360, 0))) {
-                needs_reinit = true;
-            }
+        if (!replaying) {
+            ImGui::SameLine(200);
+            ImGui::TextColored(ImVec4(0.5f, 0.8f, 1.0f, 1.0f), "Steps/s: %.1f", simulation.steps_per_second());
+        }
+        ImGui::Checkbox("Show Profiler", &show_profiler);
+        if (!replaying) {
+            ImGui::SameLine(200);
+            ImGui::Checkbox("Show Analytics", &show_analytics);
         }
 
-        if (needs_reinit) {
-            particles.reinit(config_num_particles, config_num_types);
+        if (replaying) {
+            ImGui::Spacing();
+            ImGui::SeparatorText("Replay");
+
+            const int last_frame = static_cast<int>(replay.frame_count()) - 1;
+            ImGui::Text("Frame %d / %d (step %llu, %s)", replay_frame, last_frame,
+                        static_cast<unsigned long long>(last_frame >= 0 ? replay.frame_step(replay_frame) : 0),
+                        trajectory_encoding_name(replay.header().encoding));
+            ImGui::SliderInt("Frame", &replay_frame, 0, std::max(0, last_frame));
+            ImGui::SliderInt("Frames / Tick", &replay_speed, 1, 16);
+            if (ImGui::Button(replay_playing ? "Pause" : "Play", ImVec2(175, 0))) {
+                replay_playing = !replay_playing;
+            }
+            ImGui::SameLine();
+            ImGui::Checkbox("Loop", &replay_loop);
+        } else {
+            ImGui::Spacing();
+            ImGui::SeparatorText("Configuration");
+
+            if (ImGui::CollapsingHeader("Simulation Settings")) {
+                // The count changes live; only a new type count restarts the run.
+                ImGui::SliderInt("Particle Count", &config_num_particles, 1000, 1000000, "%d",
+                                 ImGuiSliderFlags_Logarithmic);
+                if (ImGui::IsItemDeactivatedAfterEdit()) {
+                    const size_t n = config_num_particles;
+                    simulation.submit([n](ParticleSystem& ps) { ps.set_population(n); });
+                }
+                ImGui::SliderInt("Particle Types", &config_num_types, 1, MAX_PARTICLE_TYPES);
 
-            for (int i = 0; i < config_num_types; ++i) {
-                for (int j = 0; j < config_num_types; ++j) {
-                    attraction_values[i * 6 + j] = particles.attraction_matrix[i][j];
+                if (ImGui::Button("Apply Types", ImVec2(360, 0))) {
+                    const size_t n = config_num_particles;
+                    const int types = config_num_types;
+                    rules_sync_command = simulation.submit([n, types](ParticleSystem& ps) { ps.reinit(n, types); });
                 }
-            }
 
-            needs_reinit = false;
-        }
+                if (ImGui::SliderFloat("Interaction Radius", &interaction_radius, 20.0f, 200.0f)) {
+                    const float radius = interaction_radius;
+                    simulation.submit([radius](ParticleSystem& ps) { ps.interaction_radius = radius; });
+                }
+                ImGui::TextColored(ImVec4(0.6f, 0.6f, 0.6f, 1.0f), "Grid cells: radius / %d (auto)", frame.grid_reach);
 
-        ImGui::Spacing();
+                const char* law_names[] = {"Constant", "Classic", "Smooth Step"};
+                if (ImGui::Combo("Force Law", &force_law, law_names, 3)) {
+                    const ForceLaw law = static_cast<ForceLaw>(force_law);
+                    simulation.submit([law](ParticleSystem& ps) { ps.force_law = law; });
+                }
+                if (force_law == static_cast<int>(ForceLaw::Classic) &&
+                    ImGui::SliderFloat("Repulsion Zone", &force_beta, 0.05f, 0.95f)) {
+                    const float beta = force_beta;
+                    simulation.submit([beta](ParticleSystem& ps) { ps.beta = beta; });
+                }
+            }
 
-        if (ImGui::CollapsingHeader("Attraction Rules")) {
-            const char* type_names[] = {"Blue", "Red", "Purple", "Yellow", "Green", "Orange"};
+            ImGui::Spacing();
+
+            const int types = frame.num_types;
+            const bool rules_synced = attraction_values.size() == static_cast<size_t>(types) * types;
+
+            if (ImGui::CollapsingHeader("Attraction Rules") && rules_synced) {
+                if (types <= NAMED_TYPES) {
+                    const char* type_names[] = {"Blue", "Red", "Purple", "Yellow", "Green", "Orange"};
+
+                    for (int i = 0; i < types; ++i) {
+                        for (int j = 0; j < types; ++j) {
+                            char label[64];
+                            snprintf(label, sizeof(label), "%s -> %s", type_names[i], type_names[j]);
+                            if (ImGui::SliderFloat(label, &attraction_values[i * types + j], -1.0f, 1.0f)) {
+                                const float value = attraction_values[i * types + j];
+                                simulation.submit([i, j, value](ParticleSystem& ps) { ps.set_attraction(i, j, value); });
+                            }
+                        }
+                    }
+                } else {
+                    // One cell per pair, row = acting type, green attracting and
+                    // red repelling; click a cell to edit it with the slider.
+                    const float cell = std::max(1.0f, std::floor(360.0f / types));
+                    const ImVec2 origin = ImGui::GetCursorScreenPos();
+                    ImGui::InvisibleButton("##rules", ImVec2(cell * types, cell * types));
+                    if (ImGui::IsItemHovered()) {
+                        const ImVec2 mouse = io.MousePos;
+                        const int i = std::clamp(static_cast<int>((mouse.y - origin.y) / cell), 0, types - 1);
+                        const int j = std::clamp(static_cast<int>((mouse.x - origin.x) / cell), 0, types - 1);
+                        ImGui::SetTooltip("%d -> %d: %.2f", i, j, attraction_values[i * types + j]);
+                        if (ImGui::IsItemClicked()) {
+                            selected_rule = i * types + j;
+                        }
+                    }
+
+                    ImDrawList* draw = ImGui::GetWindowDrawList();
+                    for (int i = 0; i < types; ++i) {
+                        for (int j = 0; j < types; ++j) {
+                            const float value = std::clamp(attraction_values[i * types + j], -1.0f, 1.0f);
+                            const int level = static_cast<int>(std::fabs(value) * 255.0f);
+                            const ImU32 color = value >= 0.0f ? IM_COL32(0, level, 0, 255) : IM_COL32(level, 0, 0, 255);
+                            const ImVec2 corner(origin.x + j * cell, origin.y + i * cell);
+                            draw->AddRectFilled(corner, ImVec2(corner.x + cell, corner.y + cell), color);
+                        }
+                    }
+
+                    selected_rule = std::min(selected_rule, types * types - 1);
+                    const int i = selected_rule / types;
+                    const int j = selected_rule % types;
+                    const ImVec2 corner(origin.x + j * cell, origin.y + i * cell);
+                    draw->AddRect(corner, ImVec2(corner.x + cell, corner.y + cell), IM_COL32(255, 255, 255, 255));
 
-            for (int i = 0; i < particles.num_types; ++i) {
-                for (int j = 0; j < particles.num_types; ++j) {
                     char label[64];
-                    snprintf(label, sizeof(label), "%s -> %s", type_names[i], type_names[j]);
-                    ImGui::SliderFloat(label, &attraction_values[i * 6 + j], -1.0f, 1.0f);
-                    particles.set_attraction(i, j, attraction_values[i * 6 + j]);
+                    snprintf(label, sizeof(label), "Type %d -> %d", i, j);
+                    if (ImGui::SliderFloat(label, &attraction_values[selected_rule], -1.0f, 1.0f)) {
+                        const float value = attraction_values[selected_rule];
+                        simulation.submit([i, j, value](ParticleSystem& ps) { ps.set_attraction(i, j, value); });
+                    }
                 }
             }
-        }
 
-        if (ImGui::Button("Randomize Rules", ImVec2(175, 0))) {
-            particles.randomize_rules();
-            for (int i = 0; i < particles.num_types; ++i) {
-                for (int j = 0; j < particles.num_types; ++j) {
-                    attraction_values[i * 6 + j] = particles.attraction_matrix[i][j];
-                }
+            if (ImGui::Button("Randomize Rules", ImVec2(175, 0))) {
+                rules_sync_command = simulation.submit([](ParticleSystem& ps) { ps.randomize_rules(); });
             }
-        }
 
-        ImGui::SameLine();
+            ImGui::SameLine();
 
-        if (ImGui::Button("Reset Particles", ImVec2(175, 0))) {
-            particles.reset_particles();
-        }
+            if (ImGui::Button("Reset Particles", ImVec2(175, 0))) {
+                simulation.submit([](ParticleSystem& ps) { ps.reset_particles(); });
+            }
 
-        ImGui::Spacing();
-        ImGui::SeparatorText("Interaction");
+            if (ImGui::Button("Save Snapshot", ImVec2(360, 0))) {
+                simulation.submit([](ParticleSystem& ps) {
+                    std::string save_error;
+                    if (!save_snapshot(ps, "nucleon_snapshot.bin", save_error)) {
+                        SDL_Log("%s", save_error.c_str());
+                    }
+                });
+            }
 
-        ImGui::SliderFloat("Mouse Force", &mouse_force_strength, 0.0f, 25.0f);
-        ImGui::SliderFloat("Mouse Radius", &mouse_force_radius, 10.0f, 1000.0f);
-        ImGui::TextColored(ImVec4(0.6f, 0.6f, 0.6f, 1.0f), "Left Click = Repel | Right Click = Attract");
+            ImGui::Spacing();
+            ImGui::SeparatorText("Interaction");
+
+            ImGui::RadioButton("Force", &brush_tool, 0);
+            ImGui::SameLine();
+            ImGui::RadioButton("Paint Type", &brush_tool, 1);
+            ImGui::SameLine();
+            ImGui::RadioButton("Spawn", &brush_tool, 2);
+            ImGui::SameLine();
+            ImGui::RadioButton("Erase", &brush_tool, 3);
+            ImGui::SliderFloat("Mouse Radius", &mouse_force_radius, 10.0f, 1000.0f);
+            if (brush_tool == 0) {
+                ImGui::SliderFloat("Mouse Force", &mouse_force_strength, 0.0f, 25.0f);
+                ImGui::TextColored(ImVec4(0.6f, 0.6f, 0.6f, 1.0f), "Left Click = Repel | Right Click = Attract");
+            } else if (brush_tool == 3) {
+                ImGui::TextColored(ImVec4(0.6f, 0.6f, 0.6f, 1.0f), "Click = Erase");
+            } else {
+                paint_type = std::min(paint_type, frame.num_types - 1);
+                ImGui::SliderInt(brush_tool == 1 ? "Paint With" : "Spawn Type", &paint_type, 0, frame.num_types - 1);
+                if (brush_tool == 2) {
+                    ImGui::SliderInt("Spawn Rate", &spawn_rate, 1, 500);
+                    const char* lifetime_format = spawn_lifetime > 0.0f ? "%.1f" : "forever";
+                    if (ImGui::SliderFloat("Lifetime (s)", &spawn_lifetime, 0.0f, 60.0f, lifetime_format)) {
+                        const float life = spawn_lifetime > 0.0f ? spawn_lifetime : INFINITY;
+                        simulation.submit([life](ParticleSystem& ps) { ps.spawn_lifetime = life; });
+                    }
+                }
+                ImGui::TextColored(ImVec4(0.6f, 0.6f, 0.6f, 1.0f), brush_tool == 1 ? "Click = Paint" : "Click = Spawn");
+            }
+        }
 
         ImGui::Spacing();
         ImGui::SeparatorText("Visual");
 
-        ImGui::SliderFloat("Simulation Speed", &simulation_speed, 0.0f, 10.0f);
+        if (ImGui::SliderFloat("Simulation Speed", &simulation_speed, 0.0f, 10.0f)) {
+            simulation.speed.store(simulation_speed > 0.01f ? simulation_speed : 0.0f);
+        }
         ImGui::SliderFloat("Particle Size", &particle_size, 1.0f, 5.0f);
 
         ImGui::Spacing();
         ImGui::Checkbox("Glow Effect", &enable_glow);
         ImGui::SameLine(200);
         ImGui::Checkbox("Trail Effect", &enable_trail);
+        // Splats on the CPU into one texture: the cost follows the window
+        // size instead of the particle count.
+        ImGui::Checkbox("CPU Splat Renderer", &enable_splat);
 
-        static float last_particle_size = 2.0f;
-        if (particle_size != last_particle_size) {
-            SDL_DestroyTexture(particle_texture);
-            SDL_DestroyTexture(glow_texture);
-            particle_texture = create_circle_texture(renderer, (int)particle_size);
-            glow_texture = create_circle_texture(renderer, (int)(particle_size * 2));
-            SDL_SetTextureBlendMode(glow_texture, SDL_BLENDMODE_ADD);
-            last_particle_size = particle_size;
-        }
+        particle_renderer->set_particle_size(particle_size);
 
         ImGui::End();
 
-        Uint32 mouse_state = SDL_GetMouseState(nullptr, nullptr);
-        float mouse_x, mouse_y;
-        SDL_GetMouseState(&mouse_x, &mouse_y);
+        if (show_profiler) {
+            ImGui::SetNextWindowPos(ImVec2(WINDOW_WIDTH - 400, 10), ImGuiCond_FirstUseEver);
+            ImGui::SetNextWindowSize(ImVec2(390, 0), ImGuiCond_FirstUseEver);
+            ImGui::Begin("Profiler", &show_profiler, ImGuiWindowFlags_AlwaysAutoResize);
+
+            const ProfilePhase phases[] = {
+                ProfilePhase::Grid, ProfilePhase::Forces, ProfilePhase::Integrate,
+                ProfilePhase::Mouse, ProfilePhase::Render, ProfilePhase::ImGui
+            };
+
+            ImGui::SeparatorText("Frame Phases (ms)");
+            for (ProfilePhase phase : phases) {
+                char overlay[64];
+                snprintf(overlay, sizeof(overlay), "%.2f ms (avg %.2f)", profiler.last_ms(phase), profiler.average_ms(phase));
+                ImGui::PlotLines(profile_phase_name(phase), profiler.history(phase), Profiler::HISTORY,
+                                 profiler.history_offset(), overlay, 0.0f, FLT_MAX, ImVec2(280, 36));
+            }
+
+            ImGui::SeparatorText("Force Pass");
+            const std::vector<float>& thread_ms = frame.thread_ms;
+            ImGui::Text("Load imbalance: %.2fx (max / mean over %zu threads)", frame.load_imbalance, thread_ms.size());
+            ImGui::PlotHistogram("Thread ms", thread_ms.data(), static_cast<int>(thread_ms.size()),
+                                 0, nullptr, 0.0f, FLT_MAX, ImVec2(280, 50));
+            ImGui::Text("Neighbor candidates: %.1f mean, %u max per particle",
+                        frame.mean_neighbor_candidates, frame.max_neighbor_candidates);
+            ImGui::Text("Steps in last frame: %d", frame.steps);
+            ImGui::Text("Grid churn: %.2f%% of particles changed cells (%s)", 100.0f * frame.grid_churn,
+                        frame.grid_incremental ? "incremental" : "rebuilt");
+
+            ImGui::SeparatorText("Trace");
+            if (!replaying && ImGui::Button("Capture 120 Steps", ImVec2(360, 0))) {
+                simulation.capture_trace(120, "nucleon_trace.json");
+            }
 
-        if (mouse_state & SDL_BUTTON_LMASK) {
-            particles.apply_mouse_force(mouse_x, mouse_y, -mouse_force_strength, mouse_force_radius);
+            ImGui::End();
         }
-        if (mouse_state & SDL_BUTTON_RMASK) {
-            particles.apply_mouse_force(mouse_x, mouse_y, mouse_force_strength, mouse_force_radius);
+        profiler.enabled = show_profiler;
+        simulation.set_profiling(show_profiler);
+
+        if (show_analytics && !replaying) {
+            ImGui::SetNextWindowPos(ImVec2(WINDOW_WIDTH - 400, 420), ImGuiCond_FirstUseEver);
+            ImGui::SetNextWindowSize(ImVec2(390, 0), ImGuiCond_FirstUseEver);
+            ImGui::Begin("Analytics", &show_analytics, ImGuiWindowFlags_AlwaysAutoResize);
+
+            ImGui::SliderInt("Every N Steps", &analytics_every, 1, 120);
+            const StructureStats& stats = frame.structure;
+            if (frame.structure_samples == 0) {
+                ImGui::Text("Waiting for the first sample...");
+            } else {
+                ImGui::Text("Step %llu, %.2f ms per sample", static_cast<unsigned long long>(stats.step),
+                            stats.compute_ms);
+
+                ImGui::SeparatorText("Clusters");
+                ImGui::Text("%zu clusters, largest %zu, mean %.1f", stats.clusters, stats.largest_cluster,
+                            stats.mean_cluster_size);
+                ImGui::Text("Clustered: %.1f%% of particles", 100.0 * stats.clustered_fraction);
+                std::vector<float> sizes(stats.cluster_size_histogram.begin(), stats.cluster_size_histogram.end());
+                while (sizes.size() > 1 && sizes.back() == 0.0f) sizes.pop_back();
+                ImGui::PlotHistogram("Sizes (log2)", sizes.data(), static_cast<int>(sizes.size()),
+                                     0, nullptr, 0.0f, FLT_MAX, ImVec2(280, 50));
+
+                ImGui::SeparatorText("Energy");
+                ImGui::Text("Kinetic: %.4g, mean speed %.2f", stats.kinetic_energy, stats.mean_speed);
+
+                ImGui::SeparatorText("Radial Distribution");
+                char overlay[64];
+                snprintf(overlay, sizeof(overlay), "out to %.0f", stats.rdf_range);
+                ImGui::PlotLines("g(r)", stats.rdf.data(), stats.rdf_bins, 0, overlay, 0.0f, FLT_MAX,
+                                 ImVec2(280, 60));
+                if (stats.rdf_types > 0) {
+                    const int last_type = stats.rdf_types - 1;
+                    ImGui::SliderInt("Type A", &rdf_type_a, 0, last_type);
+                    ImGui::SliderInt("Type B", &rdf_type_b, 0, last_type);
+                    rdf_type_a = std::min(rdf_type_a, last_type);
+                    rdf_type_b = std::min(rdf_type_b, last_type);
+                    const int pair = rdf_pair_index(rdf_type_a, rdf_type_b, stats.rdf_types);
+                    ImGui::PlotLines("g_ab(r)", stats.type_rdf.data() + static_cast<size_t>(pair) * stats.rdf_bins,
+                                     stats.rdf_bins, 0, nullptr, 0.0f, FLT_MAX, ImVec2(280, 60));
+                }
+            }
+
+            ImGui::End();
+        }
+        simulation.set_analytics_every(show_analytics && !replaying ? analytics_every : 0);
+
+        if (profiler.enabled) {
+            profiler.record(ProfilePhase::ImGui, imgui_start_ns, profiler_now_ns());
         }
 
-        if (simulation_speed > 0.01f) {
-            particles.update(0.016f * simulation_speed);
+        Uint32 mouse_state = SDL_GetMouseState(nullptr, nullptr);
+        float mouse_x, mouse_y;
+        SDL_GetMouseState(&mouse_x, &mouse_y);
+        mouse_x *= frame.world_width / WINDOW_WIDTH;
+        mouse_y *= frame.world_height / WINDOW_HEIGHT;
+
+        if (replaying) {
+            const int frames = static_cast<int>(replay.frame_count());
+            if (replay_playing && frames > 0) {
+                replay_frame += replay_speed;
+                if (replay_frame >= frames) {
+                    replay_frame = replay_loop ? 0 : frames - 1;
+                    replay_playing = replay_loop;
+                }
+            }
+            replay_frame = std::clamp(replay_frame, 0, std::max(0, frames - 1));
+            if (frames > 0) {
+                replay.read_frame(replay_frame, replay_view.x.data(), replay_view.y.data());
+            }
+        } else if (mouse_state & (SDL_BUTTON_LMASK | SDL_BUTTON_RMASK)) {
+            Brush brush;
+            brush.x = mouse_x;
+            brush.y = mouse_y;
+            brush.radius = mouse_force_radius;
+            if (brush_tool == 0) {
+                brush.tool = BrushTool::Force;
+                brush.strength = (mouse_state & SDL_BUTTON_LMASK) ? -mouse_force_strength : mouse_force_strength;
+            } else if (brush_tool == 1) {
+                brush.tool = BrushTool::Paint;
+                brush.paint_type = paint_type;
+            } else if (brush_tool == 2) {
+                brush.tool = BrushTool::Spawn;
+                brush.paint_type = paint_type;
+                brush.spawn_rate = spawn_rate;
+            } else {
+                brush.tool = BrushTool::Erase;
+            }
+            simulation.set_brush(brush);
+        } else {
+            simulation.clear_brush();
         }
 
-        if (enable_trail) {
+        const int64_t render_start_ns = profiler_now_ns();
+
+        if (enable_trail && !enable_splat) {
             SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
             SDL_SetRenderDrawColor(renderer, 0, 0, 0, 10);
             SDL_FRect screen = {0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
@@ -242,58 +533,44 @@ int main() {
             SDL_RenderClear(renderer);
         }
 
-        std::vector<std::vector<SDL_FRect>> color_rects(particles.num_types);
-        for (auto& vec : color_rects) {
-            vec.reserve(particles.count / particles.num_types);
-        }
-
-        for (size_t i = 0; i < particles.count; ++i) {
-            SDL_FRect rect = {particles.x[i], particles.y[i], particle_size, particle_size};
-            color_rects[particles.type[i]].push_back(rect);
-        }
-
-        SDL_Color colors[] = {
-            {0, 0, 255, 255},
-            {255, 0, 0, 255},
-            {255, 0, 255, 255},
-            {255, 255, 0, 255},
-            {0, 255, 0, 255},
-            {255, 165, 0, 255}
-        };
-
-        for (int t = 0; t < particles.num_types; ++t) {
-            if (enable_glow) {
-                SDL_SetTextureColorMod(glow_texture, colors[t].r, colors[t].g, colors[t].b);
-                SDL_SetTextureAlphaMod(glow_texture, 60);
-
-                for (const auto& rect : color_rects[t]) {
-                    SDL_FRect dest = {rect.x - particle_size * 2, rect.y - particle_size * 2, particle_size * 4, particle_size * 4};
-                    SDL_RenderTexture(renderer, glow_texture, nullptr, &dest);
-                }
-            }
+        // Snapshots and trajectories may come from a world of another size.
+        const float view_scale_x = WINDOW_WIDTH / frame.world_width;
+        const float view_scale_y = WINDOW_HEIGHT / frame.world_height;
 
-            SDL_SetTextureColorMod(particle_texture, colors[t].r, colors[t].g, colors[t].b);
-            SDL_SetTextureAlphaMod(particle_texture, 255);
+        static const std::vector<SDL_Color> colors = make_type_palette(MAX_PARTICLE_TYPES);
 
-            for (const auto& rect : color_rects[t]) {
-                SDL_FRect dest = {rect.x - particle_size, rect.y - particle_size, particle_size * 2, particle_size * 2};
-                SDL_RenderTexture(renderer, particle_texture, nullptr, &dest);
-            }
+        if (enable_splat) {
+            particle_renderer->draw_splat(frame, colors.data(), view_scale_x, view_scale_y,
+                                          WINDOW_WIDTH, WINDOW_HEIGHT, enable_glow, enable_trail);
+        } else {
+            particle_renderer->draw(frame, colors.data(), view_scale_x, view_scale_y, enable_glow);
         }
 
+        if (profiler.enabled) {
+            profiler.record(ProfilePhase::Render, render_start_ns, profiler_now_ns());
+        }
 
         // Render ImGui
+        const int64_t imgui_render_start_ns = profiler_now_ns();
         ImGui::Render();
         ImGui_ImplSDLRenderer3_RenderDrawData(ImGui::GetDrawData(), renderer);
+        if (profiler.enabled) {
+            profiler.record(ProfilePhase::ImGui, imgui_render_start_ns, profiler_now_ns());
+        }
+
+        profiler.end_frame();
 
         SDL_RenderPresent(renderer);
-        SDL_Delay(16);
     }
 
+    simulation.stop();
+
     ImGui_ImplSDLRenderer3_Shutdown();
     ImGui_ImplSDL3_Shutdown();
     ImGui::DestroyContext();
 
+    particle_renderer.reset();
+
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -1,26 +1,49 @@
 #include "particle_system.hpp"
+#include "counter_rng.hpp"
 #include <random>
 #include <cmath>
+#include <algorithm>
+#include <bit>
+#include <omp.h>
 
-static const float WORLD_WIDTH = 1600.0f;
-static const float WORLD_HEIGHT = 900.0f;
+// Tiles the half-stencil pass aims to cut the grid into, so that each of
+// its six colours still has dozens for the threads to share.
+constexpr int HALF_STENCIL_TILES = 384;
 
-inline float wrap_distance(float delta, float world_size) {
-    if (delta > world_size * 0.5f) {
-        return delta - world_size;
-    } else if (delta < -world_size * 0.5f) {
-        return delta + world_size;
+// Counter RNG streams. Draws are indexed by particle id (times the number of
+// values drawn per particle), so they do not depend on slot order or threads.
+enum : uint64_t {
+    STREAM_INIT_POSITION = 0,
+    STREAM_INIT_TYPE = 1,
+    STREAM_RULES = 2,
+    STREAM_RESET = 3,
+    STREAM_SPAWN = 4,
+    STREAM_POPULATION = 5,
+};
+
+// Steps between re-picking the grid reach when cell_size is automatic.
+constexpr size_t GRID_TUNE_INTERVAL = 64;
+// Particles per scheduling unit of the Verlet force pass.
+constexpr uint32_t LIST_BLOCK = 256;
+// Steps the Verlet mode runs the gather pass after lists that were stale by
+// the step after their build.
+constexpr int LIST_RETRY_INTERVAL = 16;
+
+const char* force_mode_name(ForceMode mode) {
+    switch (mode) {
+        case ForceMode::Gather: return "gather";
+        case ForceMode::HalfStencil: return "half";
+        case ForceMode::Verlet: return "verlet";
     }
-    return delta;
+    return "unknown";
 }
 
-inline float fast_inv_sqrt(float x) {
-    float xhalf = 0.5f * x;
-    int i = *(int*)&x;
-    i = 0x5f3759df - (i >> 1);
-    x = *(float*)&i;
-    x = x * (1.5f - xhalf * x * x);
-    return x;
+// seed == 0 keeps the old behavior of a fresh std::random_device draw; any
+// other seed is used as is.
+static uint64_t resolve_seed(uint64_t seed) {
+    if (seed != 0) return seed;
+    std::random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) | rd();
 }
 
 void ParticleSystem::init(size_t num_particles, int n_types, float world_width, float world_height) {
@@ -34,107 +57,966 @@ void ParticleSystem::init(size_t num_particles, int n_types, float world_width,
     vx.resize(count);
     vy.resize(count);
     type.resize(count);
+    lifetime.assign(count, INFINITY);
+    id.resize(count);
+    slot_of_id.resize(count);
+    free_ids.clear();
+    expiring_ = false;
+    grid_stats_ = {};
+    step_count = 0;
 
-    grid = new SpatialGrid(world_width, world_height, 80.0f);
+    grid_reach_ = 1;
+    next_cell_valid_ = false;
+    lists_valid_ = false;
+    list_uses_ = 0;
+    list_backoff_ = 0;
+    list_stats_ = {};
+    configure_grid();
 
-    for (int i = 0; i < 10; ++i) {
-        for (int j = 0; j < 10; ++j) {
-            attraction_matrix[i][j] = 0.0f;
-        }
-    }
+    attraction_.assign(static_cast<size_t>(num_types) * num_types, 0.0f);
+    ++rules_version_;
+    type_radius.assign(num_types, 1.0f);
+    type_mass.assign(num_types, 1.0f);
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<float> pos_x(0.0f, world_width);
-    std::uniform_real_distribution<float> pos_y(0.0f, world_height);
-    std::uniform_int_distribution<int> type_dist(0, num_types - 1);
-
-    for (size_t i = 0; i < count; ++i) {
-        x[i] = pos_x(gen);
-        y[i] = pos_y(gen);
+    const uint64_t s = resolve_seed(seed);
+    const int n = static_cast<int>(count);
+
+#pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        x[i] = counter_uniform(s, STREAM_INIT_POSITION, 2 * static_cast<uint64_t>(i), 0.0f, world_width);
+        y[i] = counter_uniform(s, STREAM_INIT_POSITION, 2 * static_cast<uint64_t>(i) + 1, 0.0f, world_height);
         vx[i] = 0.0f;
         vy[i] = 0.0f;
-        type[i] = type_dist(gen);
+        type[i] = static_cast<uint8_t>(counter_below(s, STREAM_INIT_TYPE, i, num_types));
+        id[i] = static_cast<uint32_t>(i);
+        slot_of_id[i] = static_cast<uint32_t>(i);
     }
 }
 
 void ParticleSystem::set_attraction(int type1, int type2, float value) {
-    attraction_matrix[type1][type2] = value;
+    attraction_[type1 * num_types + type2] = value;
+    ++rules_version_;
+}
+
+// Recreates the grid only when the world, radius, cell size or reach changed.
+void ParticleSystem::configure_grid() {
+    const float radius = grid_radius();
+    int reach = grid_reach_;
+    float cell = radius / reach;
+    if (cell_size > 0.0f) {
+        cell = std::max(cell_size, radius / MAX_GRID_REACH);
+        reach = std::clamp(static_cast<int>(std::ceil(radius / cell)), 1, MAX_GRID_REACH);
+        grid_reach_ = reach;
+    }
+
+    if (grid && grid->cell_size() == cell && grid->reach() == reach && grid->width() == world_width_ &&
+        grid->height() == world_height_) {
+        return;
+    }
+
+    delete grid;
+    grid = new SpatialGrid(world_width_, world_height_, cell, reach);
+    next_cell_valid_ = false;
+    lists_valid_ = false;
+}
+
+bool ParticleSystem::use_half_stencil() const {
+    return force_mode == ForceMode::HalfStencil && grid->supports_half_stencil();
+}
+
+bool ParticleSystem::use_neighbor_lists() const {
+    return force_mode == ForceMode::Verlet;
+}
+
+// The lists are built from the grid stencil, so it has to reach the skin too,
+// except while the gather pass stands in for them.
+float ParticleSystem::grid_radius() const {
+    return use_neighbor_lists() && list_backoff_ == 0 ? interaction_radius * (1.0f + verlet_skin)
+                                                      : interaction_radius;
+}
+
+ForceKernel ParticleSystem::gather_kernel() const {
+    return resolve_force_kernel(deterministic && force_kernel == ForceKernel::Auto ? ForceKernel::Scalar : force_kernel);
+}
+
+// Estimated force pass cost per particle for reach k, in pair evaluations:
+// the candidates a grid with that reach would test, counted on the current
+// positions so clusters are seen as they are, plus a fixed cost per stencil
+// row for its slot range, which grows with the kernel's vector width through
+// the partially filled blocks at either end. The row cost was fitted to the
+// measured reach 1 to 2 crossovers on uniform worlds (about 6, 14 and 22
+// neighbors per r^2 for the scalar, AVX2 and AVX-512 kernels).
+int ParticleSystem::tuned_grid_reach() const {
+    const int lanes = use_half_stencil() ? 1 : force_kernel_lanes(gather_kernel());
+    const double row_cost = 8.0 + 1.3 * lanes;
+
+    int best = 1;
+    double best_cost = 0.0;
+    for (int k = 1; k <= MAX_GRID_REACH; ++k) {
+        double candidates;
+        if (k == grid->reach()) {
+            candidates = grid->mean_neighbor_candidates();
+        } else {
+            SpatialGrid trial(world_width_, world_height_, grid_radius() / k, k);
+            // Mostly empty cells only add rows without trimming anything.
+            if (k > 1 && static_cast<size_t>(trial.num_cells()) > 2 * count) break;
+            trial.insert_parallel(x, y, count);
+            candidates = trial.mean_neighbor_candidates();
+        }
+
+        const double cost = candidates + row_cost * (2 * k + 1);
+        if (k == 1 || cost < best_cost) {
+            best = k;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+void ParticleSystem::rebuild_grid() {
+    ProfileScope scope(profiler, ProfilePhase::Grid);
+
+    configure_grid();
+    grid_stats_.last_incremental = false;
+    if (next_cell_valid_) {
+        const std::span<const uint32_t> cells(next_cell_.data(), count);
+        if (max_grid_churn > 0.0f && moved_cells_ != SIZE_MAX && !slots_changed_) {
+            grid_stats_.moved += moved_cells_;
+            grid_stats_.checked += count;
+            grid_stats_.last_churn = count > 0 ? static_cast<float>(moved_cells_) / count : 0.0f;
+            const size_t max_moved = static_cast<size_t>(max_grid_churn * count);
+            grid_stats_.last_incremental = moved_cells_ == 0 ||
+                                           (moved_cells_ <= max_moved && grid->update_cells(cells, max_moved));
+        }
+        if (!grid_stats_.last_incremental) grid->insert_cells(cells);
+    } else {
+        grid->insert_parallel(x, y, count);
+    }
+    ++(grid_stats_.last_incremental ? grid_stats_.incremental : grid_stats_.rebuilt);
+    next_cell_valid_ = false;
+    slots_changed_ = false;
+    moved_cells_ = SIZE_MAX;
+
+    if (cell_size <= 0.0f && step_count % GRID_TUNE_INTERVAL == 0) {
+        const int reach = tuned_grid_reach();
+        if (reach != grid_reach_) {
+            grid_reach_ = reach;
+            configure_grid();
+            grid->insert_parallel(x, y, count);
+        }
+    }
+
+    if (sort_interval > 0 && step_count % sort_interval == 0 && !use_neighbor_lists()) {
+        reorder_by_cell();
+    }
 }
 
 void ParticleSystem::apply_forces() {
-    const float max_distance = 80.0f;
-    const float max_distance_sq = max_distance * max_distance;
+    {
+        ProfileScope scope(profiler, ProfilePhase::Forces);
+
+        gather_sorted();
+
+        CellForceArgs args;
+        args.x = sorted_x_.data();
+        args.y = sorted_y_.data();
+        args.type = sorted_type_.data();
+        args.fx = sorted_fx_.data();
+        args.fy = sorted_fy_.data();
+        args.world_width = world_width_;
+        args.world_height = world_height_;
+        args.law = force_law_params(beta);
+        prepare_coefficients(args);
+
+        if (use_half_stencil()) {
+            compute_forces_half_stencil(args);
+        } else if (use_neighbor_lists()) {
+            compute_forces_verlet(args);
+        } else {
+            compute_forces_gather(args);
+        }
+
+        if (profiling() && profiler->neighbor_stats) {
+            record_neighbor_stats();
+        }
+    }
+
+    if (analytics && analytics->due(step_count)) {
+        analyze_structure();
+    }
+
+    // The brush adds into the same sorted force arrays, so its velocity change
+    // rides along with the scatter in integrate instead of another sweep.
+    if (brush.tool != BrushTool::None && brush.tool != BrushTool::Spawn) {
+        apply_brush();
+    }
+}
+
+// Runs before integrate moves anything, so the grid and the sorted copies
+// still describe the particles exactly.
+void ParticleSystem::analyze_structure() {
+    StructureInput input;
+    input.step = step_count;
+    input.count = count;
+    input.num_types = num_types;
+    input.world_width = world_width_;
+    input.world_height = world_height_;
+    input.interaction_radius = interaction_radius;
+    input.grid = grid;
+    input.x = sorted_x_.data();
+    input.y = sorted_y_.data();
+    input.type = sorted_type_.data();
+    input.vx = vx.data();
+    input.vy = vy.data();
+    input.slot_type = type.data();
+    input.type_mass = type_mass.data();
+    analytics->analyze(input);
+}
+
+void ParticleSystem::prepare_coefficients(CellForceArgs& args) {
+    type_radius_sq_.resize(num_types);
+    type_inv_radius_.resize(num_types);
+    type_inv_mass_.resize(num_types);
+    float max_radius_sq = 0.0f;
+    for (int t = 0; t < num_types; ++t) {
+        const float radius = interaction_radius * std::clamp(type_radius[t], 0.0f, 1.0f);
+        type_radius_sq_[t] = radius * radius;
+        type_inv_radius_[t] = 1.0f / radius;
+        type_inv_mass_[t] = 1.0f / type_mass[t];
+        max_radius_sq = std::max(max_radius_sq, type_radius_sq_[t]);
+    }
+
+    args.matrix = attraction_.data();
+    args.matrix_q = nullptr;
+    args.matrix_scale = 1.0f;
+    args.matrix_stride = num_types;
+    args.num_types = num_types;
+    args.radius_sq = type_radius_sq_.data();
+    args.inv_radius = type_inv_radius_.data();
+    args.inv_mass = type_inv_mass_.data();
+    args.max_distance_sq = max_radius_sq;
 
-    grid->insert_parallel(x, y, count);
+    if (!quantize_coefficients) return;
+
+    if (coefficients_version_ != rules_version_ || coefficients_.size() != attraction_.size()) {
+        float max_abs = 0.0f;
+        for (float a : attraction_) max_abs = std::max(max_abs, std::fabs(a));
+        coefficients_scale_ = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+
+        // The kernels gather 4 bytes per entry, so the table has 3 to spare.
+        coefficients_q_.assign(attraction_.size() + 3, 0);
+        coefficients_.resize(attraction_.size());
+        for (size_t k = 0; k < attraction_.size(); ++k) {
+            coefficients_q_[k] = static_cast<int8_t>(std::lround(attraction_[k] / coefficients_scale_));
+            coefficients_[k] = static_cast<float>(coefficients_q_[k]) * coefficients_scale_;
+        }
+        coefficients_version_ = rules_version_;
+    }
+
+    args.matrix = coefficients_.data();
+    args.matrix_q = coefficients_q_.data();
+    args.matrix_scale = coefficients_scale_;
+}
+
+void ParticleSystem::gather_sorted() {
+    const int n = static_cast<int>(count);
+    std::span<const uint32_t> order = grid->sorted_indices();
+
+    sorted_x_.resize(count + FORCE_KERNEL_PADDING);
+    sorted_y_.resize(count + FORCE_KERNEL_PADDING);
+    sorted_type_.resize(count + FORCE_KERNEL_PADDING);
+    sorted_fx_.resize(count);
+    sorted_fy_.resize(count);
+    std::fill(sorted_type_.begin() + count, sorted_type_.end(), 0);
+
+#pragma omp parallel for
+    for (int k = 0; k < n; ++k) {
+        uint32_t i = order[k];
+        sorted_x_[k] = x[i];
+        sorted_y_[k] = y[i];
+        sorted_type_[k] = type[i];
+    }
+}
+
+void ParticleSystem::compute_forces_gather(const CellForceArgs& args) {
+    const int num_cells = grid->num_cells();
+
+    active_mode_ = ForceMode::Gather;
+    active_kernel_ = gather_kernel();
+    const CellForceFn cell_forces = select_cell_forces(active_kernel_, force_law, num_types, args.matrix_q != nullptr);
+
+    const bool timed = profiling();
 
 #pragma omp parallel
     {
-        std::vector<size_t> neighbors;
+        const int64_t start_ns = timed ? profiler_now_ns() : 0;
 
+        // Candidate blocks are read whole and masked, so clusters of dense
+        // cells dominate; dynamic scheduling evens that out across threads.
+#pragma omp for schedule(dynamic, 4) nowait
+        for (int c = 0; c < num_cells; ++c) {
+            const uint32_t begin = grid->cell_begin(c);
+            const uint32_t end = grid->cell_end(c);
+            if (begin == end) continue;
+
+            uint32_t range_begin[MAX_NEIGHBOR_RANGES];
+            uint32_t range_end[MAX_NEIGHBOR_RANGES];
+            int num_ranges = grid->neighbor_ranges(c, range_begin, range_end);
+
+            cell_forces(args, begin, end, range_begin, range_end, num_ranges);
+        }
+
+        if (timed) {
+            profiler->record_thread(ProfilePhase::Forces, omp_get_thread_num(), start_ns, profiler_now_ns());
+        }
+    }
+}
+
+void ParticleSystem::compute_forces_half_stencil(const CellForceArgs& args) {
+    const int n = static_cast<int>(count);
+
+    active_mode_ = ForceMode::HalfStencil;
+    active_kernel_ = ForceKernel::Scalar;
+    const PairForceFn pair_forces = select_pair_forces(force_law);
+
+    const bool timed = profiling();
+
+    // The grid is cut into tiles at least reach cells each way. A cell's
+    // forward stencil reaches reach cells east and reach rows north, so a
+    // tile writes only to itself, its east and west neighbors and the three
+    // tiles north of them: tiles coloured by column mod 3 and row mod 2
+    // never share a particle. The six colours run one after another, the
+    // tiles of each in parallel, all adding straight into args.fx/fy.
+    // Tiling depends only on the grid, so the summation order does not
+    // depend on the thread count. Grids too narrow for three tile columns
+    // use whole rows.
+    const int grid_cols = grid->grid_width();
+    const int grid_rows = grid->grid_height();
+    const int side = std::max(grid->reach(),
+        static_cast<int>(std::sqrt(static_cast<double>(grid_cols) * grid_rows / HALF_STENCIL_TILES)));
+    int tile_cols = grid_cols / side;
+    tile_cols = tile_cols >= 3 ? tile_cols - tile_cols % 3 : 1;
+    const int col_colours = tile_cols >= 3 ? 3 : 1;
+    int tile_rows = grid_rows / side;
+    tile_rows -= tile_rows % 2;
+    const int tiles_per_colour = tile_cols / col_colours * (tile_rows / 2);
+
+#pragma omp parallel
+    {
 #pragma omp for
-        for (int i = 0; i < static_cast<int>(count); ++i) {
-            float fx = 0.0f;
-            float fy = 0.0f;
-
-            grid->query_neighbors(x[i], y[i], neighbors);
-
-            for (size_t j : neighbors) {
-                if (static_cast<size_t>(i) == j) continue;
-                float dx = wrap_distance(x[j] - x[i], WORLD_WIDTH);
-                float dy = wrap_distance(y[j] - y[i], WORLD_HEIGHT);
-                float dist_sq = dx * dx + dy * dy;
-
-                if (dist_sq > 0 && dist_sq < max_distance_sq) {
-                    float inv_dist = fast_inv_sqrt(dist_sq);
-                    float dist = dist_sq * inv_dist;
-                    float force = attraction_matrix[type[i]][type[j]] * inv_dist;
-                    fx += force * dx;
-                    fy += force * dy;
+        for (int k = 0; k < n; ++k) {
+            args.fx[k] = 0.0f;
+            args.fy[k] = 0.0f;
+        }
+
+        const int64_t start_ns = timed ? profiler_now_ns() : 0;
+
+        for (int colour = 0; colour < 2 * col_colours; ++colour) {
+#pragma omp for schedule(dynamic, 1)
+            for (int t = 0; t < tiles_per_colour; ++t) {
+                const int tx = colour % col_colours + col_colours * (t % (tile_cols / col_colours));
+                const int ty = colour / col_colours + 2 * (t / (tile_cols / col_colours));
+                const int col_begin = tx * grid_cols / tile_cols;
+                const int col_end = (tx + 1) * grid_cols / tile_cols;
+                const int row_begin = ty * grid_rows / tile_rows;
+                const int row_end = (ty + 1) * grid_rows / tile_rows;
+
+                for (int row = row_begin; row < row_end; ++row) {
+                    for (int c = row * grid_cols + col_begin; c < row * grid_cols + col_end; ++c) {
+                        const uint32_t begin = grid->cell_begin(c);
+                        const uint32_t end = grid->cell_end(c);
+                        if (begin == end) continue;
+
+                        pair_forces(args, begin, end, begin, end);
+                        grid->for_each_forward_neighbor_cell(c, [&](int neighbor) {
+                            pair_forces(args, begin, end, grid->cell_begin(neighbor), grid->cell_end(neighbor));
+                        });
+                    }
+                }
+            }
+        }
+
+        if (timed) {
+            profiler->record_thread(ProfilePhase::Forces, omp_get_thread_num(), start_ns, profiler_now_ns());
+        }
+
+#pragma omp for
+        for (int k = 0; k < n; ++k) {
+            const float inv_mass = args.inv_mass[args.type[k]];
+            args.fx[k] *= inv_mass;
+            args.fy[k] *= inv_mass;
+        }
+    }
+}
+
+// Rows are by slot and the lists go stale when particles change slots, so a
+// build first sorts the particles by cell: the rows then match the cell
+// order the lists are scanned in, and neighbors are close by in memory.
+void ParticleSystem::compute_forces_verlet(CellForceArgs args) {
+    active_mode_ = ForceMode::Verlet;
+    active_kernel_ = gather_kernel();
+
+    // Lists that last a single step cost a build per step on top of the
+    // pass, so the gather pass runs for a while before the next try.
+    if (list_backoff_ > 0) {
+        --list_backoff_;
+        ++list_stats_.fallback_steps;
+        compute_forces_gather(args);
+        return;
+    }
+
+    const float cutoff = std::sqrt(args.max_distance_sq) + verlet_skin * interaction_radius;
+    if (!neighbor_lists_current(cutoff)) {
+        if (list_stats_.builds > 0 && list_uses_ == 1) {
+            list_backoff_ = LIST_RETRY_INTERVAL - 1;
+            list_uses_ = 0;
+            ++list_stats_.fallback_steps;
+            compute_forces_gather(args);
+            return;
+        }
+        if (!grid->identity_order()) reorder_by_cell();
+        build_neighbor_lists(args, cutoff);
+        list_uses_ = 0;
+    }
+    ++list_uses_;
+    ++list_stats_.passes;
+
+    const int n = static_cast<int>(count);
+    list_px_.resize(count + LIST_POSITION_PADDING);
+    list_py_.resize(count + LIST_POSITION_PADDING);
+#pragma omp parallel for simd
+    for (int i = 0; i < n; ++i) {
+        list_px_[i] = x[i];
+        list_py_[i] = y[i];
+    }
+
+    NeighborListArgs list;
+    list.start = list_start_.data();
+    list.neighbors = list_neighbors_.data();
+    list.neighbor_types = list_types_.data();
+    list.x = list_px_.data();
+    list.y = list_py_.data();
+    args.type = type.data();
+
+    const uint32_t* order = grid->identity_order() ? nullptr : grid->sorted_indices().data();
+    const ListForceFn list_forces =
+        select_list_forces(active_kernel_, force_law, num_types, args.matrix_q != nullptr);
+    const int num_blocks = static_cast<int>((count + LIST_BLOCK - 1) / LIST_BLOCK);
+    const bool timed = profiling();
+
+#pragma omp parallel
+    {
+        const int64_t start_ns = timed ? profiler_now_ns() : 0;
+
+        // Rows are as long as the crowding around each particle, so blocks
+        // in clusters take longer.
+#pragma omp for schedule(dynamic, 1) nowait
+        for (int b = 0; b < num_blocks; ++b) {
+            const uint32_t begin = static_cast<uint32_t>(b) * LIST_BLOCK;
+            list_forces(args, list, order, begin, std::min(begin + LIST_BLOCK, static_cast<uint32_t>(n)));
+        }
+
+        if (timed) {
+            profiler->record_thread(ProfilePhase::Forces, omp_get_thread_num(), start_ns, profiler_now_ns());
+        }
+    }
+}
+
+// A pair within the interaction radius now was within it plus twice the
+// largest displacement at the build, so the lists hold while no particle
+// has moved more than half the skin.
+bool ParticleSystem::neighbor_lists_current(float cutoff) const {
+    if (!lists_valid_ || list_cutoff_ != cutoff || list_start_.size() != count + 1) return false;
+
+    const int n = static_cast<int>(count);
+    const float half_skin = 0.5f * verlet_skin * interaction_radius;
+    const float w = world_width_;
+    const float h = world_height_;
+    float max_sq = 0.0f;
+
+#pragma omp parallel for simd reduction(max : max_sq)
+    for (int i = 0; i < n; ++i) {
+        float dx = std::fabs(x[i] - list_x_[i]);
+        float dy = std::fabs(y[i] - list_y_[i]);
+        dx = std::min(dx, w - dx);
+        dy = std::min(dy, h - dy);
+        max_sq = std::max(max_sq, dx * dx + dy * dy);
+    }
+    return max_sq <= half_skin * half_skin;
+}
+
+// Expects the slots in cell order, so args (the sorted arrays) is indexed by
+// slot. Each thread takes a contiguous run of about count / threads slots and
+// scans their stencils into its own buffers, which a single thread then
+// keeps as the lists; several threads copy theirs to their offsets once
+// every length is known.
+void ParticleSystem::build_neighbor_lists(const CellForceArgs& args, float cutoff) {
+    const uint32_t n = static_cast<uint32_t>(count);
+    const int num_cells = grid->num_cells();
+    const float cutoff_sq = cutoff * cutoff;
+    const NeighborScanFn scan = select_neighbor_scan(active_kernel_);
+    std::vector<size_t> thread_entries(omp_get_max_threads() + 1, 0);
+
+    list_start_.resize(count + 1);
+    list_start_[0] = 0;
+
+#pragma omp parallel
+    {
+        const int tid = omp_get_thread_num();
+        const int num_threads = omp_get_num_threads();
+
+#pragma omp single
+        {
+            thread_lists_.resize(num_threads);
+            thread_list_types_.resize(num_threads);
+        }
+
+        const uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(n) * tid / num_threads);
+        const uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(n) * (tid + 1) / num_threads);
+        std::vector<uint32_t>& rows = thread_lists_[tid];
+        std::vector<uint8_t>& row_types = thread_list_types_[tid];
+        size_t used = 0;
+
+        int lo = 0;
+        int hi = num_cells;
+        while (lo < hi) {
+            const int mid = (lo + hi) / 2;
+            if (grid->cell_end(mid) <= first) lo = mid + 1;
+            else hi = mid;
+        }
+
+        for (uint32_t i = first, c = lo; i < last; ++c) {
+            const uint32_t cell_last = std::min(grid->cell_end(c), last);
+            if (i >= cell_last) continue;
+
+            uint32_t range_begin[MAX_NEIGHBOR_RANGES];
+            uint32_t range_end[MAX_NEIGHBOR_RANGES];
+            const int num_ranges = grid->neighbor_ranges(c, range_begin, range_end);
+            size_t candidates = FORCE_KERNEL_PADDING;
+            for (int r = 0; r < num_ranges; ++r) candidates += range_end[r] - range_begin[r];
+
+            for (; i < cell_last; ++i) {
+                if (rows.size() < used + candidates) {
+                    rows.resize(2 * (used + candidates));
+                    row_types.resize(rows.size());
+                }
+                const uint32_t found = scan(args, i, range_begin, range_end, num_ranges, cutoff_sq, rows.data() + used);
+                for (uint32_t e = 0; e < found; ++e) row_types[used + e] = args.type[rows[used + e]];
+                used += found;
+                list_start_[i + 1] = static_cast<uint32_t>(used);
+            }
+        }
+        thread_entries[tid + 1] = used;
+
+#pragma omp barrier
+#pragma omp single
+        {
+            for (int t = 0; t < num_threads; ++t) thread_entries[t + 1] += thread_entries[t];
+            if (num_threads == 1) {
+                list_neighbors_.swap(rows);
+                list_types_.swap(row_types);
+            } else {
+                list_neighbors_.resize(thread_entries[num_threads]);
+                list_types_.resize(thread_entries[num_threads] + FORCE_KERNEL_PADDING);
+            }
+        }
+
+        if (num_threads > 1) {
+            const uint32_t offset = static_cast<uint32_t>(thread_entries[tid]);
+            std::copy(rows.begin(), rows.begin() + used, list_neighbors_.begin() + offset);
+            std::copy(row_types.begin(), row_types.begin() + used, list_types_.begin() + offset);
+            for (uint32_t i = first; i < last; ++i) list_start_[i + 1] += offset;
+        }
+    }
+
+    list_x_.assign(x.begin(), x.end());
+    list_y_.assign(y.begin(), y.end());
+    list_cutoff_ = cutoff;
+    lists_valid_ = true;
+    ++list_stats_.builds;
+    list_stats_.entries = list_start_[count];
+    list_stats_.stencil_candidates = grid->mean_neighbor_candidates();
+}
+
+void ParticleSystem::apply_brush() {
+    ProfileScope scope(profiler, ProfilePhase::Mouse);
+
+    grid->cells_in_radius(brush.x, brush.y, brush.radius, brush_cells_);
+
+    const int num_cells = static_cast<int>(brush_cells_.size());
+    const float radius_sq = brush.radius * brush.radius;
+    const float half_w = world_width_ * 0.5f;
+    const float half_h = world_height_ * 0.5f;
+    const float force_scale = brush.strength * 100.0f;
+    const uint8_t paint_type = static_cast<uint8_t>(std::clamp(brush.paint_type, 0, num_types - 1));
+    std::span<const uint32_t> order = grid->sorted_indices();
+    if (brush.tool == BrushTool::Erase) expiring_ = true;
+    // The lists keep each neighbor's type.
+    if (brush.tool == BrushTool::Paint) lists_valid_ = false;
+
+#pragma omp parallel for schedule(dynamic, 4)
+    for (int b = 0; b < num_cells; ++b) {
+        const int c = brush_cells_[b];
+        const uint32_t end = grid->cell_end(c);
+
+        for (uint32_t k = grid->cell_begin(c); k < end; ++k) {
+            float dx = brush.x - sorted_x_[k];
+            float dy = brush.y - sorted_y_[k];
+            dx += (dx < -half_w ? world_width_ : 0.0f) - (dx > half_w ? world_width_ : 0.0f);
+            dy += (dy < -half_h ? world_height_ : 0.0f) - (dy > half_h ? world_height_ : 0.0f);
+            const float dist_sq = dx * dx + dy * dy;
+            if (dist_sq >= radius_sq) continue;
+
+            if (brush.tool == BrushTool::Force) {
+                // strength * 100 / dist along the unit direction, without the sqrt,
+                // scaled by inverse mass like the pair forces it is added to.
+                if (dist_sq > 1.0f) {
+                    const float force = force_scale * type_inv_mass_[sorted_type_[k]] / dist_sq;
+                    sorted_fx_[k] += force * dx;
+                    sorted_fy_[k] += force * dy;
                 }
+            } else if (brush.tool == BrushTool::Paint) {
+                type[order[k]] = paint_type;
+            } else {
+                lifetime[order[k]] = 0.0f;
             }
+        }
+    }
+}
 
-            vx[i] = (vx[i] + fx) * 0.5f;
-            vy[i] = (vy[i] + fy) * 0.5f;
+void ParticleSystem::record_neighbor_stats() {
+    if (active_mode_ == ForceMode::Verlet) {
+        const int n = static_cast<int>(count);
+        uint32_t max_entries = 0;
+#pragma omp parallel for reduction(max : max_entries)
+        for (int i = 0; i < n; ++i) {
+            max_entries = std::max(max_entries, list_start_[i + 1] - list_start_[i]);
         }
+        profiler->record_neighbors(count > 0 ? static_cast<double>(list_stats_.entries) / count : 0.0, max_entries);
+        return;
+    }
+
+    const int num_cells = grid->num_cells();
+    uint64_t total = 0;
+    uint32_t max_candidates = 0;
+
+#pragma omp parallel for reduction(+ : total) reduction(max : max_candidates)
+    for (int c = 0; c < num_cells; ++c) {
+        const uint32_t occupancy = grid->cell_end(c) - grid->cell_begin(c);
+        if (occupancy == 0) continue;
+
+        uint32_t candidates = 0;
+        grid->for_each_neighbor_cell(c, [&](int neighbor) {
+            candidates += grid->cell_end(neighbor) - grid->cell_begin(neighbor);
+        });
+        total += static_cast<uint64_t>(occupancy) * candidates;
+        max_candidates = std::max(max_candidates, candidates);
     }
+
+    profiler->record_neighbors(count > 0 ? static_cast<double>(total) / count : 0.0, max_candidates);
+}
+
+void ParticleSystem::reorder_by_cell() {
+    std::span<const uint32_t> order = grid->sorted_indices();
+    const int n = static_cast<int>(count);
+
+    sort_scratch_f_.resize(count);
+    sort_scratch_u8_.resize(count);
+    sort_scratch_u32_.resize(count);
+
+    auto permute = [&](auto& values, auto& scratch) {
+#pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            scratch[i] = values[order[i]];
+        }
+        values.swap(scratch);
+    };
+
+    permute(x, sort_scratch_f_);
+    permute(y, sort_scratch_f_);
+    permute(vx, sort_scratch_f_);
+    permute(vy, sort_scratch_f_);
+    permute(type, sort_scratch_u8_);
+    permute(lifetime, sort_scratch_f_);
+    permute(id, sort_scratch_u32_);
+
+#pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        slot_of_id[id[i]] = static_cast<uint32_t>(i);
+    }
+
+    grid->mark_sorted();
+    lists_valid_ = false;
 }
 
 void ParticleSystem::update(float dt) {
+    rebuild_grid();
     apply_forces();
+    integrate(dt);
+    expire_particles(dt);
+    spawn_particles();
+    step_count++;
+}
+
+// Walks the slots backwards, so the particle remove_slot moves into a freed
+// slot has already been counted down. Serial, which keeps the removal order
+// and so the ids handed out afterwards independent of the thread count.
+void ParticleSystem::expire_particles(float dt) {
+    if (!expiring_) return;
+
+    bool mortal = false;
+    for (size_t i = count; i-- > 0;) {
+        if (lifetime[i] == INFINITY) continue;
+        lifetime[i] -= dt;
+        if (lifetime[i] <= 0.0f) {
+            remove_slot(i);
+        } else {
+            mortal = true;
+        }
+    }
+    expiring_ = mortal;
+}
+
+// The emitter and the Spawn brush, drawing from a stream keyed by the step.
+void ParticleSystem::spawn_particles() {
+    const bool brush_spawn = brush.tool == BrushTool::Spawn && brush.spawn_rate > 0;
+    if (emit_rate <= 0 && !brush_spawn) return;
+
+    const uint64_t s = resolve_seed(seed);
+    const uint64_t stream = STREAM_SPAWN | (static_cast<uint64_t>(step_count) << 8);
+    uint64_t draw = 0;
+
+    for (int k = 0; k < emit_rate; ++k, draw += 3) {
+        spawn(counter_uniform(s, stream, draw, 0.0f, world_width_),
+              counter_uniform(s, stream, draw + 1, 0.0f, world_height_), 0.0f, 0.0f,
+              static_cast<int>(counter_below(s, stream, draw + 2, num_types)), spawn_lifetime);
+    }
+
+    if (!brush_spawn) return;
+    for (int k = 0; k < brush.spawn_rate; ++k, draw += 2) {
+        // sqrt of the radial draw spreads the points evenly over the disc.
+        const float r = brush.radius * std::sqrt(counter_uniform(s, stream, draw, 0.0f, 1.0f));
+        const float angle = counter_uniform(s, stream, draw + 1, 0.0f, 6.2831853f);
+        spawn(brush.x + r * std::cos(angle), brush.y + r * std::sin(angle), 0.0f, 0.0f, brush.paint_type,
+              spawn_lifetime);
+    }
+}
+
+void ParticleSystem::reserve(size_t capacity) {
+    x.reserve(capacity);
+    y.reserve(capacity);
+    vx.reserve(capacity);
+    vy.reserve(capacity);
+    type.reserve(capacity);
+    lifetime.reserve(capacity);
+    id.reserve(capacity);
+    slot_of_id.reserve(capacity);
+    free_ids.reserve(capacity);
+    next_cell_.reserve(capacity);
+    sort_scratch_f_.reserve(capacity);
+    sort_scratch_u8_.reserve(capacity);
+    sort_scratch_u32_.reserve(capacity);
+    sorted_x_.reserve(capacity + FORCE_KERNEL_PADDING);
+    sorted_y_.reserve(capacity + FORCE_KERNEL_PADDING);
+    sorted_type_.reserve(capacity + FORCE_KERNEL_PADDING);
+    sorted_fx_.reserve(capacity + FORCE_KERNEL_PADDING);
+    sorted_fy_.reserve(capacity + FORCE_KERNEL_PADDING);
+    if (grid) grid->reserve(capacity);
+}
+
+uint32_t ParticleSystem::spawn(float px, float py, float pvx, float pvy, int particle_type, float life) {
+    uint32_t new_id;
+    if (free_ids.empty()) {
+        new_id = static_cast<uint32_t>(slot_of_id.size());
+        slot_of_id.push_back(INVALID_SLOT);
+    } else {
+        new_id = free_ids.back();
+        free_ids.pop_back();
+    }
+
+    px -= std::floor(px / world_width_) * world_width_;
+    py -= std::floor(py / world_height_) * world_height_;
 
-    for (size_t i = 0; i < count; ++i) {
-        x[i] += vx[i] * dt * 60.0f;
-        y[i] += vy[i] * dt * 60.0f;
+    const size_t slot = count++;
+    slot_of_id[new_id] = static_cast<uint32_t>(slot);
+    x.push_back(px);
+    y.push_back(py);
+    vx.push_back(pvx);
+    vy.push_back(pvy);
+    type.push_back(static_cast<uint8_t>(std::clamp(particle_type, 0, num_types - 1)));
+    lifetime.push_back(life);
+    id.push_back(new_id);
 
-        if (x[i] < 0) x[i] += WORLD_WIDTH;
-        if (x[i] > WORLD_WIDTH) x[i] -= WORLD_WIDTH;
-        if (y[i] < 0) y[i] += WORLD_HEIGHT;
-        if (y[i] > WORLD_HEIGHT) y[i] -= WORLD_HEIGHT;
+    if (next_cell_valid_) {
+        next_cell_.resize(count);
+        next_cell_[slot] = static_cast<uint32_t>(grid->cell_of(px, py));
     }
+    if (life != INFINITY) expiring_ = true;
+    slots_changed_ = true;
+    lists_valid_ = false;
+    return new_id;
+}
+
+void ParticleSystem::despawn(uint32_t particle_id) {
+    if (particle_id < slot_of_id.size() && slot_of_id[particle_id] != INVALID_SLOT) {
+        remove_slot(slot_of_id[particle_id]);
+    }
+}
+
+void ParticleSystem::remove_slot(size_t slot) {
+    const size_t last = count - 1;
+    slot_of_id[id[slot]] = INVALID_SLOT;
+    free_ids.push_back(id[slot]);
+
+    if (slot != last) {
+        x[slot] = x[last];
+        y[slot] = y[last];
+        vx[slot] = vx[last];
+        vy[slot] = vy[last];
+        type[slot] = type[last];
+        lifetime[slot] = lifetime[last];
+        id[slot] = id[last];
+        slot_of_id[id[slot]] = static_cast<uint32_t>(slot);
+        if (next_cell_valid_) next_cell_[slot] = next_cell_[last];
+    }
+
+    x.pop_back();
+    y.pop_back();
+    vx.pop_back();
+    vy.pop_back();
+    type.pop_back();
+    lifetime.pop_back();
+    id.pop_back();
+    count = last;
+    slots_changed_ = true;
+    lists_valid_ = false;
+}
+
+void ParticleSystem::set_population(size_t num_particles) {
+    if (num_particles > count) {
+        // Keyed by the new particle's slot and the step, like reset_particles.
+        const uint64_t s = resolve_seed(seed);
+        const uint64_t stream = STREAM_POPULATION | (static_cast<uint64_t>(step_count) << 8);
+        reserve(num_particles);
+        while (count < num_particles) {
+            const uint64_t draw = 3 * static_cast<uint64_t>(count);
+            spawn(counter_uniform(s, stream, draw, 0.0f, world_width_),
+                  counter_uniform(s, stream, draw + 1, 0.0f, world_height_), 0.0f, 0.0f,
+                  static_cast<int>(counter_below(s, stream, draw + 2, num_types)));
+        }
+        return;
+    }
+
+    for (size_t i = slot_of_id.size(); i-- > 0 && count > num_particles;) {
+        if (slot_of_id[i] != INVALID_SLOT) remove_slot(slot_of_id[i]);
+    }
+    // Retire the freed ids at the top of the range, so a population that was
+    // only ever resized keeps contiguous ids.
+    while (!slot_of_id.empty() && slot_of_id.back() == INVALID_SLOT) {
+        slot_of_id.pop_back();
+    }
+    const uint32_t limit = static_cast<uint32_t>(slot_of_id.size());
+    std::erase_if(free_ids, [limit](uint32_t i) { return i >= limit; });
+}
+
+void ParticleSystem::integrate(float dt) {
+    ProfileScope scope(profiler, ProfilePhase::Integrate);
+
+    const int n = static_cast<int>(count);
+    const float w = world_width_;
+    const float h = world_height_;
+    const SpatialGrid& cells = *grid;
+    next_cell_.resize(count);
+
+    float* px = x.data();
+    float* py = y.data();
+    float* pvx = vx.data();
+    float* pvy = vy.data();
+    uint32_t* cell = next_cell_.data();
+    const float* fx = sorted_fx_.data();
+    const float* fy = sorted_fy_.data();
+    // Counting the particles that change cells here is what lets
+    // rebuild_grid choose between patching and rebuilding the grid.
+    const std::span<const uint32_t> previous = cells.slot_cells();
+    const uint32_t* prev = previous.size() == count && !slots_changed_ ? previous.data() : nullptr;
+    size_t moved = 0;
+
+    // Select-based wrap and the cell for the next rebuild, in the same sweep
+    // as the move, so rebuild_grid does not recompute cell coordinates.
+    auto move = [&](int i, float vxi, float vyi) {
+        float nx = px[i] + vxi * dt * 60.0f;
+        float ny = py[i] + vyi * dt * 60.0f;
+
+        nx += nx < 0.0f ? w : 0.0f;
+        nx -= nx > w ? w : 0.0f;
+        ny += ny < 0.0f ? h : 0.0f;
+        ny -= ny > h ? h : 0.0f;
+
+        px[i] = nx;
+        py[i] = ny;
+        cell[i] = static_cast<uint32_t>(cells.cell_of(nx, ny));
+        return prev && cell[i] != prev[i];
+    };
+
+    if (grid->identity_order()) {
+        // Slots are in cell order, so the forces line up with them and the
+        // whole step is one contiguous, vectorizable sweep.
+#pragma omp parallel for simd schedule(static) reduction(+ : moved)
+        for (int i = 0; i < n; ++i) {
+            const float vxi = (pvx[i] + fx[i]) * 0.5f;
+            const float vyi = (pvy[i] + fy[i]) * 0.5f;
+            pvx[i] = vxi;
+            pvy[i] = vyi;
+            moved += move(i, vxi, vyi);
+        }
+    } else {
+        // Otherwise scatter only the velocities, keeping the random writes to
+        // two arrays, and stream through the slots for the rest.
+        const uint32_t* order = grid->sorted_indices().data();
+#pragma omp parallel for schedule(static)
+        for (int k = 0; k < n; ++k) {
+            const uint32_t i = order[k];
+            pvx[i] = (pvx[i] + fx[k]) * 0.5f;
+            pvy[i] = (pvy[i] + fy[k]) * 0.5f;
+        }
+
+#pragma omp parallel for simd schedule(static) reduction(+ : moved)
+        for (int i = 0; i < n; ++i) {
+            moved += move(i, pvx[i], pvy[i]);
+        }
+    }
+
+    next_cell_valid_ = true;
+    moved_cells_ = prev ? moved : SIZE_MAX;
 }
 
 void ParticleSystem::randomize_rules() {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<float> rule_dist(-1.0f, 1.0f);
+    const uint64_t s = resolve_seed(seed);
 
     for (int i = 0; i < num_types; ++i) {
         for (int j = 0; j < num_types; ++j) {
-            attraction_matrix[i][j] = rule_dist(gen);
+            // Pairs of the first 10 types keep the draws they had when that
+            // was the limit, so seeded runs reproduce.
+            const uint64_t draw = i < 10 && j < 10 ? i * 10 + j : 100 + i * MAX_PARTICLE_TYPES + j;
+            attraction_[i * num_types + j] = counter_uniform(s, STREAM_RULES, draw, -1.0f, 1.0f);
         }
     }
+    ++rules_version_;
 }
 
 void ParticleSystem::reset_particles() {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<float> pos_x(0.0f, world_width_);
-    std::uniform_real_distribution<float> pos_y(0.0f, world_height_);
+    // Keyed by step too, so resets at different times scatter differently.
+    const uint64_t s = resolve_seed(seed);
+    const uint64_t stream = STREAM_RESET | (static_cast<uint64_t>(step_count) << 8);
+    const int n = static_cast<int>(count);
+    next_cell_valid_ = false;
+    lists_valid_ = false;
 
-    for (size_t i = 0; i < count; ++i) {
-        x[i] = pos_x(gen);
-        y[i] = pos_y(gen);
+#pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        const uint64_t draw = 2 * static_cast<uint64_t>(id[i]);
+        x[i] = counter_uniform(s, stream, draw, 0.0f, world_width_);
+        y[i] = counter_uniform(s, stream, draw + 1, 0.0f, world_height_);
         vx[i] = 0.0f;
         vy[i] = 0.0f;
     }
@@ -148,23 +1030,27 @@ void ParticleSystem::cleanup() {
 }
 
 void ParticleSystem::reinit(size_t num_particles, int num_types_new) {
-    cleanup();
     init(num_particles, num_types_new, world_width_, world_height_);
 }
 
-void ParticleSystem::apply_mouse_force(float mouse_x, float mouse_y, float force_strength, float radius) {
-    const float max_distance_sq = radius * radius;
-
-    for (size_t i = 0; i < count; ++i) {
-        float dx = wrap_distance(mouse_x - x[i], WORLD_WIDTH);
-        float dy = wrap_distance(mouse_y - y[i], WORLD_HEIGHT);
-        float dist_sq = dx * dx + dy * dy;
-
-        if (dist_sq < max_distance_sq && dist_sq > 1.0f) {
-            float dist = std::sqrt(dist_sq);
-            float force = (force_strength * 100.0f) / dist;
-            vx[i] += force * dx / dist;
-            vy[i] += force * dy / dist;
+uint64_t ParticleSystem::state_hash() const {
+    // FNV-1a over the per-id state, so slot order (spatial sorting) does not
+    // change the result.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&](uint32_t word) {
+        for (int b = 0; b < 4; ++b) {
+            hash ^= (word >> (8 * b)) & 0xff;
+            hash *= 0x100000001b3ull;
         }
+    };
+
+    for (const uint32_t i : slot_of_id) {
+        if (i == INVALID_SLOT) continue;
+        mix(std::bit_cast<uint32_t>(x[i]));
+        mix(std::bit_cast<uint32_t>(y[i]));
+        mix(std::bit_cast<uint32_t>(vx[i]));
+        mix(std::bit_cast<uint32_t>(vy[i]));
+        mix(type[i]);
     }
+    return hash;
 }
\ No newline at end of file
@@ -2,8 +2,79 @@
 #define PARTICLE_SYSTEM_HPP
 
 #include <vector>
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <span>
 #include "spatial_grid.hpp"
+#include "force_kernels.hpp"
+#include "profiler.hpp"
+#include "analytics.hpp"
+
+// Types are stored as uint8_t.
+constexpr int MAX_PARTICLE_TYPES = 256;
+
+// Gather evaluates every pair from both sides with the SIMD cell kernels.
+// HalfStencil visits half of the neighbor stencil and applies each pair to
+// both particles, running coloured tiles of cells in parallel so no two
+// threads write the same particle. Verlet keeps, per
+// particle, a list of the particles within the interaction radius plus a
+// skin, and reuses it across steps until some particle has moved half the
+// skin, so a step tests only those instead of the whole grid stencil.
+enum class ForceMode { Gather, HalfStencil, Verlet };
+
+const char* force_mode_name(ForceMode mode);
+
+// Tools applied to the particles inside a circle during apply_forces. Only
+// the grid cells that intersect the circle are visited. Erase expires the
+// particles it covers and Spawn adds particles after the move, so neither
+// disturbs the cell-ordered arrays of the force pass.
+enum class BrushTool { None, Force, Paint, Spawn, Erase };
+
+struct Brush {
+    BrushTool tool = BrushTool::None;
+    float x = 0.0f;
+    float y = 0.0f;
+    float radius = 0.0f;
+    // Force: positive pulls particles toward the center, negative pushes them away.
+    float strength = 0.0f;
+    // Paint: the type given to every particle inside the circle. Spawn: the
+    // type of the new particles.
+    int paint_type = 0;
+    // Spawn: particles added per step at uniform points inside the circle.
+    int spawn_rate = 0;
+};
+
+// slot_of_id entry of an id that is not in use.
+constexpr uint32_t INVALID_SLOT = UINT32_MAX;
+
+// Grid maintenance since init. Churn is measured on the steps that tried an
+// incremental update.
+struct GridStats {
+    uint64_t incremental = 0;
+    uint64_t rebuilt = 0;
+    // Particles that changed cells and particles checked, summed over steps.
+    uint64_t moved = 0;
+    uint64_t checked = 0;
+    float last_churn = 0.0f;
+    bool last_incremental = false;
+
+    double mean_churn() const { return checked > 0 ? static_cast<double>(moved) / checked : 0.0; }
+};
+
+// Verlet list upkeep since init.
+struct NeighborListStats {
+    uint64_t builds = 0;
+    uint64_t passes = 0;
+    // Steps that ran the gather pass because the lists kept going stale.
+    uint64_t fallback_steps = 0;
+    // Entries of the current lists, and the mean number of candidates the
+    // grid stencil held per particle when they were built.
+    uint64_t entries = 0;
+    double stencil_candidates = 0.0;
+
+    double steps_per_build() const { return builds > 0 ? static_cast<double>(passes) / builds : 0.0; }
+};
 
 struct ParticleSystem {
     std::vector<float> x;
@@ -11,26 +82,228 @@ struct ParticleSystem {
     std::vector<float> vx;
     std::vector<float> vy;
     std::vector<uint8_t> type;
+    // Seconds each particle has left, infinite for particles that never
+    // expire; update() removes the ones whose time runs out.
+    std::vector<float> lifetime;
+    // id[i] is the stable identity of the particle stored in slot i;
+    // slot_of_id inverts it, with INVALID_SLOT for the ids on free_ids. Slots
+    // change when spatial sorting is enabled or particles are removed.
+    std::vector<uint32_t> id;
+    std::vector<uint32_t> slot_of_id;
+    std::vector<uint32_t> free_ids;
     size_t count;
 
     ~ParticleSystem() { cleanup(); }
 
-    float attraction_matrix[10][10];
     int num_types;
 
-    SpatialGrid* grid;
+    // How type1 reacts to type2; the matrix is num_types x num_types, row-major.
+    float attraction(int type1, int type2) const { return attraction_[type1 * num_types + type2]; }
+    std::span<const float> attraction_matrix() const { return attraction_; }
+    // Changes whenever the matrix does.
+    uint64_t rules_version() const { return rules_version_; }
+
+    // Per type, num_types entries reset to 1 by init: the fraction of
+    // interaction_radius within which the type senses others, in (0, 1], and
+    // its mass, which divides the force it feels. Either may change between
+    // steps.
+    std::vector<float> type_radius;
+    std::vector<float> type_mass;
+
+    // Quantizes the coefficients to int8 with one scale (max |a| / 127). The
+    // vector kernels gather from that table once the type count outgrows
+    // their register-resident rows, touching a quarter of the memory; every
+    // kernel then uses the quantized values.
+    bool quantize_coefficients = false;
+
+    SpatialGrid* grid = nullptr;
+
+    // Seeds init, randomize_rules and reset_particles; 0 uses std::random_device.
+    uint64_t seed = 0;
+
+    // Gives bitwise-identical state for any thread count: every force mode
+    // already sums in an order fixed by the grid (one thread per particle in
+    // the gather and Verlet passes, tiles that depend only on the grid in the
+    // half stencil); this resolves an Auto kernel to Scalar so the result
+    // does not depend on the CPU either. Explicit kernels are honored for
+    // comparing variants.
+    bool deterministic = false;
+
+    // Pairs closer than interaction_radius interact. The grid has cells of
+    // interaction_radius / k and a stencil reaching k cells each way: a
+    // positive cell_size fixes the cell width (k follows from it), 0 lets
+    // rebuild_grid re-pick k from the measured crowding every
+    // GRID_TUNE_INTERVAL steps. Both may change between steps.
+    float interaction_radius = 80.0f;
+    float cell_size = 0.0f;
+    int grid_reach() const { return grid_reach_; }
+    // rebuild_grid moves only the particles that changed cells while they
+    // are at most this fraction of all particles, and rebuilds the grid
+    // otherwise; 0 always rebuilds. Either way the cell order is the same.
+    float max_grid_churn = 0.05f;
+    const GridStats& grid_stats() const { return grid_stats_; }
+    // Restores a saved run's reach; kept until the next retune.
+    void set_grid_reach(int reach) { grid_reach_ = std::clamp(reach, 1, MAX_GRID_REACH); }
+
+    // Physically reorder the particle arrays by grid cell every sort_interval
+    // steps (0 disables), so neighbor cells are contiguous in memory.
+    int sort_interval = 0;
+    size_t step_count = 0;
+
+    // Auto picks the widest SIMD kernel the CPU supports at runtime.
+    ForceKernel force_kernel = ForceKernel::Auto;
+    ForceKernel active_force_kernel() const { return active_kernel_; }
+
+    ForceMode force_mode = ForceMode::Gather;
+    ForceMode active_force_mode() const { return active_mode_; }
+
+    // Verlet mode: the margin beyond the interaction radius that the lists
+    // cover, as a fraction of interaction_radius. A wider skin rebuilds less
+    // often but evaluates more pairs per step. The grid is sized for the
+    // radius plus the skin, and the particles are sorted by cell at every
+    // build instead of every sort_interval steps.
+    float verlet_skin = 0.15f;
+    const NeighborListStats& neighbor_list_stats() const { return list_stats_; }
+
+    // Shape of the pair force over distance; beta is the Classic law's
+    // repulsion zone as a fraction of interaction_radius, in (0, 1).
+    ForceLaw force_law = ForceLaw::Constant;
+    float beta = 0.3f;
+
+    // Optional; when set and enabled, update() reports its phases to it.
+    Profiler* profiler = nullptr;
+    // Optional; when set, apply_forces hands it the step's grid and sorted
+    // positions on the steps it is due.
+    StructureAnalytics* analytics = nullptr;
+
+    // Applied on every step until the tool is set back to None.
+    Brush brush;
+
+    // Emitter: particles spawned every step at uniform random positions and
+    // types. Emitted and brush-spawned particles live spawn_lifetime seconds.
+    int emit_rate = 0;
+    float spawn_lifetime = INFINITY;
 
     void init(size_t num_particles, int num_types, float world_width, float world_height);
     void reinit(size_t num_particles, int num_types);
     void cleanup();
     void update(float dt);
+
+    // The particles are a pool of dense slots. spawn appends a slot and
+    // takes the most recently freed id (or a new one); despawn moves the
+    // last particle into the freed slot. Both are O(1) and leave the grid
+    // alone: the next rebuild_grid inserts whatever the slots hold. reserve
+    // sizes every per-particle array so growing up to capacity allocates
+    // nothing.
+    void reserve(size_t capacity);
+    size_t capacity() const { return x.capacity(); }
+    // Ids are below id_limit(); they stop being contiguous once particles
+    // have been removed.
+    size_t id_limit() const { return slot_of_id.size(); }
+    uint32_t spawn(float px, float py, float pvx, float pvy, int particle_type, float life = INFINITY);
+    void despawn(uint32_t particle_id);
+    // Grows by uniformly placed particles of random types, or shrinks by
+    // removing the highest ids; every other particle stays as it is.
+    void set_population(size_t num_particles);
+    // Call after writing lifetime directly, so update() counts it down.
+    void lifetimes_changed() { expiring_ = true; }
+
+    // The phases of update(), exposed so they can be timed separately.
+    // apply_forces leaves the forces in cell order; integrate applies them to
+    // the velocities, moves and wraps the particles, and computes the cells
+    // the next rebuild_grid inserts them into.
+    void rebuild_grid();
+    void apply_forces();
+    void integrate(float dt);
+
     void set_attraction(int type1, int type2, float value);
     void randomize_rules();
     void reset_particles();
-    void apply_mouse_force(float mouse_x, float mouse_y, float force_strength, float radius);
+    // Hash of every live particle's position, velocity and type in id order.
+    uint64_t state_hash() const;
+
+    float world_width() const { return world_width_; }
+    float world_height() const { return world_height_; }
 
 private:
-    void apply_forces();
+    void configure_grid();
+    int tuned_grid_reach() const;
+    bool use_half_stencil() const;
+    bool use_neighbor_lists() const;
+    float grid_radius() const;
+    ForceKernel gather_kernel() const;
+    void reorder_by_cell();
+    void gather_sorted();
+    void compute_forces_gather(const CellForceArgs& args);
+    void compute_forces_half_stencil(const CellForceArgs& args);
+    void compute_forces_verlet(CellForceArgs args);
+    bool neighbor_lists_current(float cutoff) const;
+    void build_neighbor_lists(const CellForceArgs& args, float cutoff);
+    void record_neighbor_stats();
+    void apply_brush();
+    void expire_particles(float dt);
+    void spawn_particles();
+    void remove_slot(size_t slot);
+    void prepare_coefficients(CellForceArgs& args);
+    void analyze_structure();
+    bool profiling() const { return profiler && profiler->enabled; }
+
+    std::vector<float> sort_scratch_f_;
+    std::vector<uint8_t> sort_scratch_u8_;
+    std::vector<uint32_t> sort_scratch_u32_;
+
+    ForceKernel active_kernel_ = ForceKernel::Scalar;
+    ForceMode active_mode_ = ForceMode::Gather;
+    std::vector<float> sorted_x_;
+    std::vector<float> sorted_y_;
+    std::vector<uint8_t> sorted_type_;
+    std::vector<float> sorted_fx_;
+    std::vector<float> sorted_fy_;
+    std::vector<int> brush_cells_;
+    // Cell of each slot for the next rebuild_grid, valid only right after
+    // integrate; anything else that moves particles recomputes from x/y.
+    std::vector<uint32_t> next_cell_;
+    bool next_cell_valid_ = false;
+    // Set while some lifetime may be finite.
+    bool expiring_ = false;
+    // Set when spawn or despawn changed the slots since the last grid insert.
+    bool slots_changed_ = false;
+    // Slots whose cell integrate changed, when it could compare against the
+    // grid's (SIZE_MAX otherwise).
+    size_t moved_cells_ = SIZE_MAX;
+    GridStats grid_stats_;
+    // Verlet lists in CSR form (see NeighborListArgs), built from the
+    // positions in list_x_/list_y_ with a cutoff of list_cutoff_. Cleared by
+    // anything that moves particles between slots or repaints them.
+    std::vector<uint32_t> list_start_;
+    std::vector<uint32_t> list_neighbors_;
+    std::vector<uint8_t> list_types_;
+    std::vector<std::vector<uint32_t>> thread_lists_;
+    std::vector<std::vector<uint8_t>> thread_list_types_;
+    std::vector<float> list_x_;
+    std::vector<float> list_y_;
+    std::vector<float> list_px_;
+    std::vector<float> list_py_;
+    float list_cutoff_ = 0.0f;
+    bool lists_valid_ = false;
+    // Passes on the current lists, and gather steps left before building again.
+    int list_uses_ = 0;
+    int list_backoff_ = 0;
+    NeighborListStats list_stats_;
+    int grid_reach_ = 1;
+
+    std::vector<float> attraction_;
+    uint64_t rules_version_ = 0;
+    // The quantized table and its dequantized floats, built for
+    // coefficients_version_.
+    std::vector<int8_t> coefficients_q_;
+    std::vector<float> coefficients_;
+    uint64_t coefficients_version_ = 0;
+    float coefficients_scale_ = 1.0f;
+    // type_radius and type_mass expanded for the kernels each pass.
+    std::vector<float> type_radius_sq_;
+    std::vector<float> type_inv_radius_;
+    std::vector<float> type_inv_mass_;
     float world_width_;
     float world_height_;
 };
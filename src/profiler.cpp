@@ -0,0 +1,132 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <omp.h>
+
+const char* profile_phase_name(ProfilePhase phase) {
+    switch (phase) {
+        case ProfilePhase::Grid: return "grid";
+        case ProfilePhase::Forces: return "forces";
+        case ProfilePhase::Integrate: return "integrate";
+        case ProfilePhase::Mouse: return "mouse";
+        case ProfilePhase::Render: return "render";
+        case ProfilePhase::ImGui: return "imgui";
+        case ProfilePhase::Count: break;
+    }
+    return "unknown";
+}
+
+Profiler::Profiler()
+    : history_(PROFILE_PHASE_COUNT, std::vector<float>(HISTORY, 0.0f)) {
+    begin_frame();
+}
+
+void Profiler::begin_frame() {
+    std::fill(std::begin(frame_ns_), std::end(frame_ns_), 0.0);
+
+    // Workers index these by thread number, so size them for the current
+    // OpenMP team here, outside any parallel region.
+    const size_t max_threads = omp_get_max_threads();
+    thread_ns_.assign(max_threads, 0);
+    thread_ms_.resize(max_threads, 0.0f);
+    if (trace_.size() < max_threads) {
+        trace_.resize(max_threads);
+    }
+}
+
+void Profiler::end_frame() {
+    if (!enabled) return;
+
+    for (int p = 0; p < PROFILE_PHASE_COUNT; ++p) {
+        history_[p][history_pos_] = static_cast<float>(frame_ns_[p] * 1e-6);
+    }
+    history_pos_ = (history_pos_ + 1) % HISTORY;
+    frames_recorded_ = std::min(frames_recorded_ + 1, HISTORY);
+
+    for (size_t t = 0; t < thread_ns_.size(); ++t) {
+        thread_ms_[t] = static_cast<float>(thread_ns_[t] * 1e-6);
+    }
+}
+
+void Profiler::record(ProfilePhase phase, int64_t start_ns, int64_t end_ns) {
+    frame_ns_[static_cast<int>(phase)] += static_cast<double>(end_ns - start_ns);
+
+    if (tracing_) {
+        trace_[0].push_back({phase, 0, start_ns, end_ns});
+    }
+}
+
+void Profiler::record_thread(ProfilePhase phase, int thread, int64_t start_ns, int64_t end_ns) {
+    if (thread >= static_cast<int>(thread_ns_.size())) return;
+
+    thread_ns_[thread] += end_ns - start_ns;
+
+    if (tracing_) {
+        trace_[thread].push_back({phase, thread, start_ns, end_ns});
+    }
+}
+
+void Profiler::record_neighbors(double mean_candidates, uint32_t max_candidates) {
+    mean_candidates_ = mean_candidates;
+    max_candidates_ = max_candidates;
+}
+
+float Profiler::last_ms(ProfilePhase phase) const {
+    int last = (history_pos_ + HISTORY - 1) % HISTORY;
+    return history_[static_cast<int>(phase)][last];
+}
+
+float Profiler::average_ms(ProfilePhase phase) const {
+    if (frames_recorded_ == 0) return 0.0f;
+
+    const std::vector<float>& h = history_[static_cast<int>(phase)];
+    float sum = 0.0f;
+    for (int i = 0; i < frames_recorded_; ++i) {
+        sum += h[(history_pos_ + HISTORY - 1 - i) % HISTORY];
+    }
+    return sum / frames_recorded_;
+}
+
+float Profiler::load_imbalance() const {
+    float max_ms = 0.0f;
+    float sum_ms = 0.0f;
+    int active = 0;
+    for (float ms : thread_ms_) {
+        if (ms <= 0.0f) continue;
+        max_ms = std::max(max_ms, ms);
+        sum_ms += ms;
+        active++;
+    }
+    return active > 0 && sum_ms > 0.0f ? max_ms / (sum_ms / active) : 1.0f;
+}
+
+void Profiler::start_trace() {
+    for (auto& events : trace_) {
+        events.clear();
+    }
+    trace_origin_ns_ = profiler_now_ns();
+    tracing_ = true;
+}
+
+void Profiler::stop_trace() {
+    tracing_ = false;
+}
+
+bool Profiler::write_chrome_trace(const std::string& path) const {
+    FILE* out = std::fopen(path.c_str(), "w");
+    if (!out) return false;
+
+    std::fprintf(out, "{\"traceEvents\": [\n");
+    bool first = true;
+    for (const auto& events : trace_) {
+        for (const TraceEvent& e : events) {
+            std::fprintf(out, "%s  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                         first ? "" : ",\n", profile_phase_name(e.phase), e.thread,
+                         (e.start_ns - trace_origin_ns_) * 1e-3, (e.end_ns - e.start_ns) * 1e-3);
+            first = false;
+        }
+    }
+    std::fprintf(out, "\n], \"displayTimeUnit\": \"ms\"}\n");
+    std::fclose(out);
+    return true;
+}
@@ -0,0 +1,107 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class ProfilePhase { Grid, Forces, Integrate, Mouse, Render, ImGui, Count };
+
+constexpr int PROFILE_PHASE_COUNT = static_cast<int>(ProfilePhase::Count);
+
+const char* profile_phase_name(ProfilePhase phase);
+
+inline int64_t profiler_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Collects per-phase wall time per frame into a rolling history, per-thread
+// busy time of the force pass, neighbor candidate counts, and optionally a
+// Chrome trace (chrome://tracing / Perfetto). Code under measurement holds a
+// Profiler pointer and pays one branch per scope when it is null or disabled.
+class Profiler {
+public:
+    static constexpr int HISTORY = 240;
+
+    bool enabled = false;
+    // Counting neighbor candidates costs a pass over the grid; benchmarks that
+    // only want phase times turn it off.
+    bool neighbor_stats = true;
+
+    Profiler();
+
+    void begin_frame();
+    void end_frame();
+
+    void record(ProfilePhase phase, int64_t start_ns, int64_t end_ns);
+    // Called from inside a parallel region by each worker thread.
+    void record_thread(ProfilePhase phase, int thread, int64_t start_ns, int64_t end_ns);
+    void record_neighbors(double mean_candidates, uint32_t max_candidates);
+    // Adds time measured elsewhere, e.g. by another thread's profiler.
+    void add_ms(ProfilePhase phase, double ms) { frame_ns_[static_cast<int>(phase)] += ms * 1e6; }
+
+    // Rolling history in milliseconds, HISTORY entries; the oldest sits at history_offset().
+    const float* history(ProfilePhase phase) const { return history_[static_cast<int>(phase)].data(); }
+    int history_offset() const { return history_pos_; }
+    float last_ms(ProfilePhase phase) const;
+    float average_ms(ProfilePhase phase) const;
+
+    // Busy time per thread in the last frame's force pass, and max / mean of it.
+    const std::vector<float>& thread_ms() const { return thread_ms_; }
+    float load_imbalance() const;
+
+    double mean_neighbor_candidates() const { return mean_candidates_; }
+    uint32_t max_neighbor_candidates() const { return max_candidates_; }
+
+    void start_trace();
+    void stop_trace();
+    bool tracing() const { return tracing_; }
+    bool write_chrome_trace(const std::string& path) const;
+
+private:
+    struct TraceEvent {
+        ProfilePhase phase;
+        int thread;
+        int64_t start_ns;
+        int64_t end_ns;
+    };
+
+    std::vector<std::vector<float>> history_;
+    int history_pos_ = 0;
+    int frames_recorded_ = 0;
+    double frame_ns_[PROFILE_PHASE_COUNT] = {};
+
+    std::vector<int64_t> thread_ns_;
+    std::vector<float> thread_ms_;
+
+    double mean_candidates_ = 0.0;
+    uint32_t max_candidates_ = 0;
+
+    bool tracing_ = false;
+    int64_t trace_origin_ns_ = 0;
+    // One event list per thread so workers can append without locking.
+    std::vector<std::vector<TraceEvent>> trace_;
+};
+
+class ProfileScope {
+public:
+    ProfileScope(Profiler* profiler, ProfilePhase phase)
+        : profiler_(profiler && profiler->enabled ? profiler : nullptr), phase_(phase),
+          start_ns_(profiler_ ? profiler_now_ns() : 0) {}
+
+    ~ProfileScope() {
+        if (profiler_) profiler_->record(phase_, start_ns_, profiler_now_ns());
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    Profiler* profiler_;
+    ProfilePhase phase_;
+    int64_t start_ns_;
+};
+
+#endif
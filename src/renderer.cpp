@@ -0,0 +1,153 @@
+#include "renderer.hpp"
+#include <cmath>
+
+std::vector<SDL_Color> make_type_palette(int count) {
+    std::vector<SDL_Color> palette(count);
+    const std::vector<Rgb8> colors = type_palette(count);
+    for (int t = 0; t < count; ++t) {
+        palette[t] = {colors[t].r, colors[t].g, colors[t].b, 255};
+    }
+    return palette;
+}
+
+SDL_Texture* create_circle_texture(SDL_Renderer* renderer, int radius) {
+    int diameter = radius * 2 + 2;
+    SDL_Surface* surface = SDL_CreateSurface(diameter, diameter, SDL_PIXELFORMAT_RGBA8888);
+
+    SDL_FillSurfaceRect(surface, nullptr, SDL_MapSurfaceRGBA(surface, 0, 0, 0, 0));
+
+    Uint32* pixels = (Uint32*)surface->pixels;
+    float center = diameter / 2.0f;
+
+    for (int y = 0; y < diameter; y++) {
+        for (int x = 0; x < diameter; x++) {
+            float dx = x - center + 0.5f;
+            float dy = y - center + 0.5f;
+            float dist = std::sqrt(dx*dx + dy*dy);
+
+            if (dist <= radius) {
+                float alpha = 1.0f;
+                if (dist > radius - 1.0f) {
+                    alpha = radius - dist;
+                }
+                Uint8 a = (Uint8)(alpha * 255);
+                pixels[y * diameter + x] = SDL_MapSurfaceRGBA(surface, 255, 255, 255, a);
+            }
+        }
+    }
+
+    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    SDL_DestroySurface(surface);
+
+    return texture;
+}
+
+ParticleRenderer::ParticleRenderer(SDL_Renderer* renderer) : renderer_(renderer) {
+    set_particle_size(2.0f);
+}
+
+ParticleRenderer::~ParticleRenderer() {
+    SDL_DestroyTexture(particle_texture_);
+    SDL_DestroyTexture(glow_texture_);
+    SDL_DestroyTexture(splat_texture_);
+}
+
+void ParticleRenderer::set_particle_size(float size) {
+    if (size == particle_size_ && particle_texture_) return;
+
+    SDL_DestroyTexture(particle_texture_);
+    SDL_DestroyTexture(glow_texture_);
+    particle_texture_ = create_circle_texture(renderer_, (int)size);
+    glow_texture_ = create_circle_texture(renderer_, (int)(size * 2));
+    SDL_SetTextureBlendMode(glow_texture_, SDL_BLENDMODE_ADD);
+    particle_size_ = size;
+}
+
+void ParticleRenderer::reserve_quads(size_t quads) {
+    vertices_.resize(quads * 4);
+
+    const size_t filled = indices_.size() / 6;
+    if (filled >= quads) return;
+
+    indices_.resize(quads * 6);
+    for (size_t q = filled; q < quads; ++q) {
+        const int v = static_cast<int>(q * 4);
+        int* out = indices_.data() + q * 6;
+        out[0] = v;
+        out[1] = v + 1;
+        out[2] = v + 2;
+        out[3] = v;
+        out[4] = v + 2;
+        out[5] = v + 3;
+    }
+}
+
+void ParticleRenderer::fill_layer(const RenderFrame& frame, const SDL_Color* colors, float scale_x, float scale_y,
+                                  float half_extent, float alpha) {
+    SDL_FColor palette[MAX_PARTICLE_TYPES];
+    for (int t = 0; t < frame.num_types; ++t) {
+        palette[t] = {colors[t].r / 255.0f, colors[t].g / 255.0f, colors[t].b / 255.0f, alpha};
+    }
+
+    const int n = static_cast<int>(frame.count);
+    const float* px = frame.x.data();
+    const float* py = frame.y.data();
+    const uint8_t* type = frame.type.data();
+    SDL_Vertex* out = vertices_.data();
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) {
+        const float cx = px[i] * scale_x;
+        const float cy = py[i] * scale_y;
+        const SDL_FColor color = palette[type[i]];
+        SDL_Vertex* v = out + 4 * static_cast<size_t>(i);
+
+        v[0] = {{cx - half_extent, cy - half_extent}, color, {0.0f, 0.0f}};
+        v[1] = {{cx + half_extent, cy - half_extent}, color, {1.0f, 0.0f}};
+        v[2] = {{cx + half_extent, cy + half_extent}, color, {1.0f, 1.0f}};
+        v[3] = {{cx - half_extent, cy + half_extent}, color, {0.0f, 1.0f}};
+    }
+}
+
+void ParticleRenderer::draw(const RenderFrame& frame, const SDL_Color* colors, float scale_x, float scale_y, bool glow) {
+    if (frame.count == 0) return;
+
+    reserve_quads(frame.count);
+    const int num_vertices = static_cast<int>(frame.count * 4);
+    const int num_indices = static_cast<int>(frame.count * 6);
+
+    // SDL copies the geometry into its command queue, so the same buffer is
+    // refilled for the second layer.
+    if (glow) {
+        fill_layer(frame, colors, scale_x, scale_y, particle_size_ * 2.0f, 60.0f / 255.0f);
+        SDL_RenderGeometry(renderer_, glow_texture_, vertices_.data(), num_vertices, indices_.data(), num_indices);
+    }
+
+    fill_layer(frame, colors, scale_x, scale_y, particle_size_, 1.0f);
+    SDL_RenderGeometry(renderer_, particle_texture_, vertices_.data(), num_vertices, indices_.data(), num_indices);
+}
+
+void ParticleRenderer::draw_splat(const RenderFrame& frame, const SDL_Color* colors, float scale_x, float scale_y,
+                                  int width, int height, bool glow, bool trail) {
+    if (!splat_texture_ || splat_.width() != width || splat_.height() != height) {
+        SDL_DestroyTexture(splat_texture_);
+        splat_texture_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, width, height);
+        splat_.resize(width, height);
+    }
+
+    Rgb8 palette[MAX_PARTICLE_TYPES];
+    for (int t = 0; t < frame.num_types; ++t) {
+        palette[t] = {colors[t].r, colors[t].g, colors[t].b};
+    }
+
+    splat_.particle_size = particle_size_;
+    splat_.glow = glow ? 0.8f : 0.0f;
+    splat_.glow_radius = static_cast<int>(particle_size_ * 3.0f);
+    splat_.trail_decay = trail ? 0.96f : 0.0f;
+    splat_.render(frame.x.data(), frame.y.data(), frame.type.data(), frame.count, frame.num_types,
+                  scale_x, scale_y, palette);
+
+    SDL_UpdateTexture(splat_texture_, nullptr, splat_.pixels(), width * 4);
+    SDL_RenderTexture(renderer_, splat_texture_, nullptr, nullptr);
+}
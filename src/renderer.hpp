@@ -0,0 +1,53 @@
+#ifndef RENDERER_HPP
+#define RENDERER_HPP
+
+#include <vector>
+#include <SDL3/SDL.h>
+#include "simulation_thread.hpp"
+#include "splat_renderer.hpp"
+
+SDL_Texture* create_circle_texture(SDL_Renderer* renderer, int radius);
+
+// type_palette() as opaque SDL colors.
+std::vector<SDL_Color> make_type_palette(int count);
+
+// Draws every particle as a textured quad tinted by its type through vertex
+// colors, so each layer (glow, body) is a single SDL_RenderGeometry call.
+// The vertex and index buffers persist between frames: indices are only
+// rewritten when the particle count grows, and vertices are filled in place
+// from the x/y/type arrays in parallel.
+class ParticleRenderer {
+public:
+    explicit ParticleRenderer(SDL_Renderer* renderer);
+    ~ParticleRenderer();
+
+    // Radius in pixels; rebuilds the circle textures when it changes.
+    void set_particle_size(float size);
+
+    // scale_x/scale_y map world coordinates to pixels; colors has one entry per type.
+    void draw(const RenderFrame& frame, const SDL_Color* colors, float scale_x, float scale_y, bool glow);
+
+    // Draws the frame with SplatRenderer at width x height and shows it as
+    // one streaming texture covering the target. Trails are kept by the
+    // splat renderer, so the target is cleared every frame.
+    void draw_splat(const RenderFrame& frame, const SDL_Color* colors, float scale_x, float scale_y,
+                    int width, int height, bool glow, bool trail);
+
+private:
+    void reserve_quads(size_t quads);
+    void fill_layer(const RenderFrame& frame, const SDL_Color* colors, float scale_x, float scale_y,
+                    float half_extent, float alpha);
+
+    SDL_Renderer* renderer_;
+    SDL_Texture* particle_texture_ = nullptr;
+    SDL_Texture* glow_texture_ = nullptr;
+    float particle_size_ = 0.0f;
+
+    std::vector<SDL_Vertex> vertices_;
+    std::vector<int> indices_;
+
+    SplatRenderer splat_;
+    SDL_Texture* splat_texture_ = nullptr;
+};
+
+#endif
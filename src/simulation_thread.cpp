@@ -0,0 +1,199 @@
+#include "simulation_thread.hpp"
+#include <algorithm>
+#include <chrono>
+
+SimulationThread::SimulationThread(ParticleSystem& particles) : particles_(particles) {}
+
+void SimulationThread::start() {
+    if (thread_.joinable()) return;
+
+    particles_.profiler = &profiler_;
+    particles_.analytics = &analytics_;
+    stop_requested_ = false;
+
+    const float no_phases[PROFILE_PHASE_COUNT] = {};
+    publish(0, no_phases);
+
+    thread_ = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop() {
+    if (!thread_.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_requested_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    particles_.profiler = nullptr;
+    particles_.analytics = nullptr;
+}
+
+uint64_t SimulationThread::submit(Command command) {
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        commands_.push_back(std::move(command));
+        sequence = ++submitted_;
+    }
+    wake_.notify_one();
+    return sequence;
+}
+
+void SimulationThread::set_brush(const Brush& brush) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    brush_ = brush;
+}
+
+void SimulationThread::clear_brush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    brush_.tool = BrushTool::None;
+}
+
+void SimulationThread::capture_trace(int steps, const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trace_steps_requested_ = steps;
+    trace_path_ = path;
+}
+
+const RenderFrame& SimulationThread::acquire_frame() {
+    if (middle_.load(std::memory_order_acquire) & FRESH_FRAME) {
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & 3;
+    }
+    return frames_[front_];
+}
+
+void SimulationThread::publish(int steps, const float* phase_ms) {
+    RenderFrame& frame = frames_[back_];
+    const size_t count = particles_.count;
+
+    frame.count = count;
+    frame.num_types = particles_.num_types;
+    frame.world_width = particles_.world_width();
+    frame.world_height = particles_.world_height();
+    frame.interaction_radius = particles_.interaction_radius;
+    frame.grid_reach = particles_.grid_reach();
+    frame.grid_churn = particles_.grid_stats().last_churn;
+    frame.grid_incremental = particles_.grid_stats().last_incremental;
+    frame.step = particles_.step_count;
+    frame.last_command = applied_;
+    // Up to 256 x 256 floats, so only copied when the rules changed.
+    if (frame.rules_version != particles_.rules_version()) {
+        std::span<const float> matrix = particles_.attraction_matrix();
+        frame.attraction_matrix.assign(matrix.begin(), matrix.end());
+        frame.rules_version = particles_.rules_version();
+    }
+
+    frame.x.assign(particles_.x.begin(), particles_.x.begin() + count);
+    frame.y.assign(particles_.y.begin(), particles_.y.begin() + count);
+    frame.type.assign(particles_.type.begin(), particles_.type.begin() + count);
+
+    frame.steps = steps;
+    std::copy(phase_ms, phase_ms + PROFILE_PHASE_COUNT, frame.phase_ms);
+    if (profiler_.enabled) {
+        frame.thread_ms = profiler_.thread_ms();
+        frame.load_imbalance = profiler_.load_imbalance();
+        frame.mean_neighbor_candidates = profiler_.mean_neighbor_candidates();
+        frame.max_neighbor_candidates = profiler_.max_neighbor_candidates();
+    }
+    if (frame.structure_samples != analytics_.samples()) {
+        frame.structure = analytics_.latest();
+        frame.structure_samples = analytics_.samples();
+    }
+
+    back_ = middle_.exchange(back_ | FRESH_FRAME, std::memory_order_acq_rel) & 3;
+}
+
+void SimulationThread::run() {
+    using clock = std::chrono::steady_clock;
+
+    std::vector<Command> pending;
+    int trace_steps_left = 0;
+    std::string trace_path;
+
+    double accumulator = 0.0;
+    auto last = clock::now();
+    auto rate_start = last;
+    int rate_steps = 0;
+    std::chrono::duration<double> wait(0.0);
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (wait.count() > 0.0) {
+                wake_.wait_for(lock, wait, [&] { return stop_requested_ || !commands_.empty(); });
+            }
+            if (stop_requested_) break;
+
+            pending.swap(commands_);
+            applied_ = submitted_;
+            particles_.brush = brush_;
+
+            if (trace_steps_requested_ > 0) {
+                trace_steps_left = trace_steps_requested_;
+                trace_path = trace_path_;
+                trace_steps_requested_ = 0;
+                profiler_.start_trace();
+            }
+        }
+
+        const bool changed = !pending.empty();
+        for (Command& command : pending) {
+            command(particles_);
+        }
+        pending.clear();
+
+        const auto now = clock::now();
+        const float current_speed = speed.load();
+        accumulator += std::chrono::duration<double>(now - last).count() * current_speed;
+        last = now;
+
+        profiler_.enabled = profiling_.load() || trace_steps_left > 0;
+        analytics_.every = analytics_every_.load();
+        float phase_ms[PROFILE_PHASE_COUNT] = {};
+        int steps = 0;
+
+        while (accumulator >= fixed_dt && steps < max_substeps) {
+            profiler_.begin_frame();
+            particles_.update(fixed_dt);
+            profiler_.end_frame();
+
+            if (profiler_.enabled) {
+                for (int p = 0; p < PROFILE_PHASE_COUNT; ++p) {
+                    phase_ms[p] += profiler_.last_ms(static_cast<ProfilePhase>(p));
+                }
+            }
+
+            if (trace_steps_left > 0 && --trace_steps_left == 0) {
+                profiler_.stop_trace();
+                profiler_.write_chrome_trace(trace_path);
+            }
+
+            accumulator -= fixed_dt;
+            steps++;
+        }
+
+        // Falling behind: drop the backlog instead of trying to catch up,
+        // which would only make the next iteration slower still.
+        if (steps == max_substeps) {
+            accumulator = std::min(accumulator, static_cast<double>(fixed_dt));
+        }
+
+        if (steps > 0 || changed) {
+            publish(steps, phase_ms);
+        }
+
+        rate_steps += steps;
+        const double rate_window = std::chrono::duration<double>(now - rate_start).count();
+        if (rate_window >= 1.0) {
+            steps_per_second_.store(rate_steps / rate_window);
+            rate_steps = 0;
+            rate_start = now;
+        }
+
+        wait = current_speed > 0.0f
+            ? std::chrono::duration<double>((fixed_dt - accumulator) / current_speed)
+            : std::chrono::duration<double>(0.05);
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef SIMULATION_THREAD_HPP
+#define SIMULATION_THREAD_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "particle_system.hpp"
+#include "profiler.hpp"
+
+// What the display needs from one published simulation state.
+struct RenderFrame {
+    size_t count = 0;
+    int num_types = 0;
+    float world_width = 1.0f;
+    float world_height = 1.0f;
+    float interaction_radius = 0.0f;
+    int grid_reach = 1;
+    uint64_t step = 0;
+    // Sequence number of the last command applied before this frame.
+    uint64_t last_command = 0;
+    // num_types x num_types, row-major, as of rules_version.
+    std::vector<float> attraction_matrix;
+    uint64_t rules_version = 0;
+
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<uint8_t> type;
+
+    // Steps taken since the previous frame, their summed phase times, and the
+    // force pass statistics of the last of them (filled when profiling).
+    int steps = 0;
+    float phase_ms[PROFILE_PHASE_COUNT] = {};
+    std::vector<float> thread_ms;
+    float load_imbalance = 1.0f;
+    double mean_neighbor_candidates = 0.0;
+    uint32_t max_neighbor_candidates = 0;
+    // Fraction of particles that changed cells in the last step, and whether
+    // the grid was patched rather than rebuilt for it.
+    float grid_churn = 0.0f;
+    bool grid_incremental = false;
+
+    // The newest structure sample and how many have been taken; only copied
+    // when a new one arrived.
+    StructureStats structure;
+    uint64_t structure_samples = 0;
+};
+
+// Steps a ParticleSystem on its own thread with a fixed timestep: wall time
+// scaled by speed feeds an accumulator that is drained in fixed_dt steps, at
+// most max_substeps per iteration. After stepping it publishes a RenderFrame
+// through a lock-free triple buffer, so the display always reads the newest
+// complete state without waiting for the simulation or blocking it.
+//
+// Once started, the thread owns the ParticleSystem; everything else reaches
+// it through submit(), whose commands run between steps in submission order.
+class SimulationThread {
+public:
+    using Command = std::function<void(ParticleSystem&)>;
+
+    explicit SimulationThread(ParticleSystem& particles);
+    ~SimulationThread() { stop(); }
+
+    float fixed_dt = 0.016f;
+    int max_substeps = 8;
+    // Simulated seconds per wall second; 0 pauses stepping but still runs commands.
+    std::atomic<float> speed{1.0f};
+
+    void start();
+    void stop();
+
+    // Returns the command's sequence number; RenderFrame::last_command reaches
+    // it once the command has been applied.
+    uint64_t submit(Command command);
+
+    // Applied every step until cleared; replaces the previous brush.
+    void set_brush(const Brush& brush);
+    void clear_brush();
+
+    void set_profiling(bool enabled) { profiling_.store(enabled); }
+    // Structure analytics every `every` steps, 0 = off.
+    void set_analytics_every(int every) { analytics_every_.store(every); }
+    // Records a Chrome trace of the next `steps` steps and writes it to path.
+    void capture_trace(int steps, const std::string& path);
+
+    // The newest published frame; valid until the next call. UI thread only.
+    const RenderFrame& acquire_frame();
+
+    double steps_per_second() const { return steps_per_second_.load(); }
+
+private:
+    void run();
+    void publish(int steps, const float* phase_ms);
+
+    ParticleSystem& particles_;
+    Profiler profiler_;
+    StructureAnalytics analytics_;
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_requested_ = false;
+    std::vector<Command> commands_;
+    uint64_t submitted_ = 0;
+    // Commands taken off the queue so far; simulation thread only.
+    uint64_t applied_ = 0;
+    Brush brush_;
+    int trace_steps_requested_ = 0;
+    std::string trace_path_;
+
+    std::atomic<bool> profiling_{false};
+    std::atomic<int> analytics_every_{0};
+    std::atomic<double> steps_per_second_{0.0};
+
+    // Triple buffer: the simulation writes frames_[back_], the display reads
+    // frames_[front_], and middle_ holds the index in between, tagged with
+    // FRESH_FRAME when it has not been picked up yet.
+    static constexpr int FRESH_FRAME = 4;
+    RenderFrame frames_[3];
+    int back_ = 0;
+    std::atomic<int> middle_{1};
+    int front_ = 2;
+};
+
+#endif
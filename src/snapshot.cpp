@@ -0,0 +1,507 @@
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char SNAPSHOT_MAGIC[8] = {'N', 'U', 'C', 'S', 'N', 'A', 'P', '1'};
+static const char TRAJECTORY_MAGIC[8] = {'N', 'U', 'C', 'T', 'R', 'A', 'J', '1'};
+static const uint32_t FRAME_MAGIC = 0x4d415246; // "FRAM"
+static const uint32_t SNAPSHOT_VERSION = 5;
+static const uint32_t TRAJECTORY_VERSION = 1;
+
+const char* trajectory_encoding_name(TrajectoryEncoding encoding) {
+    switch (encoding) {
+        case TrajectoryEncoding::Raw: return "raw";
+        case TrajectoryEncoding::Quantized: return "quantized";
+        case TrajectoryEncoding::Delta: return "delta";
+    }
+    return "unknown";
+}
+
+template <typename T>
+static bool write_block(FILE* file, const T* data, size_t count) {
+    return std::fwrite(data, sizeof(T), count, file) == count;
+}
+
+template <typename T>
+static bool read_block(FILE* file, T* data, size_t count) {
+    return std::fread(data, sizeof(T), count, file) == count;
+}
+
+bool save_snapshot(const ParticleSystem& particles, const std::string& path, std::string& error) {
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.num_types = static_cast<uint32_t>(particles.num_types);
+    header.count = particles.count;
+    header.seed = particles.seed;
+    header.step_count = particles.step_count;
+    header.world_width = particles.world_width();
+    header.world_height = particles.world_height();
+    header.interaction_radius = particles.interaction_radius;
+    header.cell_size = particles.cell_size;
+    header.grid_reach = static_cast<uint32_t>(particles.grid_reach());
+    header.force_law = particles.force_law;
+    header.beta = particles.beta;
+    header.quantize_coefficients = particles.quantize_coefficients ? 1 : 0;
+    header.id_limit = particles.id_limit();
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        error = "cannot write snapshot '" + path + "'";
+        return false;
+    }
+
+    const size_t n = particles.count;
+    const size_t types = static_cast<size_t>(particles.num_types);
+    bool ok = write_block(file, &header, 1) &&
+              write_block(file, particles.attraction_matrix().data(), types * types) &&
+              write_block(file, particles.type_radius.data(), types) &&
+              write_block(file, particles.type_mass.data(), types) &&
+              write_block(file, particles.x.data(), n) &&
+              write_block(file, particles.y.data(), n) &&
+              write_block(file, particles.vx.data(), n) &&
+              write_block(file, particles.vy.data(), n) &&
+              write_block(file, particles.type.data(), n) &&
+              write_block(file, particles.id.data(), n) &&
+              write_block(file, particles.lifetime.data(), n) &&
+              write_block(file, particles.free_ids.data(), particles.free_ids.size());
+    ok = std::fclose(file) == 0 && ok;
+
+    if (!ok) error = "error writing snapshot '" + path + "'";
+    return ok;
+}
+
+// Header bytes written by each snapshot version.
+static size_t header_size(uint32_t version) {
+    switch (version) {
+        case 1: return offsetof(SnapshotHeader, interaction_radius);
+        case 2: return offsetof(SnapshotHeader, force_law);
+        case 3: return offsetof(SnapshotHeader, quantize_coefficients);
+        case 4: return offsetof(SnapshotHeader, id_limit);
+        default: return sizeof(SnapshotHeader);
+    }
+}
+
+bool load_snapshot(ParticleSystem& particles, const std::string& path, std::string& error) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        error = "cannot open snapshot '" + path + "'";
+        return false;
+    }
+
+    // Version 1 headers end before interaction_radius; those runs used a
+    // fixed 80 radius and cell size. Version 2 headers end before force_law;
+    // those runs used the constant law.
+    const size_t v1_size = offsetof(SnapshotHeader, interaction_radius);
+    SnapshotHeader header{};
+    header.interaction_radius = 80.0f;
+    header.cell_size = 80.0f;
+    header.grid_reach = 1;
+    header.force_law = ForceLaw::Constant;
+    header.beta = 0.3f;
+    header.id_limit = 0;
+
+    auto* raw = reinterpret_cast<unsigned char*>(&header);
+    if (!read_block(file, raw, v1_size) || std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version < 1 || header.version > SNAPSHOT_VERSION || header.num_types < 1 ||
+        header.num_types > (header.version >= 4 ? MAX_PARTICLE_TYPES : 10) ||
+        !read_block(file, raw + v1_size, header_size(header.version) - v1_size) ||
+        header.force_law > ForceLaw::SmoothStep || !(header.beta > 0.0f && header.beta < 1.0f) ||
+        (header.version >= 5 && (header.id_limit < header.count || header.id_limit > UINT32_MAX))) {
+        std::fclose(file);
+        error = "'" + path + "' is not a snapshot";
+        return false;
+    }
+
+    particles.cleanup();
+    particles.seed = header.seed;
+    particles.interaction_radius = header.interaction_radius;
+    particles.cell_size = header.cell_size;
+    particles.force_law = header.force_law;
+    particles.beta = header.beta;
+    particles.quantize_coefficients = header.quantize_coefficients != 0;
+    particles.init(header.count, static_cast<int>(header.num_types), header.world_width, header.world_height);
+    particles.set_grid_reach(static_cast<int>(header.grid_reach));
+    particles.step_count = header.step_count;
+
+    const int types = particles.num_types;
+    std::vector<float> matrix(static_cast<size_t>(types) * types);
+    bool ok = true;
+    if (header.version >= 4) {
+        ok = read_block(file, matrix.data(), matrix.size()) &&
+             read_block(file, particles.type_radius.data(), particles.type_radius.size()) &&
+             read_block(file, particles.type_mass.data(), particles.type_mass.size());
+    } else {
+        for (int i = 0; i < types; ++i) {
+            std::copy(header.matrix[i], header.matrix[i] + types, matrix.begin() + i * types);
+        }
+    }
+    for (int i = 0; i < types; ++i) {
+        for (int j = 0; j < types; ++j) {
+            particles.set_attraction(i, j, matrix[i * types + j]);
+        }
+    }
+
+    const size_t n = particles.count;
+    ok = ok &&
+         read_block(file, particles.x.data(), n) &&
+         read_block(file, particles.y.data(), n) &&
+         read_block(file, particles.vx.data(), n) &&
+         read_block(file, particles.vy.data(), n) &&
+         read_block(file, particles.type.data(), n) &&
+         read_block(file, particles.id.data(), n);
+    const size_t id_limit = header.version >= 5 ? header.id_limit : n;
+    if (header.version >= 5) {
+        particles.free_ids.resize(id_limit - n);
+        ok = ok &&
+             read_block(file, particles.lifetime.data(), n) &&
+             read_block(file, particles.free_ids.data(), particles.free_ids.size());
+        particles.lifetimes_changed();
+    }
+    std::fclose(file);
+
+    if (!ok) {
+        error = "snapshot '" + path + "' is truncated";
+        return false;
+    }
+
+    for (int t = 0; t < types; ++t) {
+        if (!(particles.type_radius[t] > 0.0f && particles.type_radius[t] <= 1.0f) || !(particles.type_mass[t] > 0.0f)) {
+            error = "snapshot '" + path + "' is corrupt";
+            return false;
+        }
+    }
+    // Every id below the limit is either in exactly one slot or free.
+    particles.slot_of_id.assign(id_limit, INVALID_SLOT);
+    for (size_t i = 0; i < n; ++i) {
+        const uint32_t id = particles.id[i];
+        if (id >= id_limit || particles.slot_of_id[id] != INVALID_SLOT || particles.type[i] >= header.num_types ||
+            std::isnan(particles.lifetime[i])) {
+            error = "snapshot '" + path + "' is corrupt";
+            return false;
+        }
+        particles.slot_of_id[id] = static_cast<uint32_t>(i);
+    }
+    std::vector<bool> freed(id_limit);
+    for (uint32_t id : particles.free_ids) {
+        if (id >= id_limit || particles.slot_of_id[id] != INVALID_SLOT || freed[id]) {
+            error = "snapshot '" + path + "' is corrupt";
+            return false;
+        }
+        freed[id] = true;
+    }
+    return true;
+}
+
+// Fixed point over one period of the torus; a position equal to the world
+// size maps to 65536, which wraps to 0, the same point.
+static inline uint16_t quantize(float value, float scale) {
+    return static_cast<uint16_t>(static_cast<uint32_t>(std::lround(value * scale)));
+}
+
+static inline uint32_t zigzag(int16_t delta) {
+    return static_cast<uint16_t>((delta << 1) ^ (delta >> 15));
+}
+
+static inline int16_t unzigzag(uint32_t value) {
+    return static_cast<int16_t>((value >> 1) ^ (0u - (value & 1)));
+}
+
+bool TrajectoryWriter::open(const std::string& path, const ParticleSystem& particles, TrajectoryEncoding encoding,
+                            uint32_t keyframe_interval, std::string& error) {
+    close();
+
+    // Frames are indexed by id, so the population has to stay fixed.
+    if (particles.id_limit() != particles.count || particles.emit_rate > 0) {
+        error = "trajectories need a fixed population";
+        return false;
+    }
+
+    file_ = std::fopen(path.c_str(), "wb");
+    if (!file_) {
+        error = "cannot write trajectory '" + path + "'";
+        return false;
+    }
+
+    header_ = {};
+    std::memcpy(header_.magic, TRAJECTORY_MAGIC, sizeof(header_.magic));
+    header_.version = TRAJECTORY_VERSION;
+    header_.encoding = encoding;
+    header_.count = particles.count;
+    header_.num_types = static_cast<uint32_t>(particles.num_types);
+    header_.keyframe_interval = std::max(1u, keyframe_interval);
+    header_.world_width = particles.world_width();
+    header_.world_height = particles.world_height();
+    frames_written_ = 0;
+
+    std::vector<uint8_t> types(particles.count);
+    for (size_t n = 0; n < particles.count; ++n) {
+        types[n] = particles.type[particles.slot_of_id[n]];
+    }
+
+    if (!write_block(file_, &header_, 1) || !write_block(file_, types.data(), types.size())) {
+        close();
+        error = "error writing trajectory '" + path + "'";
+        return false;
+    }
+    bytes_written_ = sizeof(header_) + types.size();
+    return true;
+}
+
+bool TrajectoryWriter::write_frame(const ParticleSystem& particles) {
+    if (!file_ || particles.count != header_.count || particles.id_limit() != header_.count) return false;
+
+    const int n = static_cast<int>(header_.count);
+    const uint32_t* slot_of_id = particles.slot_of_id.data();
+
+    TrajectoryFrameHeader frame{};
+    frame.magic = FRAME_MAGIC;
+    frame.step = particles.step_count;
+
+    const void* payload = nullptr;
+
+    if (header_.encoding == TrajectoryEncoding::Raw) {
+        raw_.resize(2 * header_.count);
+
+#pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            raw_[i] = particles.x[slot_of_id[i]];
+            raw_[n + i] = particles.y[slot_of_id[i]];
+        }
+
+        frame.kind = TrajectoryFrameKind::Raw;
+        frame.payload_bytes = raw_.size() * sizeof(float);
+        payload = raw_.data();
+    } else {
+        const float scale_x = 65536.0f / header_.world_width;
+        const float scale_y = 65536.0f / header_.world_height;
+        q_.resize(2 * header_.count);
+
+#pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            q_[i] = quantize(particles.x[slot_of_id[i]], scale_x);
+            q_[n + i] = quantize(particles.y[slot_of_id[i]], scale_y);
+        }
+
+        const bool keyframe = header_.encoding == TrajectoryEncoding::Quantized ||
+                              frames_written_ % header_.keyframe_interval == 0;
+
+        if (keyframe) {
+            frame.kind = TrajectoryFrameKind::Key;
+            frame.payload_bytes = q_.size() * sizeof(uint16_t);
+            payload = q_.data();
+        } else {
+            // Varints are at most three bytes for a 16-bit zigzag value.
+            payload_.resize(3 * q_.size());
+            uint8_t* out = payload_.data();
+            for (size_t i = 0; i < q_.size(); ++i) {
+                uint32_t value = zigzag(static_cast<int16_t>(q_[i] - prev_q_[i]));
+                while (value >= 0x80) {
+                    *out++ = static_cast<uint8_t>(value | 0x80);
+                    value >>= 7;
+                }
+                *out++ = static_cast<uint8_t>(value);
+            }
+
+            frame.kind = TrajectoryFrameKind::Delta;
+            frame.payload_bytes = static_cast<uint64_t>(out - payload_.data());
+            payload = payload_.data();
+        }
+
+        if (header_.encoding == TrajectoryEncoding::Delta) {
+            prev_q_.swap(q_);
+        }
+    }
+
+    if (!write_block(file_, &frame, 1) ||
+        !write_block(file_, static_cast<const uint8_t*>(payload), frame.payload_bytes)) {
+        return false;
+    }
+    std::fflush(file_);
+
+    frames_written_++;
+    bytes_written_ += sizeof(frame) + frame.payload_bytes;
+    return true;
+}
+
+void TrajectoryWriter::close() {
+    if (file_) {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+bool TrajectoryReader::open(const std::string& path, std::string& error) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error = "cannot open trajectory '" + path + "'";
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    size_ = static_cast<size_t>(file_size.QuadPart);
+
+    HANDLE mapping = size_ > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    file_handle_ = file;
+    mapping_handle_ = mapping;
+    if (!view) {
+        close();
+        error = "cannot map trajectory '" + path + "'";
+        return false;
+    }
+    data_ = static_cast<const uint8_t*>(view);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open trajectory '" + path + "'";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        error = "'" + path + "' is not a trajectory";
+        return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+
+    void* view = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        size_ = 0;
+        error = "cannot map trajectory '" + path + "'";
+        return false;
+    }
+    madvise(view, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const uint8_t*>(view);
+#endif
+
+    if (size_ < sizeof(header_)) {
+        close();
+        error = "'" + path + "' is not a trajectory";
+        return false;
+    }
+    std::memcpy(&header_, data_, sizeof(header_));
+
+    const size_t types_end = sizeof(header_) + header_.count;
+    if (std::memcmp(header_.magic, TRAJECTORY_MAGIC, sizeof(header_.magic)) != 0 ||
+        header_.version != TRAJECTORY_VERSION || header_.num_types < 1 || header_.num_types > MAX_PARTICLE_TYPES ||
+        types_end > size_) {
+        close();
+        error = "'" + path + "' is not a trajectory";
+        return false;
+    }
+    types_ = data_ + sizeof(header_);
+
+    size_t offset = types_end;
+    size_t keyframe = 0;
+    while (offset + sizeof(TrajectoryFrameHeader) <= size_) {
+        TrajectoryFrameHeader frame;
+        std::memcpy(&frame, data_ + offset, sizeof(frame));
+        const size_t payload = offset + sizeof(frame);
+        if (frame.magic != FRAME_MAGIC || frame.payload_bytes > size_ - payload) break;
+
+        if (frame.kind != TrajectoryFrameKind::Delta) {
+            keyframe = frames_.size();
+        } else if (frames_.empty()) {
+            break;
+        }
+        frames_.push_back({frame.kind, frame.step, payload, static_cast<size_t>(frame.payload_bytes), keyframe});
+        offset = payload + frame.payload_bytes;
+    }
+    return true;
+}
+
+void TrajectoryReader::close() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_handle_) CloseHandle(mapping_handle_);
+    if (file_handle_) CloseHandle(file_handle_);
+    file_handle_ = nullptr;
+    mapping_handle_ = nullptr;
+#else
+    if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    types_ = nullptr;
+    frames_.clear();
+    decoded_frame_ = SIZE_MAX;
+}
+
+bool TrajectoryReader::decode_delta(const FrameEntry& entry) {
+    const uint8_t* in = data_ + entry.offset;
+    const uint8_t* end = in + entry.bytes;
+
+    for (uint16_t& q : q_) {
+        uint32_t value = 0;
+        int shift = 0;
+        while (true) {
+            if (in == end || shift > 14) return false;
+            uint8_t byte = *in++;
+            value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+            shift += 7;
+        }
+        q = static_cast<uint16_t>(q + unzigzag(value));
+    }
+    return true;
+}
+
+bool TrajectoryReader::read_frame(size_t frame, float* x, float* y) {
+    if (frame >= frames_.size()) return false;
+
+    const FrameEntry& entry = frames_[frame];
+    const int n = static_cast<int>(header_.count);
+
+    if (entry.kind == TrajectoryFrameKind::Raw) {
+        if (entry.bytes != 2 * header_.count * sizeof(float)) return false;
+        std::memcpy(x, data_ + entry.offset, header_.count * sizeof(float));
+        std::memcpy(y, data_ + entry.offset + header_.count * sizeof(float), header_.count * sizeof(float));
+        return true;
+    }
+
+    if (decoded_frame_ == SIZE_MAX || decoded_frame_ > frame || decoded_frame_ < entry.keyframe) {
+        const FrameEntry& key = frames_[entry.keyframe];
+        if (key.bytes != 2 * header_.count * sizeof(uint16_t)) return false;
+        q_.resize(2 * header_.count);
+        std::memcpy(q_.data(), data_ + key.offset, key.bytes);
+        decoded_frame_ = entry.keyframe;
+    }
+
+    while (decoded_frame_ < frame) {
+        const FrameEntry& next = frames_[decoded_frame_ + 1];
+        if (next.kind != TrajectoryFrameKind::Delta || !decode_delta(next)) {
+            decoded_frame_ = SIZE_MAX;
+            return false;
+        }
+        decoded_frame_++;
+    }
+
+    const float scale_x = header_.world_width / 65536.0f;
+    const float scale_y = header_.world_height / 65536.0f;
+
+#pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        x[i] = q_[i] * scale_x;
+        y[i] = q_[n + i] * scale_y;
+    }
+    return true;
+}
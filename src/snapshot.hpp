@@ -0,0 +1,152 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "particle_system.hpp"
+
+// All integers and floats are written in host byte order.
+
+// A snapshot is a SnapshotHeader, then (from version 4) the num_types x
+// num_types attraction matrix and the per-type radius and mass (float), then
+// raw x, y, vx, vy (float), type (uint8) and id (uint32) blocks of
+// header.count entries each, in slot order, then (from version 5) the
+// lifetime (float) block and the id_limit - count free ids (uint32) in free
+// list order, so a loaded run continues bitwise identically to the saved one.
+// Verlet runs are the exception: their neighbor lists are not saved, and
+// rebuilding them (with the cell reorder that comes with it) at the loaded
+// step changes slot and summation order from there on.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_types;
+    uint64_t count;
+    uint64_t seed;
+    uint64_t step_count;
+    float world_width;
+    float world_height;
+    // Versions 1 to 3, which allowed at most 10 types.
+    float matrix[10][10];
+    // Version 2 and later; version 1 files load with the defaults.
+    float interaction_radius;
+    float cell_size;
+    uint32_t grid_reach;
+    uint32_t reserved;
+    // Version 3 and later.
+    ForceLaw force_law;
+    float beta;
+    // Version 4 and later.
+    uint32_t quantize_coefficients;
+    uint32_t reserved_v4;
+    // Version 5 and later; older files have ids 0 to count - 1.
+    uint64_t id_limit;
+};
+
+bool save_snapshot(const ParticleSystem& particles, const std::string& path, std::string& error);
+// Reinitializes particles with the counts, world size, interaction radius,
+// grid layout, force law, rules, type traits and state stored in the file.
+bool load_snapshot(ParticleSystem& particles, const std::string& path, std::string& error);
+
+// Raw frames hold float positions. Quantized frames hold 16-bit fixed point
+// positions on the torus (world / 65536 resolution). Delta writes a quantized
+// keyframe every keyframe_interval frames and in between zigzag varint deltas
+// against the previous frame, taken modulo 65536 so crossing the seam is a
+// small step too.
+enum class TrajectoryEncoding : uint32_t { Raw, Quantized, Delta };
+
+const char* trajectory_encoding_name(TrajectoryEncoding encoding);
+
+// Append-only stream of positions in id order, so frames line up across
+// spatial sorting: a TrajectoryHeader, the particle types, then frames of
+// TrajectoryFrameHeader + payload. A reader stops at the first incomplete
+// frame, so a file can be replayed while it is still being written.
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    TrajectoryEncoding encoding;
+    uint64_t count;
+    uint32_t num_types;
+    uint32_t keyframe_interval;
+    float world_width;
+    float world_height;
+};
+
+enum class TrajectoryFrameKind : uint32_t { Raw, Key, Delta };
+
+struct TrajectoryFrameHeader {
+    uint32_t magic;
+    TrajectoryFrameKind kind;
+    uint64_t step;
+    uint64_t payload_bytes;
+};
+
+class TrajectoryWriter {
+public:
+    ~TrajectoryWriter() { close(); }
+
+    bool open(const std::string& path, const ParticleSystem& particles, TrajectoryEncoding encoding,
+              uint32_t keyframe_interval, std::string& error);
+    bool write_frame(const ParticleSystem& particles);
+    void close();
+    bool is_open() const { return file_ != nullptr; }
+    uint64_t frames_written() const { return frames_written_; }
+    uint64_t bytes_written() const { return bytes_written_; }
+
+private:
+    FILE* file_ = nullptr;
+    TrajectoryHeader header_{};
+    uint64_t frames_written_ = 0;
+    uint64_t bytes_written_ = 0;
+    std::vector<float> raw_;
+    std::vector<uint16_t> q_;
+    std::vector<uint16_t> prev_q_;
+    std::vector<uint8_t> payload_;
+};
+
+// Memory-maps a trajectory and decodes frames on demand. Playing forward
+// continues from the last decoded frame; any other seek decodes from the
+// nearest keyframe at or before the target.
+class TrajectoryReader {
+public:
+    ~TrajectoryReader() { close(); }
+
+    bool open(const std::string& path, std::string& error);
+    void close();
+
+    const TrajectoryHeader& header() const { return header_; }
+    // Particle types in id order, header().count entries.
+    const uint8_t* types() const { return types_; }
+    size_t frame_count() const { return frames_.size(); }
+    uint64_t frame_step(size_t frame) const { return frames_[frame].step; }
+
+    // Writes the positions of frame into x and y (header().count entries each).
+    bool read_frame(size_t frame, float* x, float* y);
+
+private:
+    struct FrameEntry {
+        TrajectoryFrameKind kind;
+        uint64_t step;
+        size_t offset;
+        size_t bytes;
+        size_t keyframe;
+    };
+
+    bool decode_delta(const FrameEntry& entry);
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_handle_ = nullptr;
+    void* mapping_handle_ = nullptr;
+#endif
+
+    TrajectoryHeader header_{};
+    const uint8_t* types_ = nullptr;
+    std::vector<FrameEntry> frames_;
+    std::vector<uint16_t> q_;
+    size_t decoded_frame_ = SIZE_MAX;
+};
+
+#endif
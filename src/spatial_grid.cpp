@@ -1,92 +1,356 @@
 #include "spatial_grid.hpp"
+#include <algorithm>
 #include <cmath>
+#include <omp.h>
 
-SpatialGrid::SpatialGrid(float width, float height, float cell_size)
-    : width_(width), height_(height), cell_size_(cell_size) {
+// Cell blocks per thread in insert_cells, enough to even out clusters.
+constexpr int INSERT_BLOCKS_PER_THREAD = 8;
+// Cells per block in update_cells; a block is merged by one thread.
+constexpr int UPDATE_BLOCK_CELLS = 1024;
 
-    grid_width_ = static_cast<int>(std::ceil(width / cell_size));
-    grid_height_ = static_cast<int>(std::ceil(height / cell_size));
+SpatialGrid::SpatialGrid(float width, float height, float cell_size, int reach)
+    : width_(width), height_(height), cell_size_(cell_size), reach_(std::clamp(reach, 1, MAX_GRID_REACH)) {
 
-    cells_.resize(grid_width_ * grid_height_);
+    grid_width_ = std::max(1, static_cast<int>(width / cell_size));
+    grid_height_ = std::max(1, static_cast<int>(height / cell_size));
+    inv_cell_width_ = grid_width_ / width;
+    inv_cell_height_ = grid_height_ / height;
+
+    cell_start_.assign(grid_width_ * grid_height_ + 1, 0);
 }
 
 void SpatialGrid::clear() {
-    for (auto& cell : cells_) {
-        cell.clear();
-    }
+    std::fill(cell_start_.begin(), cell_start_.end(), 0);
+    cell_indices_.clear();
+    identity_order_ = false;
 }
 
-void SpatialGrid::insert(size_t particle_idx, float x, float y) {
-    int cell_x = get_cell_x(x);
-    int cell_y = get_cell_y(y);
+void SpatialGrid::mark_sorted() {
+    const int n = static_cast<int>(cell_indices_.size());
+    const int cells = num_cells();
 
-    if (cell_x >= 0 && cell_x < grid_width_ && cell_y >= 0 && cell_y < grid_height_) {
-        int idx = get_cell_index(cell_x, cell_y);
-        cells_[idx].push_back(particle_idx);
+#pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        cell_indices_[i] = static_cast<uint32_t>(i);
     }
+
+    // The slots were permuted into cell order, so slot k lies in the cell
+    // whose range holds k.
+    particle_cell_.resize(n);
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int c = 0; c < cells; ++c) {
+        for (uint32_t k = cell_start_[c]; k < cell_start_[c + 1]; ++k) {
+            particle_cell_[k] = static_cast<uint32_t>(c);
+        }
+    }
+    identity_order_ = true;
 }
 
-void SpatialGrid::query_neighbors(float x, float y, std::vector<size_t>& neighbors) {
-    neighbors.clear();
+int SpatialGrid::neighbor_cells(int cell_idx, int* out) const {
+    int n = 0;
+    for_each_neighbor_cell(cell_idx, [&](int neighbor) { out[n++] = neighbor; });
+    return n;
+}
 
-    int cell_x = get_cell_x(x);
-    int cell_y = get_cell_y(y);
+int SpatialGrid::neighbor_ranges(int cell_idx, uint32_t* begin, uint32_t* end) const {
+    int n = 0;
+    for_each_neighbor_cell(cell_idx, [&](int neighbor) {
+        const uint32_t first = cell_start_[neighbor];
+        const uint32_t last = cell_start_[neighbor + 1];
+        if (first == last) return;
 
-    for (int dy = -1; dy <= 1; ++dy) {
-        for (int dx = -1; dx <= 1; ++dx) {
-            int nx = cell_x + dx;
-            int ny = cell_y + dy;
+        if (n > 0 && end[n - 1] == first) {
+            end[n - 1] = last;
+        } else {
+            begin[n] = first;
+            end[n] = last;
+            ++n;
+        }
+    });
+    return n;
+}
 
-            if (nx >= 0 && nx < grid_width_ && ny >= 0 && ny < grid_height_) {
-                int idx = get_cell_index(nx, ny);
-                for (size_t particle_idx : cells_[idx]) {
-                    neighbors.push_back(particle_idx);
-                }
-            }
+double SpatialGrid::mean_neighbor_candidates() const {
+    const int cells = num_cells();
+    const size_t count = cell_indices_.size();
+    uint64_t total = 0;
+
+#pragma omp parallel for schedule(dynamic, 64) reduction(+ : total)
+    for (int c = 0; c < cells; ++c) {
+        const uint64_t occupancy = cell_start_[c + 1] - cell_start_[c];
+        if (occupancy == 0) continue;
+
+        uint64_t candidates = 0;
+        for_each_neighbor_cell(c, [&](int neighbor) {
+            candidates += cell_start_[neighbor + 1] - cell_start_[neighbor];
+        });
+        total += occupancy * candidates;
+    }
+
+    return count > 0 ? static_cast<double>(total) / count : 0.0;
+}
+
+void SpatialGrid::cells_in_radius(float x, float y, float radius, std::vector<int>& out) const {
+    out.clear();
+
+    const int reach_x = static_cast<int>(std::ceil(radius * inv_cell_width_));
+    const int reach_y = static_cast<int>(std::ceil(radius * inv_cell_height_));
+    const int span_x = std::min(2 * reach_x + 1, grid_width_);
+    const int span_y = std::min(2 * reach_y + 1, grid_height_);
+    const int first_x = span_x == grid_width_ ? 0 : get_cell_x(x) - reach_x + grid_width_;
+    const int first_y = span_y == grid_height_ ? 0 : get_cell_y(y) - reach_y + grid_height_;
+
+    for (int r = 0; r < span_y; ++r) {
+        const int row = (first_y + r) % grid_height_;
+        for (int c = 0; c < span_x; ++c) {
+            out.push_back(get_cell_index((first_x + c) % grid_width_, row));
         }
     }
 }
 
-int SpatialGrid::get_cell_x(float x) const {
-    return static_cast<int>(x / cell_size_);
+void SpatialGrid::reserve(size_t capacity) {
+    particle_cell_.reserve(capacity);
+    cell_indices_.reserve(capacity);
 }
 
-int SpatialGrid::get_cell_y(float y) const {
-    return static_cast<int>(y / cell_size_);
+void SpatialGrid::insert_parallel(const std::vector<float>& x, const std::vector<float>& y, size_t count) {
+    const int n = static_cast<int>(count);
+    particle_cell_.resize(count);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) {
+        particle_cell_[i] = static_cast<uint32_t>(cell_of(x[i], y[i]));
+    }
+
+    insert_cells(particle_cell_);
 }
 
-int SpatialGrid::get_cell_index(int cell_x, int cell_y) const {
-    return cell_y * grid_width_ + cell_x;
+void SpatialGrid::insert_cells(std::span<const uint32_t> particle_cells) {
+    const int cells = num_cells();
+    const size_t count = particle_cells.size();
+
+    cell_indices_.resize(count);
+    identity_order_ = false;
+    if (particle_cells.data() != particle_cell_.data()) {
+        particle_cell_.assign(particle_cells.begin(), particle_cells.end());
+    }
+
+    // Counting sort in two levels, so the scratch grows with the cell count
+    // plus threads x blocks rather than threads x cells. First each thread
+    // counts its static particle chunk per block of cells, the counts are
+    // scanned, and the chunks are scattered into block_order_ grouped by
+    // block. Then each block is counted and scattered into its own cells by
+    // one thread, using cell_start_ itself for the counts. Chunks and blocks
+    // both keep ascending index order, so indices stay sorted within a cell
+    // regardless of the thread count.
+#pragma omp parallel
+    {
+        const int tid = omp_get_thread_num();
+        const int num_threads = omp_get_num_threads();
+        // With one thread the particles are already in block order.
+        const int target_blocks = num_threads > 1 ? std::min(cells, num_threads * INSERT_BLOCKS_PER_THREAD) : 1;
+        const int block_cells = (cells + target_blocks - 1) / target_blocks;
+        const int blocks = (cells + block_cells - 1) / block_cells;
+
+#pragma omp single
+        {
+            thread_counts_.assign(static_cast<size_t>(num_threads) * blocks, 0);
+            block_sums_.assign(blocks + 1, 0);
+            if (blocks > 1) block_order_.resize(count);
+        }
+
+        const size_t begin = count * tid / num_threads;
+        const size_t end = count * (tid + 1) / num_threads;
+        uint32_t* counts = thread_counts_.data() + static_cast<size_t>(tid) * blocks;
+
+        if (blocks > 1) {
+            for (size_t i = begin; i < end; ++i) {
+                counts[particle_cells[i] / block_cells]++;
+            }
+
+#pragma omp barrier
+#pragma omp single
+            {
+                // Block by block, then thread by thread within a block.
+                uint32_t total = 0;
+                for (int block = 0; block < blocks; ++block) {
+                    block_sums_[block] = total;
+                    for (int t = 0; t < num_threads; ++t) {
+                        uint32_t& n = thread_counts_[static_cast<size_t>(t) * blocks + block];
+                        const uint32_t thread_count = n;
+                        n = total;
+                        total += thread_count;
+                    }
+                }
+                block_sums_[blocks] = total;
+            }
+
+            for (size_t i = begin; i < end; ++i) {
+                block_order_[counts[particle_cells[i] / block_cells]++] = static_cast<uint32_t>(i);
+            }
+
+#pragma omp barrier
+        } else {
+#pragma omp single
+            block_sums_[1] = static_cast<uint32_t>(count);
+        }
+
+#pragma omp for schedule(dynamic, 1)
+        for (int block = 0; block < blocks; ++block) {
+            const int first_cell = block * block_cells;
+            const int last_cell = std::min(cells, first_cell + block_cells);
+            const uint32_t first = block_sums_[block];
+            const uint32_t last = block_sums_[block + 1];
+            auto slot = [&](uint32_t k) { return blocks > 1 ? block_order_[k] : k; };
+
+            std::fill(cell_start_.begin() + first_cell, cell_start_.begin() + last_cell, 0);
+            for (uint32_t k = first; k < last; ++k) {
+                cell_start_[particle_cells[slot(k)]]++;
+            }
+
+            // cell_start_[c] becomes the end of cell c, and scattering the
+            // block backwards moves it down to the start.
+            uint32_t running = first;
+            for (int c = first_cell; c < last_cell; ++c) {
+                running += cell_start_[c];
+                cell_start_[c] = running;
+            }
+            for (uint32_t k = last; k-- > first;) {
+                const uint32_t i = slot(k);
+                cell_indices_[--cell_start_[particle_cells[i]]] = i;
+            }
+        }
+    }
+    cell_start_[cells] = static_cast<uint32_t>(count);
 }
 
-void SpatialGrid::insert_parallel(const std::vector<float>& x, const std::vector<float>& y, size_t count) {
-    clear();
+bool SpatialGrid::update_cells(std::span<const uint32_t> particle_cells, size_t max_moved) {
+    const size_t count = particle_cells.size();
+    if (count != particle_cell_.size() || count != cell_indices_.size()) {
+        last_moved_ = count;
+        return false;
+    }
 
-    std::vector<int> cell_counts(cells_.size(), 0);
+    // Collect the slots whose cell changed: each thread scans a static chunk
+    // into its own list, in ascending order, and only counts past max_moved.
+    const size_t max_threads = static_cast<size_t>(omp_get_max_threads());
+    if (thread_movers_.size() < max_threads) thread_movers_.resize(max_threads);
+    size_t moved = 0;
+    int chunks = 1;
 
-#pragma omp parallel for
-    for (int i = 0; i < static_cast<int>(count); ++i) {
-        int cell_x = get_cell_x(x[i]);
-        int cell_y = get_cell_y(y[i]);
-
-        if (cell_x >= 0 && cell_x < grid_width_ && cell_y >= 0 && cell_y < grid_height_) {
-            int idx = get_cell_index(cell_x, cell_y);
-#pragma omp atomic
-            cell_counts[idx]++;
+#pragma omp parallel reduction(+ : moved)
+    {
+        const int tid = omp_get_thread_num();
+        const int num_threads = omp_get_num_threads();
+        if (tid == 0) chunks = num_threads;
+
+        std::vector<uint32_t>& local = thread_movers_[tid];
+        local.clear();
+        const size_t begin = count * tid / num_threads;
+        const size_t end = count * (tid + 1) / num_threads;
+        for (size_t i = begin; i < end; ++i) {
+            if (particle_cells[i] != particle_cell_[i] && ++moved <= max_moved) {
+                local.push_back(static_cast<uint32_t>(i));
+            }
         }
     }
 
-    for (size_t i = 0; i < cells_.size(); ++i) {
-        cells_[i].reserve(cell_counts[i]);
+    last_moved_ = moved;
+    if (moved > max_moved) return false;
+    if (moved == 0) return true;
+
+    movers_.clear();
+    for (int t = 0; t < chunks; ++t) {
+        movers_.insert(movers_.end(), thread_movers_[t].begin(), thread_movers_[t].end());
+    }
+
+    // Per block of cells, the net change in particles and the arrivals, then
+    // both as prefix sums; the departed cells are flagged for the merge.
+    const int cells = num_cells();
+    const int num_blocks = (cells + UPDATE_BLOCK_CELLS - 1) / UPDATE_BLOCK_CELLS;
+    if (cell_departed_.size() != static_cast<size_t>(cells)) cell_departed_.assign(cells, 0);
+    block_shift_.assign(num_blocks + 1, 0);
+    block_arrivals_.assign(num_blocks + 1, 0);
+
+    for (uint32_t i : movers_) {
+        const uint32_t from = particle_cell_[i];
+        const uint32_t to = particle_cells[i];
+        cell_departed_[from] = 1;
+        --block_shift_[from / UPDATE_BLOCK_CELLS + 1];
+        ++block_shift_[to / UPDATE_BLOCK_CELLS + 1];
+        ++block_arrivals_[to / UPDATE_BLOCK_CELLS + 1];
     }
+    for (int b = 0; b < num_blocks; ++b) {
+        block_shift_[b + 1] += block_shift_[b];
+        block_arrivals_[b + 1] += block_arrivals_[b];
+    }
+
+    // Arrivals keyed by (cell, slot) and bucketed by block; each block sorts
+    // its own bucket in the merge.
+    block_cursor_.assign(block_arrivals_.begin(), block_arrivals_.end() - 1);
+    arrivals_.resize(moved);
+    for (uint32_t i : movers_) {
+        const uint32_t to = particle_cells[i];
+        arrivals_[block_cursor_[to / UPDATE_BLOCK_CELLS]++] = (static_cast<uint64_t>(to) << 32) | i;
+    }
+
+    next_start_.resize(cells + 1);
+    next_indices_.resize(count);
+    const uint32_t* start = cell_start_.data();
+    const uint32_t* indices = cell_indices_.data();
+    const uint32_t* new_cell = particle_cells.data();
+    uint32_t* out_start = next_start_.data();
+    uint32_t* out_indices = next_indices_.data();
+    uint8_t* departed = cell_departed_.data();
 
-    for (size_t i = 0; i < count; ++i) {
-        int cell_x = get_cell_x(x[i]);
-        int cell_y = get_cell_y(y[i]);
+    // Runs of cells nobody left or entered are copied as they are; the
+    // others keep the particles that stayed, merged by slot with their
+    // arrivals.
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < num_blocks; ++b) {
+        uint64_t* in = arrivals_.data() + block_arrivals_[b];
+        uint64_t* in_end = arrivals_.data() + block_arrivals_[b + 1];
+        std::sort(in, in_end);
 
-        if (cell_x >= 0 && cell_x < grid_width_ && cell_y >= 0 && cell_y < grid_height_) {
-            int idx = get_cell_index(cell_x, cell_y);
-            cells_[idx].push_back(i);
+        const int first = b * UPDATE_BLOCK_CELLS;
+        const int last = std::min(cells, first + UPDATE_BLOCK_CELLS);
+        uint32_t out = static_cast<uint32_t>(start[first] + block_shift_[b]);
+
+        for (int c = first; c < last;) {
+            const int next_arrival = in != in_end ? static_cast<int>(*in >> 32) : last;
+            int stop = c;
+            while (stop < next_arrival && !departed[stop]) ++stop;
+
+            const int64_t shift = static_cast<int64_t>(out) - start[c];
+            for (int r = c; r < stop; ++r) {
+                out_start[r] = static_cast<uint32_t>(start[r] + shift);
+            }
+            std::copy(indices + start[c], indices + start[stop], out_indices + out);
+            out += start[stop] - start[c];
+            if (stop == last) break;
+
+            c = stop;
+            out_start[c] = out;
+            departed[c] = 0;
+            auto arriving = [&] { return in != in_end && static_cast<int>(*in >> 32) == c; };
+            for (uint32_t k = start[c]; k < start[c + 1]; ++k) {
+                const uint32_t slot = indices[k];
+                if (new_cell[slot] != static_cast<uint32_t>(c)) continue;
+                while (arriving() && static_cast<uint32_t>(*in) < slot) out_indices[out++] = static_cast<uint32_t>(*in++);
+                out_indices[out++] = slot;
+            }
+            while (arriving()) out_indices[out++] = static_cast<uint32_t>(*in++);
+            ++c;
         }
     }
+    out_start[cells] = static_cast<uint32_t>(count);
+
+    for (uint32_t i : movers_) {
+        particle_cell_[i] = particle_cells[i];
+    }
+
+    cell_start_.swap(next_start_);
+    cell_indices_.swap(next_indices_);
+    identity_order_ = false;
+    return true;
 }
\ No newline at end of file
@@ -2,26 +2,189 @@
 #define SPATIAL_GRID_HPP
 
 #include <vector>
+#include <algorithm>
 #include <cstdint>
+#include <span>
+
+// Largest stencil reach in cells, i.e. cells as narrow as a third of the
+// interaction radius.
+constexpr int MAX_GRID_REACH = 3;
+constexpr int MAX_NEIGHBOR_CELLS = (2 * MAX_GRID_REACH + 1) * (2 * MAX_GRID_REACH + 1);
+// One slot range per stencil row, split in two where the row wraps.
+constexpr int MAX_NEIGHBOR_RANGES = 2 * (2 * MAX_GRID_REACH + 1);
 
 class SpatialGrid {
 public:
-    SpatialGrid(float width, float height, float cell_size);
+    // Cells are at least cell_size wide and the neighbor stencil reaches
+    // `reach` cells each way, so it covers any radius up to reach * cell_size.
+    SpatialGrid(float width, float height, float cell_size, int reach = 1);
 
     void clear();
-    void insert(size_t particle_idx, float x, float y);
-    void query_neighbors(float x, float y, std::vector<size_t>& neighbors);
     void insert_parallel(const std::vector<float>& x, const std::vector<float>& y, size_t count);
+    // Same as insert_parallel, from cell indices already computed with cell_of().
+    void insert_cells(std::span<const uint32_t> particle_cells);
+    // Incremental counterpart of insert_cells for the same slots after the
+    // particles moved: only those whose cell changed are taken out and merged
+    // back in, giving the same order a full insert would. Returns false, with
+    // the grid untouched, when more than max_moved particles changed cells or
+    // the count differs from the last insert.
+    bool update_cells(std::span<const uint32_t> particle_cells, size_t max_moved);
+    // Particles that changed cells in the last update_cells call.
+    size_t last_moved() const { return last_moved_; }
+    // Cell of each slot as of the last insert or update.
+    std::span<const uint32_t> slot_cells() const { return particle_cell_; }
+    // Sizes the per-particle arrays for up to capacity particles.
+    void reserve(size_t capacity);
+
+    int num_cells() const { return grid_width_ * grid_height_; }
+    float cell_size() const { return cell_size_; }
+    int reach() const { return reach_; }
+    int grid_width() const { return grid_width_; }
+    int grid_height() const { return grid_height_; }
+    float width() const { return width_; }
+    float height() const { return height_; }
+    float cell_width() const { return width_ / grid_width_; }
+    float cell_height() const { return height_ / grid_height_; }
+
+    // Mean, over particles, of the particles in their stencil (including
+    // themselves), i.e. the candidates a gather pass tests per particle.
+    double mean_neighbor_candidates() const;
+
+    std::span<const uint32_t> cell(int cell_idx) const {
+        return {cell_indices_.data() + cell_start_[cell_idx], cell_indices_.data() + cell_start_[cell_idx + 1]};
+    }
+
+    // Particle indices of all cells back to back, i.e. the cell-sorted permutation.
+    std::span<const uint32_t> sorted_indices() const { return cell_indices_; }
+
+    // Cell c occupies [cell_begin(c), cell_end(c)) of sorted_indices(). Once the
+    // particle arrays have been physically reordered by that permutation,
+    // mark_sorted() makes the indices the identity so the ranges are slots.
+    void mark_sorted();
+    // True between mark_sorted() and the next insert, when sorted_indices()[k] == k.
+    bool identity_order() const { return identity_order_; }
+    uint32_t cell_begin(int cell_idx) const { return cell_start_[cell_idx]; }
+    uint32_t cell_end(int cell_idx) const { return cell_start_[cell_idx + 1]; }
+
+    int cell_of(float x, float y) const { return get_cell_index(get_cell_x(x), get_cell_y(y)); }
+
+    // Calls visit(neighbor_cell_idx) for the (2 * reach + 1)^2 block around
+    // cell_idx on the torus, row by row. Every cell is visited at most once,
+    // also on grids narrower than the stencil where it would overlap itself.
+    template <typename Visitor>
+    void for_each_neighbor_cell(int cell_idx, Visitor&& visit) const {
+        int cols[2 * MAX_GRID_REACH + 1];
+        int rows[2 * MAX_GRID_REACH + 1];
+        int num_cols = wrapped_neighbors(cell_idx % grid_width_, grid_width_, reach_, cols);
+        int num_rows = wrapped_neighbors(cell_idx / grid_width_, grid_height_, reach_, rows);
+
+        for (int r = 0; r < num_rows; ++r) {
+            for (int c = 0; c < num_cols; ++c) {
+                visit(get_cell_index(cols[c], rows[r]));
+            }
+        }
+    }
+
+    // Calls visit(std::span<const uint32_t>) with the particle indices of each
+    // cell around (x, y), straight out of the grid storage.
+    template <typename Visitor>
+    void for_each_neighbor(float x, float y, Visitor&& visit) const {
+        for_each_neighbor_cell(cell_of(x, y), [&](int neighbor) { visit(cell(neighbor)); });
+    }
+
+    // Forward half of the stencil (the cells east in the same row, then the
+    // full rows to the north), so that each unordered pair of cells within
+    // reach is visited from exactly one side. Only valid when
+    // supports_half_stencil().
+    template <typename Visitor>
+    void for_each_forward_neighbor_cell(int cell_idx, Visitor&& visit) const {
+        int cols[2 * MAX_GRID_REACH + 1] = {};
+        int rows[2 * MAX_GRID_REACH + 1] = {};
+        wrapped_neighbors(cell_idx % grid_width_, grid_width_, reach_, cols);
+        wrapped_neighbors(cell_idx / grid_width_, grid_height_, reach_, rows);
+
+        const int span = 2 * reach_ + 1;
+        for (int c = reach_ + 1; c < span; ++c) {
+            visit(get_cell_index(cols[c], rows[reach_]));
+        }
+        for (int r = reach_ + 1; r < span; ++r) {
+            for (int c = 0; c < span; ++c) {
+                visit(get_cell_index(cols[c], rows[r]));
+            }
+        }
+    }
+
+    bool supports_half_stencil() const {
+        return grid_width_ >= 2 * reach_ + 1 && grid_height_ >= 2 * reach_ + 1;
+    }
+
+    // Cells that may hold a point within radius of (x, y) on the torus, each
+    // listed once even when the radius wraps around the whole world.
+    void cells_in_radius(float x, float y, float radius, std::vector<int>& out) const;
+
+    // out must hold MAX_NEIGHBOR_CELLS entries.
+    int neighbor_cells(int cell_idx, int* out) const;
+
+    // The stencil as slot ranges of sorted_indices(), in visiting order with
+    // empty cells dropped and cells that are adjacent in storage merged.
+    // begin/end must hold MAX_NEIGHBOR_RANGES entries.
+    int neighbor_ranges(int cell_idx, uint32_t* begin, uint32_t* end) const;
 
 private:
     float width_, height_;
     float cell_size_;
+    int reach_;
     int grid_width_, grid_height_;
-    std::vector<std::vector<size_t>> cells_;
+    // Cells tile the world exactly, so they are stretched to at least cell_size_
+    // and the wrapped stencil covers the full interaction radius at the seam.
+    float inv_cell_width_, inv_cell_height_;
+
+    // Compressed cell storage: the particles of cell c are
+    // cell_indices_[cell_start_[c] .. cell_start_[c + 1]), in ascending index order.
+    std::vector<uint32_t> cell_start_;
+    std::vector<uint32_t> cell_indices_;
+    std::vector<uint32_t> particle_cell_;
+    // insert_cells scratch.
+    std::vector<uint32_t> thread_counts_;
+    std::vector<uint32_t> block_sums_;
+    std::vector<uint32_t> block_order_;
+    bool identity_order_ = false;
+
+    // update_cells scratch; cell_departed_ is kept zeroed between calls.
+    std::vector<std::vector<uint32_t>> thread_movers_;
+    std::vector<uint32_t> movers_;
+    std::vector<uint64_t> arrivals_;
+    std::vector<uint8_t> cell_departed_;
+    std::vector<int64_t> block_shift_;
+    std::vector<uint32_t> block_arrivals_;
+    std::vector<uint32_t> block_cursor_;
+    std::vector<uint32_t> next_start_;
+    std::vector<uint32_t> next_indices_;
+    size_t last_moved_ = 0;
+
+    int get_cell_x(float x) const {
+        return std::clamp(static_cast<int>(x * inv_cell_width_), 0, grid_width_ - 1);
+    }
+    int get_cell_y(float y) const {
+        return std::clamp(static_cast<int>(y * inv_cell_height_), 0, grid_height_ - 1);
+    }
+    int get_cell_index(int cell_x, int cell_y) const { return cell_y * grid_width_ + cell_x; }
 
-    int get_cell_x(float x) const;
-    int get_cell_y(float y) const;
-    int get_cell_index(int cell_x, int cell_y) const;
+    static int wrapped_neighbors(int center, int extent, int reach, int* out) {
+        const int span = 2 * reach + 1;
+        if (extent < span) {
+            for (int i = 0; i < extent; ++i) {
+                out[i] = i;
+            }
+            return extent;
+        }
+        int index = center - reach + (center < reach ? extent : 0);
+        for (int i = 0; i < span; ++i) {
+            out[i] = index;
+            index = index == extent - 1 ? 0 : index + 1;
+        }
+        return span;
+    }
 };
 
 #endif
\ No newline at end of file
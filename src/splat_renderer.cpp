@@ -0,0 +1,394 @@
+#include "splat_renderer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <omp.h>
+
+// Rows per band; with discs of at most MAX_SPLAT_RADIUS, the rows touched
+// from two bands two apart never overlap.
+constexpr int BAND_ROWS = 2 * MAX_SPLAT_RADIUS + 2;
+// Below one particle per DIRECT_SPLAT_PIXELS pixels, stamping each disc
+// costs less than convolving the whole image with it.
+constexpr size_t DIRECT_SPLAT_PIXELS = 8;
+// Columns per task of the vertical blur and rows per task of the horizontal
+// one, summed side by side in one pass.
+constexpr int BLUR_STRIP = 64;
+constexpr int BLUR_ROWS = 8;
+
+std::vector<Rgb8> type_palette(int count) {
+    static const Rgb8 classic[] = {
+        {0, 0, 255},
+        {255, 0, 0},
+        {255, 0, 255},
+        {255, 255, 0},
+        {0, 255, 0},
+        {255, 165, 0}
+    };
+    const int num_classic = sizeof(classic) / sizeof(classic[0]);
+
+    std::vector<Rgb8> palette(count);
+    for (int t = 0; t < count; ++t) {
+        if (t < num_classic) {
+            palette[t] = classic[t];
+            continue;
+        }
+
+        // HSV to RGB, alternating the saturation to separate similar hues.
+        const float h = std::fmod(t * 137.508f, 360.0f) / 60.0f;
+        const float s = t % 2 ? 0.55f : 0.9f;
+        const float c = s;
+        const float x = c * (1.0f - std::fabs(std::fmod(h, 2.0f) - 1.0f));
+        const float m = 1.0f - c;
+        float r = 0.0f, g = 0.0f, b = 0.0f;
+        switch (static_cast<int>(h)) {
+            case 0: r = c; g = x; break;
+            case 1: r = x; g = c; break;
+            case 2: g = c; b = x; break;
+            case 3: g = x; b = c; break;
+            case 4: r = x; b = c; break;
+            default: r = c; b = x; break;
+        }
+        palette[t] = {static_cast<uint8_t>((r + m) * 255.0f), static_cast<uint8_t>((g + m) * 255.0f),
+                      static_cast<uint8_t>((b + m) * 255.0f)};
+    }
+    return palette;
+}
+
+void SplatRenderer::resize(int width, int height) {
+    if (width == width_ && height == height_) return;
+
+    width_ = width;
+    height_ = height;
+    num_bands_ = (height + BAND_ROWS - 1) / BAND_ROWS;
+
+    const size_t plane = static_cast<size_t>(width) * height;
+    splats_.assign(3 * plane, 0.0f);
+    trail_.assign(3 * plane, 0.0f);
+    glow_width_ = (width + 1) / 2;
+    glow_height_ = (height + 1) / 2;
+    glow_.assign(3 * static_cast<size_t>(glow_width_) * glow_height_, 0.0f);
+    scratch_.assign(3 * plane, 0.0f);
+    pixels_.assign(4 * plane, 255);
+    band_start_.assign(num_bands_ + 1, 0);
+}
+
+void SplatRenderer::clear() {
+    std::fill(trail_.begin(), trail_.end(), 0.0f);
+}
+
+void SplatRenderer::render(const float* x, const float* y, const uint8_t* type, size_t count, int num_types,
+                           float scale_x, float scale_y, const Rgb8* colors) {
+    if (width_ == 0 || height_ == 0) return;
+
+    const float size = std::clamp(particle_size, 0.5f, static_cast<float>(MAX_SPLAT_RADIUS));
+    if (size != stamp_size_) {
+        // Same coverage as the viewer's circle texture: full inside, a one
+        // pixel ramp at the rim.
+        stamp_reach_ = std::min(static_cast<int>(std::ceil(size)), MAX_SPLAT_RADIUS);
+        const int span = 2 * stamp_reach_ + 1;
+        stamp_.resize(span * span);
+        for (int dy = -stamp_reach_; dy <= stamp_reach_; ++dy) {
+            for (int dx = -stamp_reach_; dx <= stamp_reach_; ++dx) {
+                const float dist = std::sqrt(static_cast<float>(dx * dx + dy * dy));
+                stamp_[(dy + stamp_reach_) * span + dx + stamp_reach_] = std::clamp(size + 0.5f - dist, 0.0f, 1.0f);
+            }
+        }
+        stamp_size_ = size;
+    }
+
+    for (int t = 0; t < num_types; ++t) {
+        palette_[t][0] = colors[t].r / 255.0f;
+        palette_[t][1] = colors[t].g / 255.0f;
+        palette_[t][2] = colors[t].b / 255.0f;
+    }
+
+    bin(y, count, scale_y);
+    splat(x, y, type, scale_x, scale_y);
+    if (glow > 0.0f) {
+        blur();
+    }
+    resolve();
+}
+
+// Counting sort of the particles by band, as SpatialGrid::insert_cells does
+// by cell, over static per-thread chunks so the order within a band is the
+// slot order for any thread count.
+void SplatRenderer::bin(const float* y, size_t count, float scale_y) {
+    particle_band_.resize(count);
+    band_order_.resize(count);
+    const int last_row = height_ - 1;
+
+#pragma omp parallel
+    {
+        const int tid = omp_get_thread_num();
+        const int num_threads = omp_get_num_threads();
+
+#pragma omp single
+        thread_counts_.assign(static_cast<size_t>(num_threads) * num_bands_, 0);
+
+        const size_t begin = count * tid / num_threads;
+        const size_t end = count * (tid + 1) / num_threads;
+        uint32_t* counts = thread_counts_.data() + static_cast<size_t>(tid) * num_bands_;
+
+        for (size_t i = begin; i < end; ++i) {
+            const uint32_t band = std::clamp(static_cast<int>(y[i] * scale_y), 0, last_row) / BAND_ROWS;
+            particle_band_[i] = band;
+            counts[band]++;
+        }
+
+#pragma omp barrier
+#pragma omp single
+        {
+            uint32_t total = 0;
+            for (int b = 0; b < num_bands_; ++b) {
+                band_start_[b] = total;
+                for (int t = 0; t < num_threads; ++t) {
+                    uint32_t& n = thread_counts_[static_cast<size_t>(t) * num_bands_ + b];
+                    const uint32_t thread_count = n;
+                    n = total;
+                    total += thread_count;
+                }
+            }
+            band_start_[num_bands_] = total;
+        }
+
+        for (size_t i = begin; i < end; ++i) {
+            band_order_[counts[particle_band_[i]]++] = static_cast<uint32_t>(i);
+        }
+    }
+}
+
+void SplatRenderer::splat(const float* x, const float* y, const uint8_t* type, float scale_x, float scale_y) {
+    const size_t plane = static_cast<size_t>(width_) * height_;
+    if (static_cast<size_t>(band_start_[num_bands_]) * DIRECT_SPLAT_PIXELS < plane) {
+        std::fill(splats_.begin(), splats_.end(), 0.0f);
+        splat_discs(x, y, type, scale_x, scale_y);
+    } else {
+        std::fill(scratch_.begin(), scratch_.end(), 0.0f);
+        splat_points(x, y, type, scale_x, scale_y);
+        convolve_stamp();
+    }
+}
+
+void SplatRenderer::splat_discs(const float* x, const float* y, const uint8_t* type, float scale_x, float scale_y) {
+    const size_t plane = static_cast<size_t>(width_) * height_;
+    const int reach = stamp_reach_;
+    const int span = 2 * reach + 1;
+
+    for (int parity = 0; parity < 2; ++parity) {
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int b = parity; b < num_bands_; b += 2) {
+            float* red = splats_.data();
+            float* green = red + plane;
+            float* blue = green + plane;
+
+            for (uint32_t k = band_start_[b]; k < band_start_[b + 1]; ++k) {
+                const uint32_t i = band_order_[k];
+                const int cx = std::clamp(static_cast<int>(x[i] * scale_x), 0, width_ - 1);
+                const int cy = std::clamp(static_cast<int>(y[i] * scale_y), 0, height_ - 1);
+                const float* color = palette_[type[i]];
+
+                const int x0 = std::max(cx - reach, 0);
+                const int x1 = std::min(cx + reach, width_ - 1);
+                const int y0 = std::max(cy - reach, 0);
+                const int y1 = std::min(cy + reach, height_ - 1);
+
+                for (int py = y0; py <= y1; ++py) {
+                    const float* weights = stamp_.data() + (py - cy + reach) * span + (x0 - cx + reach);
+                    const size_t first = static_cast<size_t>(py) * width_ + x0;
+#pragma omp simd
+                    for (int col = 0; col <= x1 - x0; ++col) {
+                        red[first + col] += weights[col] * color[0];
+                        green[first + col] += weights[col] * color[1];
+                        blue[first + col] += weights[col] * color[2];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Adds each particle's color to its center pixel in scratch_. A point only
+// touches its own band, so all bands run at once.
+void SplatRenderer::splat_points(const float* x, const float* y, const uint8_t* type, float scale_x, float scale_y) {
+    const size_t plane = static_cast<size_t>(width_) * height_;
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < num_bands_; ++b) {
+        float* red = scratch_.data();
+        float* green = red + plane;
+        float* blue = green + plane;
+
+        for (uint32_t k = band_start_[b]; k < band_start_[b + 1]; ++k) {
+            const uint32_t i = band_order_[k];
+            const int cx = std::clamp(static_cast<int>(x[i] * scale_x), 0, width_ - 1);
+            const int cy = std::clamp(static_cast<int>(y[i] * scale_y), 0, height_ - 1);
+            const float* color = palette_[type[i]];
+            const size_t p = static_cast<size_t>(cy) * width_ + cx;
+            red[p] += color[0];
+            green[p] += color[1];
+            blue[p] += color[2];
+        }
+    }
+}
+
+// Convolves the points in scratch_ with the disc into splats_, the same sum
+// splat_discs builds, one row at a time with a vector pass per stamp weight.
+void SplatRenderer::convolve_stamp() {
+    const int w = width_;
+    const int h = height_;
+    const int reach = stamp_reach_;
+    const int span = 2 * reach + 1;
+
+#pragma omp parallel for schedule(static)
+    for (int row = 0; row < 3 * h; ++row) {
+        const int py = row % h;
+        const float* points = scratch_.data() + static_cast<size_t>(row - py) * w;
+        float* out = splats_.data() + static_cast<size_t>(row) * w;
+        std::fill(out, out + w, 0.0f);
+
+        for (int dy = -reach; dy <= reach; ++dy) {
+            if (py - dy < 0 || py - dy >= h) continue;
+            const float* in = points + static_cast<size_t>(py - dy) * w;
+            const float* weights = stamp_.data() + (dy + reach) * span + reach;
+
+            for (int dx = -reach; dx <= reach; ++dx) {
+                const float weight = weights[dx];
+                if (weight == 0.0f) continue;
+                const int x0 = std::max(dx, 0);
+                const int x1 = std::min(w, w + dx);
+#pragma omp simd
+                for (int px = x0; px < x1; ++px) {
+                    out[px] += weight * in[px - dx];
+                }
+            }
+        }
+    }
+}
+
+// The glow is computed at half resolution: the splats are averaged over
+// 2x2 blocks into glow_, then two passes of a box blur, each a horizontal
+// running sum per row and a vertical one over strips of columns, approximate
+// a Gaussian at a cost independent of glow_radius.
+void SplatRenderer::blur() {
+    const int w = glow_width_;
+    const int h = glow_height_;
+    const int r = std::clamp(glow_radius / 2, 1, std::max(std::min(w, h) / 2, 1));
+    const float inv_window = 1.0f / (2 * r + 1);
+    const size_t plane = static_cast<size_t>(w) * h;
+    const size_t full_plane = static_cast<size_t>(width_) * height_;
+    const int strips = (w + BLUR_STRIP - 1) / BLUR_STRIP;
+
+#pragma omp parallel for schedule(static)
+    for (int row = 0; row < 3 * h; ++row) {
+        const int gy = row % h;
+        const float* top = splats_.data() + (row / h) * full_plane + static_cast<size_t>(2 * gy) * width_;
+        const float* bottom = 2 * gy + 1 < height_ ? top + width_ : top;
+        float* out = glow_.data() + static_cast<size_t>(row) * w;
+        for (int gx = 0; gx < w; ++gx) {
+            const int x0 = 2 * gx;
+            const int x1 = std::min(x0 + 1, width_ - 1);
+            out[gx] = 0.25f * (top[x0] + top[x1] + bottom[x0] + bottom[x1]);
+        }
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        // BLUR_ROWS rows side by side, so their running sums do not wait on
+        // each other.
+#pragma omp parallel for schedule(static)
+        for (int task = 0; task < (3 * h + BLUR_ROWS - 1) / BLUR_ROWS; ++task) {
+            const int rows = std::min(BLUR_ROWS, 3 * h - task * BLUR_ROWS);
+            const float* in = glow_.data() + static_cast<size_t>(task) * BLUR_ROWS * w;
+            float* out = scratch_.data() + static_cast<size_t>(task) * BLUR_ROWS * w;
+            float sum[BLUR_ROWS] = {};
+
+            for (int px = 0; px < r; ++px) {
+                for (int k = 0; k < rows; ++k) sum[k] += in[k * w + px];
+            }
+            for (int px = 0; px < w; ++px) {
+                if (px + r < w) {
+                    for (int k = 0; k < rows; ++k) sum[k] += in[k * w + px + r];
+                }
+                for (int k = 0; k < rows; ++k) out[k * w + px] = sum[k] * inv_window;
+                if (px - r >= 0) {
+                    for (int k = 0; k < rows; ++k) sum[k] -= in[k * w + px - r];
+                }
+            }
+        }
+
+#pragma omp parallel for schedule(static)
+        for (int task = 0; task < 3 * strips; ++task) {
+            const size_t offset = (task / strips) * plane + (task % strips) * BLUR_STRIP;
+            const int columns = std::min(BLUR_STRIP, w - (task % strips) * BLUR_STRIP);
+            const float* in = scratch_.data() + offset;
+            float* out = glow_.data() + offset;
+            float sum[BLUR_STRIP] = {};
+
+            for (int py = 0; py < r; ++py) {
+#pragma omp simd
+                for (int c = 0; c < columns; ++c) sum[c] += in[static_cast<size_t>(py) * w + c];
+            }
+            for (int py = 0; py < h; ++py) {
+                const float* enter = in + static_cast<size_t>(py + r) * w;
+                const float* leave = in + static_cast<size_t>(py - r) * w;
+                float* dst = out + static_cast<size_t>(py) * w;
+                if (py + r < h) {
+#pragma omp simd
+                    for (int c = 0; c < columns; ++c) sum[c] += enter[c];
+                }
+#pragma omp simd
+                for (int c = 0; c < columns; ++c) dst[c] = sum[c] * inv_window;
+                if (py - r >= 0) {
+#pragma omp simd
+                    for (int c = 0; c < columns; ++c) sum[c] -= leave[c];
+                }
+            }
+        }
+    }
+}
+
+// Fades the trail, takes the brighter of it and the new splats, adds the
+// glow from its half resolution pixel and converts to bytes.
+void SplatRenderer::resolve() {
+    const size_t plane = static_cast<size_t>(width_) * height_;
+    const size_t glow_plane = static_cast<size_t>(glow_width_) * glow_height_;
+    const float decay = std::clamp(trail_decay, 0.0f, 1.0f);
+    const float strength = glow;
+
+#pragma omp parallel for schedule(static)
+    for (int row = 0; row < height_; ++row) {
+        const size_t first = static_cast<size_t>(row) * width_;
+        uint8_t* out = pixels_.data() + 4 * first;
+
+        for (int c = 0; c < 3; ++c) {
+            const float* splats = splats_.data() + c * plane + first;
+            const float* blurred = glow_.data() + c * glow_plane + static_cast<size_t>(row / 2) * glow_width_;
+            float* trail = trail_.data() + c * plane + first;
+
+#pragma omp simd
+            for (int px = 0; px < width_; ++px) {
+                const float kept = std::max(trail[px] * decay, splats[px]);
+                trail[px] = kept;
+                const float value = strength > 0.0f ? kept + strength * blurred[px / 2] : kept;
+                out[4 * px + c] = static_cast<uint8_t>(std::min(value, 1.0f) * 255.0f);
+            }
+        }
+    }
+}
+
+bool SplatRenderer::write_ppm(const std::string& path) const {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    const size_t plane = static_cast<size_t>(width_) * height_;
+    std::vector<uint8_t> rgb(3 * plane);
+    for (size_t p = 0; p < plane; ++p) {
+        rgb[3 * p] = pixels_[4 * p];
+        rgb[3 * p + 1] = pixels_[4 * p + 1];
+        rgb[3 * p + 2] = pixels_[4 * p + 2];
+    }
+
+    std::fprintf(file, "P6\n%d %d\n255\n", width_, height_);
+    const bool ok = std::fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+    return std::fclose(file) == 0 && ok;
+}
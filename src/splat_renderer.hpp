@@ -0,0 +1,95 @@
+#ifndef SPLAT_RENDERER_HPP
+#define SPLAT_RENDERER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Rgb8 {
+    uint8_t r, g, b;
+};
+
+// One color per type: the six classic ones, then hues a golden angle apart
+// so that types with nearby indices stay distinguishable.
+std::vector<Rgb8> type_palette(int count);
+
+// Largest disc radius in pixels, so that a particle only touches the row
+// bands next to its own.
+constexpr int MAX_SPLAT_RADIUS = 7;
+
+// Draws particles into a pixel buffer on the CPU, with no graphics API, so
+// the cost follows the pixel count rather than the number of draw calls and
+// the same path serves the viewer and headless frame export.
+//
+// Each frame adds an antialiased disc per particle, tinted by its type, into
+// float RGB planes, so crowded areas get brighter. Particles are binned into
+// bands of rows by a counting sort, and bands two apart never touch the same
+// pixels, so even and odd bands are splatted in two parallel rounds without
+// atomics or per-thread buffers. Above about one particle per 8 pixels,
+// each particle instead adds its color to a single pixel and the image is
+// convolved with the disc, which gives the same sum at a cost set by the
+// pixel count. Glow is a separable box blur of the splats at half
+// resolution added on top; trails keep, per pixel, the brighter of the new
+// splats and the previous image faded by trail_decay.
+class SplatRenderer {
+public:
+    // Disc radius in pixels, at most MAX_SPLAT_RADIUS.
+    float particle_size = 2.0f;
+    // Fraction of the previous image kept each frame; 0 disables trails.
+    float trail_decay = 0.0f;
+    // Strength of the blurred splats added on top; 0 disables glow.
+    float glow = 0.0f;
+    int glow_radius = 6;
+
+    void resize(int width, int height);
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // scale_x/scale_y map world coordinates to pixels; colors has one entry per type.
+    void render(const float* x, const float* y, const uint8_t* type, size_t count, int num_types,
+                float scale_x, float scale_y, const Rgb8* colors);
+    // Forgets the trail history.
+    void clear();
+
+    // width() * height() RGBA pixels, 4 bytes each, top row first.
+    const uint8_t* pixels() const { return pixels_.data(); }
+    // Binary PPM (P6) of the last rendered image.
+    bool write_ppm(const std::string& path) const;
+
+private:
+    void bin(const float* y, size_t count, float scale_y);
+    void splat(const float* x, const float* y, const uint8_t* type, float scale_x, float scale_y);
+    void splat_discs(const float* x, const float* y, const uint8_t* type, float scale_x, float scale_y);
+    void splat_points(const float* x, const float* y, const uint8_t* type, float scale_x, float scale_y);
+    void convolve_stamp();
+    void blur();
+    void resolve();
+
+    int width_ = 0;
+    int height_ = 0;
+    int num_bands_ = 0;
+    int glow_width_ = 0;
+    int glow_height_ = 0;
+
+    // Three planes (red, green, blue) of width_ * height_ floats each, but
+    // glow_width_ * glow_height_ for glow_.
+    std::vector<float> splats_;
+    std::vector<float> trail_;
+    std::vector<float> glow_;
+    std::vector<float> scratch_;
+    std::vector<uint8_t> pixels_;
+
+    float palette_[256][3] = {};
+    // (2 * reach + 1)^2 disc coverage weights for the current particle_size.
+    std::vector<float> stamp_;
+    float stamp_size_ = -1.0f;
+    int stamp_reach_ = 0;
+
+    // Particle indices grouped by band, band b at [band_start_[b], band_start_[b + 1]).
+    std::vector<uint32_t> band_start_;
+    std::vector<uint32_t> band_order_;
+    std::vector<uint32_t> thread_counts_;
+    std::vector<uint32_t> particle_band_;
+};
+
+#endif